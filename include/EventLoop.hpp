@@ -0,0 +1,76 @@
+#ifndef _EVENTLOOP_HPP_
+#define _EVENTLOOP_HPP_
+
+#include <signal.h>
+
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+/* Single threaded reactor on top of epoll.
+ * Everything the daemon waits on (the display connection, the history socket and its clients,
+ * maintenance timers and signals) is an fd registered here, so one thread can sleep on all of them.
+ */
+class CEventLoop
+{
+public:
+    CEventLoop();
+    ~CEventLoop();
+
+    /*
+     * Call func every time fd becomes readable (or gets closed by the other end).
+     * It's safe to add or remove fds from inside the callbacks.
+     */
+    void AddFd(const int fd, const std::function<void()>& func);
+
+    /*
+     * Also call func every time fd, already added with AddFd(), becomes writable.
+     * Pass nullptr to stop, as it's writable most of the time.
+     */
+    void SetWriteHandler(const int fd, const std::function<void()>& func);
+
+    /*
+     * Stop watching fd, it doesn't close it.
+     */
+    void RemoveFd(const int fd);
+
+    /*
+     * Call func every interval, using a timerfd.
+     */
+    void AddTimer(const std::chrono::milliseconds interval, const std::function<void()>& func);
+
+    /*
+     * Call func when the process gets signo, using a signalfd.
+     * The signal gets blocked, so call this before starting any other thread.
+     */
+    void AddSignal(const int signo, const std::function<void()>& func);
+
+    /*
+     * Wait for events and run their callbacks until Stop() is called.
+     */
+    void Run();
+
+    void Stop()
+    { m_Running = false; }
+
+private:
+    int m_EpollFd = -1;
+
+    int m_SignalFd = -1;
+
+    sigset_t m_Signals;
+
+    std::unordered_map<int, std::function<void()>> m_Handlers;
+
+    std::unordered_map<int, std::function<void()>> m_WriteHandlers;
+
+    std::unordered_map<int, std::function<void()>> m_SignalHandlers;
+
+    // timerfds and the signalfd are ours to close
+    std::vector<int> m_OwnedFds;
+
+    bool m_Running = false;
+};
+
+#endif  // !_EVENTLOOP_HPP_
@@ -0,0 +1,27 @@
+#ifndef _FUZZY_MATCH_HPP_
+#define _FUZZY_MATCH_HPP_
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+/*
+ * Check if pattern should be matched ignoring case (smart case, like fzf).
+ * @return true if pattern has no uppercase letter
+ */
+bool fuzzyIgnoreCase(const std::string_view pattern);
+
+/*
+ * Fuzzy match pattern against text, scoring it like fzf:
+ * every byte of pattern has to appear in text in order, and matches get bonuses
+ * when they're consecutive or at the start of a word, while gaps between them cost points.
+ * Entries not containing every byte of pattern are rejected by a SIMD scan before any scoring.
+ * @param ignore_case Ignore ASCII case, then pattern must be lowercase (see fuzzyIgnoreCase())
+ * @param score Where to put the score, higher is better
+ * @param positions If not null, where to put the offsets of the matched bytes in text
+ * @return false if text doesn't match
+ */
+bool fuzzyMatch(const std::string_view text, const std::string_view pattern, const bool ignore_case, int& score,
+                std::vector<size_t>* positions = nullptr);
+
+#endif  // !_FUZZY_MATCH_HPP_
@@ -0,0 +1,174 @@
+#ifndef _SEARCH_HPP_
+#define _SEARCH_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "history/index/TrigramIndex.hpp"
+
+/* Search state of the TUI, over an entry table that doesn't change while searching.
+ * Results are indices into that table, kept as a stack with one level per query typed so far:
+ * typing narrows the results on top into a new level, and backspace just pops back to the previous one.
+ *
+ * Big searches run in the background on a pool of workers, each one matching contiguous shards of the candidates.
+ * A new query cancels the one still running, so the TUI never has to wait for stale results.
+ *
+ * The table may only have the start of the entries, then only that start of the ones cut gets matched,
+ * their whole text is loaded only for showing them.
+ */
+class CSearch
+{
+public:
+    /*
+     * Call func with the whole text of the entries having these ids, like CHistoryBackend::GetEntries().
+     */
+    using BodyLoader = std::function<void(const std::vector<uint32_t>&                          ids,
+                                          const std::function<void(uint32_t, std::string_view)>& func)>;
+
+    /*
+     * entries_value and entries_id are the entry table, sorted by id. They must outlive the search.
+     * @param fuzzy Rank the entries with fuzzyMatch() instead of looking for the exact query
+     * @param previewSize The most entries_value has of each entry, if less than all of them
+     * @param loadBodies Loads their whole text, needed with previewSize
+     */
+    CSearch(const std::vector<std::string_view>& entries_value, const std::vector<uint32_t>& entries_id,
+            const CTrigramIndex& index, const bool fuzzy, const size_t previewSize = SIZE_MAX,
+            BodyLoader loadBodies = nullptr);
+    ~CSearch();
+
+    /*
+     * Start searching query, cancelling the previous search if it's still running.
+     * If a previous query can only match a superset of it (it's a substring of it, or a subsequence when fuzzy),
+     * only the results of that one get checked again.
+     * Small searches are done right away, otherwise call Poll() until IsSearching() is false.
+     */
+    void SetQuery(const std::string& query);
+
+    /*
+     * Take the results of the background search, if it's done.
+     * @return true if the results changed
+     */
+    bool Poll();
+
+    bool IsSearching() const
+    { return m_Searching; }
+
+    /*
+     * Get the indices of the entries matching the last finished query, the best ones first when fuzzy.
+     */
+    const std::vector<size_t>& GetResults() const
+    { return *m_Stack.back().results; }
+
+    /*
+     * Get the offsets of the bytes matched by the last finished query in an entry, for highlighting.
+     * @param i The index of the entry in the table
+     */
+    void GetMatchPositions(const size_t i, std::vector<size_t>& positions) const;
+
+    /*
+     * Get the text of an entry, only its start if it's cut and the bodies aren't loaded yet.
+     * @param i The index of the entry in the table
+     */
+    std::string_view GetText(const size_t i) const
+    { return (*m_Texts)[i]; }
+
+    /*
+     * Check if the text of an entry may be cut, so its body has to be loaded for showing all of it.
+     */
+    bool IsPartial(const size_t i) const;
+
+    /*
+     * Load the whole text of the entries that may be cut among these, in a single call of the loader.
+     * Meant for the few entries shown whole, it reads all of them right away.
+     * @param indices The indices of the entries in the table
+     */
+    void LoadBodies(const std::vector<size_t>& indices);
+
+private:
+    struct Level
+    {
+        std::string query;
+        // shared with the workers, so a popped level stays alive until they're done with it
+        std::shared_ptr<const std::vector<size_t>> results;
+    };
+
+    struct Job
+    {
+        uint64_t    generation;
+        std::string query;
+        bool        ignore_case;
+
+        // what to match, loading more bodies meanwhile gets a new copy of it
+        std::shared_ptr<const std::vector<std::string_view>> texts;
+
+        std::shared_ptr<const std::vector<size_t>> candidates;
+
+        // (score, index) matched by each shard, in table order
+        std::vector<std::vector<std::pair<int, size_t>>> shards;
+
+        size_t next_shard = 0;
+        size_t done       = 0;
+    };
+
+    bool CanNarrow(const std::string& from, const std::string& to) const;
+
+    /*
+     * Match a shard of the job candidates.
+     * @return false if a newer query cancelled the job meanwhile
+     */
+    bool MatchShard(const Job& job, const size_t shard, std::vector<std::pair<int, size_t>>& out) const;
+
+    /*
+     * Merge the shards of a finished job into a level, the best first when fuzzy.
+     */
+    Level MergeShards(Job& job) const;
+
+    void Worker();
+
+    const std::vector<std::string_view>& m_EntriesValue;
+    const std::vector<uint32_t>&         m_EntriesId;
+    const CTrigramIndex&                 m_Index;
+
+    bool m_Fuzzy;
+
+    size_t     m_PreviewSize;
+    BodyLoader m_LoadBodies;
+
+    // the text of every entry, the table one until their body gets loaded
+    std::shared_ptr<std::vector<std::string_view>> m_Texts;
+    std::vector<bool>                              m_BodyLoaded;
+
+    // the bodies loaded so far, a deque so they never move
+    std::deque<std::string> m_Bodies;
+
+    // the bottom level is the empty query, with every entry
+    std::vector<Level> m_Stack;
+
+    // bumped by every SetQuery(), the workers give up on jobs with an older one
+    std::atomic<uint64_t> m_Generation{ 0 };
+
+    bool m_Searching = false;
+
+    std::vector<std::thread> m_Workers;
+    std::mutex               m_Mutex;
+    std::condition_variable  m_WorkCond;
+
+    // guarded by m_Mutex
+    std::shared_ptr<Job>   m_Job;
+    std::unique_ptr<Level> m_Ready;
+    uint64_t               m_ReadyGeneration = 0;
+    bool                   m_Stop            = false;
+};
+
+#endif  // !_SEARCH_HPP_
@@ -0,0 +1,76 @@
+#ifndef _SPSC_QUEUE_HPP_
+#define _SPSC_QUEUE_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/* Bounded lock-free queue between exactly one producer thread and one consumer thread.
+ * Pushing never waits, it fails when the queue is full so the producer can decide what to drop.
+ */
+template <typename T>
+class CSpscQueue
+{
+public:
+    /*
+     * @param capacity Rounded up to a power of two
+     */
+    explicit CSpscQueue(const size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+        m_Slots.resize(size);
+        m_Mask = size - 1;
+    }
+
+    /*
+     * Producer only.
+     * @return false if the queue is full, then value is left as it is
+     */
+    bool Push(T& value)
+    {
+        const size_t head = m_Head.load(std::memory_order_relaxed);
+        if (head - m_Tail.load(std::memory_order_acquire) == m_Slots.size())
+            return false;
+
+        m_Slots[head & m_Mask] = std::move(value);
+        m_Head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /*
+     * Consumer only.
+     * @return false if the queue is empty
+     */
+    bool Pop(T& value)
+    {
+        const size_t tail = m_Tail.load(std::memory_order_relaxed);
+        if (tail == m_Head.load(std::memory_order_acquire))
+            return false;
+
+        value = std::move(m_Slots[tail & m_Mask]);
+        m_Tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /*
+     * Get how many values are queued, from either thread, it may be already outdated.
+     */
+    size_t Size() const
+    {
+        const size_t tail = m_Tail.load(std::memory_order_acquire);
+        return m_Head.load(std::memory_order_acquire) - tail;
+    }
+
+private:
+    std::vector<T> m_Slots;
+    size_t         m_Mask;
+
+    // on their own cache lines, so the two threads don't keep stealing it from each other
+    alignas(64) std::atomic<size_t> m_Head{ 0 };  // written by the producer
+    alignas(64) std::atomic<size_t> m_Tail{ 0 };  // written by the consumer
+};
+
+#endif  // !_SPSC_QUEUE_HPP_
@@ -2,6 +2,7 @@
 #define CLIPBOARD_LISTENER_HPP_
 
 #include <functional>
+#include <string>
 
 #include "EventData.hpp"
 #include "config.hpp"
@@ -19,14 +20,35 @@ public:
     virtual void AddCopyCallback(const std::function<void(const CopyEvent&)>& func) = 0;
 
     /*
-     * Poll for clipboard events, depending on the windowing system this MAY block.
+     * Wait for the next clipboard event and handle it.
+     * Depending on the windowing system this blocks until something changes or sleeps a bit before checking.
      */
     virtual void PollClipboard() = 0;
 
+    /*
+     * Get the fd to wait on (e.g with epoll) before calling ProcessEvents().
+     * -1 means there isn't one, and PollClipboard() must be called periodically instead.
+     */
+    virtual int GetFd() const
+    { return -1; }
+
+    /*
+     * Handle the clipboard events already waiting on GetFd(), without blocking.
+     */
+    virtual void ProcessEvents() {}
+
+    /*
+     * Take the clipboard and serve content from the event loop (see GetFd()) to whoever pastes,
+     * until someone else copies something.
+     * @return false if it's not supported here
+     */
+    virtual bool OwnSelection(std::string content)
+    { return false; }
+
     /*
      * Copy the content into the clipboard
      */
-    virtual void CopyToClipboard(const std::string& str) const
+    virtual void CopyToClipboard(const std::string& str)
     {
         if (!config.silent)
         {
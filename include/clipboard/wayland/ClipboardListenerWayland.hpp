@@ -24,19 +24,29 @@ public:
     ~CClipboardListenerWayland();
 
     void AddCopyCallback(const std::function<void(const CopyEvent&)>& func) override;
+
+    /*
+     * Block until the wayland display or the selection being received has something, then handle it.
+     * Selections are handed to OnSelection() once they've been read whole.
+     */
     void PollClipboard() override;
+
+    int  GetFd() const override;
+    void ProcessEvents() override;
     //    void CopyToClipboard(const std::string& str) const override;
 
 private:
-    std::vector<std::function<void(const CopyEvent&)>> m_CopyEventCallbacks;
+    static void OnSelection(const char* data, size_t len, void* userdata);
 
-    wl_display* m_display = nullptr;
+    // add the pipe of a new selection to m_EpollFd, it goes away by itself once it gets closed
+    static void OnPasteStarted(int fd, void* userdata);
 
-    std::string m_path{ "/tmp" };
+    std::vector<std::function<void(const CopyEvent&)>> m_CopyEventCallbacks;
 
-    unsigned int m_lastModifiedFileTime = 0;
+    wl_display* m_display = nullptr;
 
-    int m_fd = 0;
+    // waits on both the display and the selection pipe, so the loop only needs one fd
+    int m_EpollFd = -1;
 
     std::string m_LastClipboardContent;
 };
@@ -3,7 +3,12 @@
 
 #ifdef __linux__
 
+#include <memory>
+#include <string>
+#include <vector>
+
 #include <xcb/xcb.h>
+#include <xcb/xfixes.h>
 #include <xcb/xproto.h>
 
 #include "clipboard/ClipboardListener.hpp"
@@ -16,13 +21,94 @@ public:
 
     void AddCopyCallback(const std::function<void(const CopyEvent&)>& func) override;
 
+    /*
+     * Ask for the selection content, then wait for the answer and handle it.
+     * Only needed without XFixes, where we have to check the clipboard periodically.
+     */
     void PollClipboard() override;
 
-    void CopyToClipboard(const std::string& str) const override;
+    /*
+     * The X11 connection fd, or -1 without XFixes.
+     * With XFixes we only get woken up when the selection owner changes.
+     */
+    int  GetFd() const override;
+    void ProcessEvents() override;
+
+    /*
+     * Own the CLIPBOARD selection, answering UTF8_STRING, STRING, TARGETS and MULTIPLE requests from memory,
+     * with INCR for the big ones. It's served by ProcessEvents() until we get a SelectionClear.
+     */
+    bool OwnSelection(std::string content) override;
+
+    /*
+     * Own the selection, then fork and keep serving it in the background until someone else copies something.
+     * The daemon does it with OwnSelection() instead.
+     */
+    void CopyToClipboard(const std::string& str) override;
 
 private:
     xcb_atom_t getAtom(xcb_connection_t* connection, const std::string& name);
 
+    /*
+     * Ask the selection owner to convert the selection into m_ClipboardProperty of our window.
+     */
+    void RequestSelection();
+
+    /*
+     * Read the converted selection from our window and run the callbacks if it's new.
+     * If it's too big, the owner sends it in chunks instead (INCR), received by ReadSelectionChunk().
+     */
+    void ReadSelection();
+
+    /*
+     * Append the next INCR chunk of the selection, sent each time we delete the property.
+     * An empty chunk ends it.
+     */
+    void ReadSelectionChunk();
+
+    /*
+     * Read the whole property of our window into m_Buffer, in chunks so a big one doesn't need a single huge reply,
+     * then delete it. Doesn't read anything past config.max_copy_size, and sets m_Overflow instead.
+     * @param size Where to put the size of the property in bytes
+     * @return The property type, XCB_NONE if it doesn't exist
+     */
+    xcb_atom_t ReadProperty(size_t& size);
+
+    /*
+     * Run the callbacks with the selection received in m_Buffer, if it's new.
+     */
+    void FinishSelection();
+
+    void HandleEvent(const xcb_generic_event_t* event);
+
+    // a big selection we're sending in chunks, after each time the requestor deletes the property
+    struct IncrTransfer
+    {
+        xcb_window_t requestor;
+        xcb_atom_t   property, target;
+        // the transfer keeps going even if we lose the selection meanwhile
+        std::shared_ptr<const std::string> content;
+        size_t                             offset;
+        // the empty chunk ending it was sent
+        bool done;
+    };
+
+    /*
+     * Handle the events about the selection we own: requests, losing it and INCR transfers.
+     * @return false if event isn't about it
+     */
+    bool HandleOwnerEvent(const xcb_generic_event_t* event);
+
+    void HandleSelectionRequest(const xcb_selection_request_event_t* request);
+
+    /*
+     * Convert the selection we own into property of requestor.
+     * @return property, or XCB_NONE if we can't convert it into target
+     */
+    xcb_atom_t ConvertSelection(const xcb_window_t requestor, const xcb_atom_t target, const xcb_atom_t property);
+
+    void SendNextChunk(IncrTransfer& transfer);
+
     std::vector<std::function<void(const CopyEvent&)>> m_CopyEventCallbacks;
 
     xcb_connection_t* m_XCBConnection = nullptr;
@@ -31,7 +117,29 @@ private:
 
     std::string m_LastClipboardContent;
 
-    xcb_atom_t m_Clipboard, m_UTF8String, m_ClipboardProperty;
+    xcb_atom_t m_Clipboard, m_UTF8String, m_ClipboardProperty, m_Incr;
+    xcb_atom_t m_CopySelection, m_Targets, m_Multiple, m_AtomPair;
+
+    // what we serve while we own m_CopySelection
+    std::shared_ptr<const std::string> m_OwnedContent;
+
+    std::vector<IncrTransfer> m_Transfers;
+
+    // the selection being received
+    std::string m_Buffer;
+
+    // receiving the selection in INCR chunks
+    bool m_Incremental = false;
+
+    // the selection is bigger than config.max_copy_size, the rest of it gets thrown away
+    bool m_Overflow = false;
+
+    bool m_HasXFixes = false;
+
+    // XFixes events are numbered starting from here
+    uint8_t m_XFixesEventBase = 0;
+
+    bool m_FirstPoll = true;
 };
 
 #endif // __linux__
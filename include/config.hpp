@@ -1,6 +1,7 @@
 #ifndef _CONFIG_HPP_
 #define _CONFIG_HPP_
 
+#include <cstdint>
 #include <vector>
 #include <string>
 #include <string_view>
@@ -15,15 +16,34 @@ public:
     // Create .config directories and files and load the config file (args or default)
     void Init(const std::string_view configFile, const std::string_view configDir);
 
-    bool arg_search         = false;
-    bool arg_terminal_input = false;
-    bool arg_copy_input     = false;
-    std::vector<std::string> arg_entries, arg_entries_delete;
+    bool arg_search             = false;
+    bool arg_terminal_input     = false;
+    bool arg_copy_input         = false;
+    bool arg_entries_all        = false;
+    bool arg_entries_delete_all = false;
+    bool arg_stats              = false;
+    std::vector<std::string> arg_entries, arg_entries_delete, arg_entries_pin, arg_entries_unpin;
+    std::string arg_export_format, arg_import_format;
+    std::string arg_query;
 
     std::string path;
+    std::string backend;
     std::string wl_seat;
     bool        primary_clip = false;
     bool        silent       = false;
+    bool        fuzzy_search = true;
+    // in bytes
+    uint64_t    max_copy_size = 64 << 20;
+
+    // retention limits, 0 means no limit
+    uint64_t max_entries      = 0;
+    uint64_t max_history_size = 0;  // in bytes
+    int64_t  max_age          = 0;  // in seconds
+
+    bool compress = false;
+
+    // entries bigger than this are stored in their own file, 0 means never, in bytes
+    uint64_t blob_threshold = 1 << 20;
 
     /**
      * Load config file and parse every config variables
@@ -62,7 +82,13 @@ extern Config config;
 
 inline constexpr std::string_view AUTOCONFIG = R"([config]
 # Path to where we store the clipbpoard history
-path = "~/.cache/clippyman/history.json"
+path = "~/.cache/clippyman/history"
+
+# Format used when creating a new clipboard history, existing ones are detected automatically.
+# "log" is an append-only record log, where each copy only writes the new entry.
+# "json" is the old history.json format, where each copy rewrites the whole file.
+# Use --export json and --import json to convert between the two.
+backend = "log"
 
 # Use the primary clipbpoard instead
 primary = false
@@ -72,6 +98,36 @@ wl-seat = ""
 
 # Print an info message along the search content you selected
 silent = false
+
+# Fuzzy match the search (-s), like fzf: "hlwd" finds "hello world", and the best matches come first.
+# It ignores case unless you type an uppercase letter.
+# Set it to false for only finding the exact text you type (case sensitive).
+fuzzy = true
+
+# Biggest copy to save in the history, in MiB. Bigger ones are ignored.
+max-copy-size = 64
+
+# Limits of the history, past them the oldest entries get deleted when copying something new
+# (and every 10 minutes by the listener). 0 means no limit.
+# Pinned entries (--pin) are never deleted.
+max-entries = 0
+
+# Size of the whole history, in MiB
+max-history-size = 0
+
+# How many days entries are kept.
+# Only for the "log" backend, the "json" one doesn't know when they were copied.
+max-age = 0
+
+# Compress the entries with zstd, if libzstd is installed. Only for the "log" backend.
+# Once there are enough entries, a dictionary trained on them gets stored in the history,
+# so even small ones get smaller. Turning it off keeps the compressed entries readable.
+compress = false
+
+# Copies bigger than this, in KiB, are stored in their own file next to the history,
+# and only the start of them is kept in it, so they don't slow down everything else.
+# The search only looks into that start. 0 means never.
+blob-threshold = 1024
 )";
 
 #endif  // _CONFIG_HPP_
@@ -0,0 +1,149 @@
+#ifndef _HISTORY_BACKEND_HPP_
+#define _HISTORY_BACKEND_HPP_
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* Every entry of a history at once, for the search TUI.
+ * The values are views into the history itself when the backend can, otherwise into storage.
+ */
+struct EntryTable
+{
+    std::vector<uint32_t>         ids;
+    std::vector<std::string_view> values;
+
+    // keeps the contents alive when they couldn't be viewed in place
+    std::string storage;
+
+    // keeps alive what the backend viewed them in, e.g a mapping of the history file
+    std::shared_ptr<const void> mapping;
+};
+
+/* The base class for clipboard history storages, Keep in mind this is not supposed to be used directly.
+ * If you want a functional CHistoryBackend instance, use OpenHistoryBackend().
+ */
+class CHistoryBackend
+{
+public:
+    virtual ~CHistoryBackend() = default;
+
+    /*
+     * Save a new entry at the end of the history.
+     * @return The id given to the entry
+     */
+    virtual uint32_t AddEntry(const std::string_view content) = 0;
+
+    /*
+     * Save new entries at the end of the history, in this order.
+     * Backends that rewrite a lot on each change do it once for all of them.
+     * @return The ids given to the entries
+     */
+    virtual std::vector<uint32_t> AddEntries(const std::vector<std::string_view>& contents);
+
+    /*
+     * Get the content of an entry.
+     * @return false if there's no entry with that id
+     */
+    virtual bool GetEntry(const uint32_t id, std::string& content) = 0;
+
+    /*
+     * Delete an entry, depending on the backend it MAY only be written after Flush().
+     * @return false if there's no entry with that id
+     */
+    virtual bool DeleteEntry(const uint32_t id) = 0;
+
+    /*
+     * Call func on the entries with these ids, in the order they are in the history.
+     * Ids without an entry are skipped.
+     */
+    virtual void GetEntries(const std::vector<uint32_t>& ids, const std::function<void(uint32_t, std::string_view)>& func);
+
+    /*
+     * Delete the entries with these ids, like DeleteEntry() on each one.
+     * @return The ids that had an entry
+     */
+    virtual std::vector<uint32_t> DeleteEntries(const std::vector<uint32_t>& ids);
+
+    /*
+     * Call func on every entry, from the oldest to the newest one.
+     */
+    virtual void ForEachEntry(const std::function<void(uint32_t, std::string_view)>& func) = 0;
+
+    /*
+     * Get the ids of every entry, from the oldest to the newest one.
+     */
+    virtual std::vector<uint32_t> GetAllIds() = 0;
+
+    /*
+     * Fill table with every entry, from the oldest to the newest one, copying as little as the backend allows.
+     * The views stay valid until the history is changed or destroyed.
+     */
+    virtual void GetEntryTable(EntryTable& table);
+
+    /*
+     * Like GetEntryTable(), but with only up to the first maxSize bytes of each entry, for listing them.
+     * Backends that can cut the entries without reading all of them do so.
+     */
+    virtual void GetPreviewTable(EntryTable& table, const size_t maxSize);
+
+    /*
+     * Pin or unpin an entry, pinned entries are never deleted by EnforceRetention().
+     * @return false if there's no entry with that id
+     */
+    virtual bool SetPinned(const uint32_t id, const bool pinned) = 0;
+
+    /*
+     * Delete the oldest entries past the retention limits in the config (max-entries, max-history-size, max-age),
+     * except the pinned ones. It only looks at the entries it deletes.
+     * @return The ids of the deleted entries
+     */
+    virtual std::vector<uint32_t> EnforceRetention()
+    { return {}; }
+
+    /*
+     * Make the changes written so far durable, for backends that group their fsyncs.
+     * Cheaper than Flush(), it's meant to be called often.
+     */
+    virtual void Sync() {}
+
+    /*
+     * Write any pending change to disk.
+     */
+    virtual void Flush() {}
+
+    /*
+     * Reclaim the space left by deleted entries, if the backend has any to reclaim.
+     * This MAY rewrite the whole storage, so it's meant for maintenance, not after each change.
+     */
+    virtual void Compact() {}
+};
+
+/*
+ * Open the clipboard history at path, creating it if it doesn't exist.
+ * The format of an existing history is detected from its content,
+ * new histories use the backend set in the config.
+ * New entries also get added to its search index (see CTrigramIndex),
+ * and the big ones get stored in their own file (see CHistoryBackendBlob).
+ */
+std::unique_ptr<CHistoryBackend> OpenHistoryBackend(const std::string& path);
+
+/*
+ * Write every entry of the history as JSON, with the same layout as the old history.json
+ * @param out Where to write the JSON
+ */
+void ExportHistoryJson(CHistoryBackend& history, FILE* out);
+
+/*
+ * Append every entry from a JSON history (like the old history.json) into the history.
+ * Entries get new ids, in the same order they appear. The ones bigger than max-copy-size are skipped.
+ * @param in Where to read the JSON
+ * @return The number of imported entries
+ */
+size_t ImportHistoryJson(CHistoryBackend& history, FILE* in);
+
+#endif  // !_HISTORY_BACKEND_HPP_
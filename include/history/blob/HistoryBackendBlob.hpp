@@ -0,0 +1,99 @@
+#ifndef _HISTORY_BACKEND_BLOB_HPP_
+#define _HISTORY_BACKEND_BLOB_HPP_
+
+#include <memory>
+#include <string>
+
+#include "history/HistoryBackend.hpp"
+
+/* Stores the entries bigger than blob-threshold in the config out of the history it wraps.
+ * Their content goes into a file named by its hash in a directory next to the history (see GetBlobDir()),
+ * so copying the same thing twice keeps one file, and the history only gets a reference to it
+ * followed by the start of the content, for listing and searching them.
+ *
+ * GetEntry(), GetEntries() and ForEachEntry() give the whole contents,
+ * GetEntryTable() gives only the start of the stored ones, so listing the history never reads them.
+ * Files no entry refers to anymore are deleted by Compact().
+ */
+class CHistoryBackendBlob : public CHistoryBackend
+{
+public:
+    CHistoryBackendBlob(std::unique_ptr<CHistoryBackend> backend, const std::string& path);
+
+    uint32_t AddEntry(const std::string_view content) override;
+    std::vector<uint32_t> AddEntries(const std::vector<std::string_view>& contents) override;
+    bool     GetEntry(const uint32_t id, std::string& content) override;
+    bool     DeleteEntry(const uint32_t id) override;
+    void     GetEntries(const std::vector<uint32_t>& ids,
+                        const std::function<void(uint32_t, std::string_view)>& func) override;
+    std::vector<uint32_t> DeleteEntries(const std::vector<uint32_t>& ids) override;
+    void     ForEachEntry(const std::function<void(uint32_t, std::string_view)>& func) override;
+    std::vector<uint32_t> GetAllIds() override;
+
+    /*
+     * The entries stored in their own file only have the start of their content in it.
+     */
+    void                  GetEntryTable(EntryTable& table) override;
+    void                  GetPreviewTable(EntryTable& table, const size_t maxSize) override;
+    bool                  SetPinned(const uint32_t id, const bool pinned) override;
+    std::vector<uint32_t> EnforceRetention() override;
+    void                  Sync() override;
+    void                  Flush() override;
+
+    /*
+     * Compact the history, then delete the files of the entries that are gone.
+     */
+    void Compact() override;
+
+    /*
+     * Like AddEntry() and AddEntries(), also giving what the history stores for the contents kept out of it,
+     * so they can be kept in memory without their whole content (see CHistoryServer).
+     * @param stored Gets it for each content stored in its own file, and stays empty for the others
+     */
+    uint32_t              AddEntry(const std::string_view content, std::string& stored);
+    std::vector<uint32_t> AddEntries(const std::vector<std::string_view>& contents, std::vector<std::string>& stored);
+
+    /*
+     * Like ForEachEntry(), but with what the history stores for the entries, so their files aren't read.
+     */
+    void ForEachStored(const std::function<void(uint32_t, std::string_view)>& func);
+
+    /*
+     * Get the whole content of an entry from what the history stores for it, reading its file if it has one.
+     */
+    void LoadStored(const std::string_view stored, std::string& content);
+
+    /*
+     * Check if what the history stores for an entry is a reference to its own file.
+     */
+    static bool HasOwnFile(const std::string_view stored);
+
+    /*
+     * Get what GetEntryTable() gives for an entry from what the history stores for it.
+     */
+    static std::string_view GetStoredPreview(const std::string_view stored);
+
+    /*
+     * Get the directory with the contents stored out of the history at path, it sits next to it.
+     */
+    static std::string GetBlobDir(const std::string& path);
+
+private:
+    /*
+     * Get what to save into the history for a content, a reference to its own file if it's too big.
+     * @param stored Where to keep it if it's not the content itself
+     */
+    std::string_view StoreContent(const std::string_view content, std::string& stored);
+
+    /*
+     * Read the whole content of an entry stored in its own file, from the reference the history has for it.
+     * If the file is gone, only the start of the content in the history is left.
+     */
+    void LoadContent(const std::string_view stored, std::string& content);
+
+    std::unique_ptr<CHistoryBackend> m_Backend;
+
+    std::string m_BlobDir;
+};
+
+#endif  // !_HISTORY_BACKEND_BLOB_HPP_
@@ -0,0 +1,82 @@
+#ifndef _HISTORY_CLIENT_HPP_
+#define _HISTORY_CLIENT_HPP_
+
+#include <memory>
+#include <string>
+
+#include "history/HistoryBackend.hpp"
+#include "history/daemon/Protocol.hpp"
+
+/* The client side of the clipboard history, it asks a running daemon (see CHistoryServer)
+ * instead of opening and reading the history file again.
+ */
+class CHistoryClient : public CHistoryBackend
+{
+public:
+    ~CHistoryClient();
+
+    /*
+     * Connect to the daemon listening at socketPath.
+     * @return nullptr if there's no daemon running
+     */
+    static std::unique_ptr<CHistoryClient> Connect(const std::string& socketPath);
+
+    uint32_t AddEntry(const std::string_view content) override;
+
+    /*
+     * A few contents per request, the daemon saves each request in a single go.
+     */
+    std::vector<uint32_t> AddEntries(const std::vector<std::string_view>& contents) override;
+    bool     GetEntry(const uint32_t id, std::string& content) override;
+    bool     DeleteEntry(const uint32_t id) override;
+
+    /*
+     * A few requests at a time, so the whole history is never in a single reply.
+     */
+    void GetEntries(const std::vector<uint32_t>& ids,
+                    const std::function<void(uint32_t, std::string_view)>& func) override;
+    void ForEachEntry(const std::function<void(uint32_t, std::string_view)>& func) override;
+    std::vector<uint32_t> GetAllIds() override;
+
+    /*
+     * The views point into the reply of the daemon, kept as the table storage.
+     * Like with CHistoryBackendBlob, the entries stored in their own file only have their start in it.
+     */
+    void GetEntryTable(EntryTable& table) override;
+
+    /*
+     * The daemon cuts the entries, so only the previews go through the socket.
+     */
+    void GetPreviewTable(EntryTable& table, const size_t maxSize) override;
+    bool                  SetPinned(const uint32_t id, const bool pinned) override;
+    void                  Flush() override;
+
+    /*
+     * Ask the daemon to put content into the clipboard, it stays there for as long as the daemon runs.
+     * @return false if the daemon can't, then we have to do it ourselves
+     */
+    bool CopyToClipboard(const std::string_view content);
+
+    /*
+     * Get how many entries the daemon has, how many copies wait for its writer thread,
+     * and how many it dropped because they came faster than it could save them.
+     */
+    void GetStats(uint32_t& entries, uint32_t& queued, uint64_t& dropped);
+
+private:
+    CHistoryClient(const int fd) : m_Fd(fd) {}
+
+    /*
+     * Send a request and wait for its reply, dies if the daemon went away.
+     */
+    std::string Request(const MessageType type, const std::string_view payload = {});
+
+    /*
+     * Fill the ids and values of a table from a list reply, already in its storage.
+     */
+    static void ReadTable(EntryTable& table);
+
+    int m_Fd = -1;
+};
+
+#endif  // !_HISTORY_CLIENT_HPP_
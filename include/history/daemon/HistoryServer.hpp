@@ -0,0 +1,297 @@
+#ifndef _HISTORY_SERVER_HPP_
+#define _HISTORY_SERVER_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "EventLoop.hpp"
+#include "SpscQueue.hpp"
+#include "history/HistoryBackend.hpp"
+#include "history/blob/HistoryBackendBlob.hpp"
+#include "history/daemon/Protocol.hpp"
+
+/* The daemon side of the clipboard history.
+ * It keeps the whole history in memory in front of the real backend,
+ * and serves it to the other clippyman instances over a unix socket (see CHistoryClient).
+ * Every change goes trough here, so the memory copy is always the source of truth.
+ * Entries stored in their own file (see CHistoryBackendBlob) are only kept as what the history has for them,
+ * their file gets read when someone asks for their whole content.
+ *
+ * What the listener copies is saved by a writer thread (see QueueEntry()), in batches,
+ * so copying doesn't wait on the disk and a big history doesn't slow the listener down.
+ * What clients change goes through the writer thread too (see WriterRequest), and the reply waits for it,
+ * so the loop never waits on the backend while it's being compacted. So do the entries stored in their own file
+ * a client asks for, so the loop never reads them.
+ * Replies are sent as fast as each client reads them, and lists are only turned into bytes then,
+ * so a client reading slowly, or not at all, never holds the others up.
+ * The backend is only touched with m_BackendMutex held.
+ */
+class CHistoryServer : public CHistoryBackend
+{
+public:
+    /*
+     * The socket and its clients are watched by loop, which must outlive the server.
+     */
+    CHistoryServer(std::unique_ptr<CHistoryBackend> backend, const std::string& socketPath, CEventLoop& loop);
+    ~CHistoryServer();
+
+    /*
+     * These wait for the writer thread to be done with the backend, clients don't go through them.
+     */
+    uint32_t              AddEntry(const std::string_view content) override;
+    bool                  SetPinned(const uint32_t id, const bool pinned) override;
+    std::vector<uint32_t> EnforceRetention() override;
+    void                  Sync() override;
+    void                  Flush() override;
+
+    /*
+     * The entry is gone from memory right away, the writer thread deletes it from the backend.
+     */
+    bool DeleteEntry(const uint32_t id) override;
+
+    bool                  GetEntry(const uint32_t id, std::string& content) override;
+    void                  ForEachEntry(const std::function<void(uint32_t, std::string_view)>& func) override;
+    std::vector<uint32_t> GetAllIds() override;
+
+    /*
+     * Enforce the retention limits, then compact the history, in the writer thread.
+     */
+    void Compact() override;
+
+    /*
+     * Hand a new entry to the writer thread, without waiting for it to be saved.
+     * It shows up in the history once it's saved, with the id the backend gives it.
+     * Only call this from the thread running the loop.
+     * @return false if the queue is full, then the entry is dropped
+     */
+    bool QueueEntry(std::string content);
+
+    /*
+     * Get how many entries are waiting for the writer thread.
+     */
+    size_t GetQueueDepth() const
+    { return m_Queue.Size(); }
+
+    /*
+     * Get how many entries have been dropped because the queue was full.
+     */
+    uint64_t GetDroppedCount() const
+    { return m_Dropped; }
+
+    /*
+     * Set what to do when a client asks to copy something into the clipboard (see CHistoryClient::CopyToClipboard()).
+     * func returns false if it can't, then the client does it itself.
+     */
+    void SetCopyHandler(const std::function<bool(std::string)>& func)
+    { m_CopyHandler = func; }
+
+private:
+    struct Client
+    {
+        // bytes received that don't make a whole request yet, or wait for the reply before them
+        std::string received;
+
+        // tells this client apart from a later one getting the same fd
+        uint64_t serial = 0;
+
+        // its last request went to the writer thread, the next ones wait for its reply
+        bool waiting = false;
+
+        // replies left to send, from sent on
+        std::string output;
+        size_t      sent = 0;
+
+        // the entries of a list reply, added to output as the client reads it, cut to listMaxSize
+        std::vector<std::pair<uint32_t, std::shared_ptr<const std::string>>> listing;
+        size_t                                                               listed      = 0;
+        uint32_t                                                             listMaxSize = 0;
+
+        bool watchingWritable = false;
+
+        /*
+         * Check if there's some reply left to send, the next requests wait for it.
+         */
+        bool IsSending() const
+        { return sent < output.size() || listed < listing.size(); }
+    };
+
+    /*
+     * A change a client asked for, done by the writer thread.
+     */
+    struct WriterRequest
+    {
+        MessageType type;  // MSG_ADD(S), MSG_DELETE, MSG_PIN, MSG_FLUSH, or MSG_GET and MSG_ENTRIES reading entries
+        uint32_t    id     = 0;
+        bool        pinned = false;
+        std::string content;
+
+        // serial of the client waiting for the reply, 0 if no one is
+        uint64_t client = 0;
+
+        // what's stored for the entries to read, taken when asked so deleting them meanwhile doesn't matter
+        std::vector<std::pair<uint32_t, std::shared_ptr<const std::string>>> entries;
+    };
+
+    struct WriterReply
+    {
+        uint64_t client;
+        // the whole message, so a big one doesn't get copied again in the loop
+        std::string message;
+    };
+
+    void Accept();
+
+    /*
+     * Read what the client sent and answer every complete request in it.
+     */
+    void HandleClient(const int fd);
+    void CloseClient(const int fd);
+
+    /*
+     * Send what's left of the replies once the client reads them, then go on with its next requests.
+     */
+    void HandleWritable(const int fd);
+
+    /*
+     * Answer the complete requests the client sent, until one has to wait for the writer thread
+     * or for the client to read its reply.
+     * @return false if the client went away
+     */
+    bool HandleRequests(const int fd, Client& client);
+
+    /*
+     * Handle a single request and queue its reply, unless it went to the writer thread.
+     * @return false if the request is malformed
+     */
+    bool HandleRequest(Client& client, const MessageType type, std::string_view request);
+
+    void QueueReply(Client& client, const MessageType type, const std::string_view reply);
+
+    /*
+     * Queue a reply listing every entry, cut to maxSize.
+     */
+    void QueueListing(Client& client, const MessageType type, const uint32_t maxSize);
+
+    /*
+     * Send what the client's socket takes without blocking, and watch it until the rest is sent.
+     * @return false if the client went away
+     */
+    bool SendReplies(const int fd, Client& client);
+
+    /*
+     * Hand a change to the writer thread, the client gets the reply once it's done.
+     */
+    void QueueRequest(WriterRequest request);
+
+    /*
+     * Get what list requests send for an entry, from what's kept in memory for it.
+     */
+    std::string_view GetListed(const std::string_view stored) const
+    { return m_Blob ? CHistoryBackendBlob::GetStoredPreview(stored) : stored; }
+
+    std::string_view GetListedCut(const std::string_view stored, const uint32_t maxSize) const;
+
+    /*
+     * Get the content shared by the entries having it, so copying the same thing again doesn't take more memory.
+     */
+    std::shared_ptr<const std::string> ShareContent(const std::string_view content);
+
+    /*
+     * Drop an entry from memory, and its content if it was the last one having it.
+     */
+    void ForgetEntry(const std::map<uint32_t, std::shared_ptr<const std::string>>::iterator it);
+
+    /*
+     * Drop the slot of a content in m_Contents if nothing else has it anymore.
+     */
+    void ReleaseContent(std::shared_ptr<const std::string> content);
+
+    /*
+     * The writer thread: wait for queued entries and requests, then save all of them at once,
+     * enforce the retention limits and fsync, once per batch.
+     */
+    void Writer();
+
+    /*
+     * Do a request of a client on the backend, from the writer thread.
+     * @param saved Gets the entry it added, if it's an add
+     * @return the reply
+     */
+    std::string DoRequest(WriterRequest& request, std::vector<std::pair<uint32_t, std::string>>& saved);
+
+    /*
+     * Get the whole reply message of a MSG_GET or MSG_ENTRIES request, reading the files of its entries.
+     * Doesn't touch the backend, so the writer thread does it without m_BackendMutex.
+     */
+    std::string ReadEntries(const WriterRequest& request) const;
+
+    /*
+     * Wake the writer thread up.
+     */
+    void WakeWriter();
+
+    /*
+     * Add what the writer thread saved into memory, drop what it evicted, and send the replies
+     * of the clients waiting on it. Runs in the loop.
+     */
+    void ApplyWrites();
+
+    std::unique_ptr<CHistoryBackend> m_Backend;
+
+    // m_Backend, if it stores big contents in their own file
+    CHistoryBackendBlob* m_Blob = nullptr;
+
+    std::mutex m_BackendMutex;
+
+    CSpscQueue<std::string> m_Queue{ 1024 };
+
+    uint64_t m_Dropped = 0;
+
+    std::thread m_Writer;
+
+    // eventfds: the loop wakes the writer, and the writer tells the loop it saved a batch
+    int m_WriterWakeFd = -1;
+    int m_WritesDoneFd = -1;
+
+    std::atomic<bool> m_StopWriter{ false };
+    std::atomic<bool> m_CompactRequested{ false };
+
+    // what clients asked the writer to do
+    std::mutex                 m_RequestsMutex;
+    std::vector<WriterRequest> m_Requests;
+
+    // what the writer saved, evicted or replied, and the loop hasn't applied yet
+    std::mutex                                    m_DoneMutex;
+    std::vector<std::pair<uint32_t, std::string>> m_DoneEntries;
+    std::vector<uint32_t>                         m_DoneEvicted;
+    std::vector<WriterReply>                      m_DoneReplies;
+
+    // id -> what the history stores for it
+    std::map<uint32_t, std::shared_ptr<const std::string>> m_Entries;
+
+    // content hash -> the content of the entries having it
+    std::unordered_map<uint64_t, std::weak_ptr<const std::string>> m_Contents;
+
+    std::function<bool(std::string)> m_CopyHandler;
+
+    CEventLoop& m_Loop;
+
+    std::string m_SocketPath;
+
+    int m_ListenFd = -1;
+
+    std::unordered_map<int, Client> m_Clients;
+
+    uint64_t m_NextClientSerial = 1;
+};
+
+#endif  // !_HISTORY_SERVER_HPP_
@@ -0,0 +1,77 @@
+#ifndef _HISTORY_PROTOCOL_HPP_
+#define _HISTORY_PROTOCOL_HPP_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/* Messages between the clippyman daemon and its clients, over a unix socket.
+ * Every message is a MessageHeader followed by `size` bytes of payload,
+ * numbers in the payload are in host byte order since both ends are on the same machine.
+ */
+enum MessageType : uint8_t
+{
+    MSG_ADD = 1,  // request: content            reply: u32 id
+    MSG_GET,      // request: u32 id             reply: u8 found, string content
+    MSG_DELETE,   // request: u32 id             reply: u8 found
+    MSG_LIST,     // request: nothing            reply: { u32 id, string content }...
+    MSG_IDS,      // request: nothing            reply: u32 id...
+    MSG_FLUSH,    // request: nothing            reply: nothing
+    MSG_COPY,     // request: content            reply: u8 copied (the daemon owns the selection now)
+    MSG_PIN,      // request: u32 id, u8 pinned  reply: u8 found
+    MSG_PREVIEWS, // request: u32 max size       reply: { u32 id, string content cut to max size }...
+    MSG_ENTRIES,  // request: u32 id...          reply: { u32 id, string content }... of the ones found
+    MSG_STATS,    // request: nothing            reply: u32 entries, u32 queued copies, u64 dropped copies
+    MSG_ADDS,     // request: string content...  reply: u32 id... in the same order
+    MSG_ERROR = 0xFF
+};
+
+struct MessageHeader
+{
+    uint8_t  type;
+    uint8_t  reserved[7];
+    uint64_t size;
+};
+
+// no message is bigger, a header saying so is taken for garbage
+constexpr uint64_t MAX_MESSAGE_SIZE = 4ull << 30;
+
+/*
+ * Get the path of the daemon socket for a clipboard history, it sits next to the history.
+ */
+std::string GetHistorySocketPath(const std::string& historyPath);
+
+/*
+ * Send a whole message.
+ * @return false if the other end went away
+ */
+bool SendMessage(const int fd, const MessageType type, const std::string_view payload);
+
+/*
+ * Append the header of a message to what's left to send.
+ */
+void AppendMessageHeader(std::string& buffer, const MessageType type, const uint64_t size);
+
+/*
+ * Receive a whole message.
+ * @return false if the other end went away, or sent a message bigger than MAX_MESSAGE_SIZE
+ */
+bool RecvMessage(const int fd, MessageType& type, std::string& payload);
+
+/*
+ * Take the first complete message out of the bytes received so far.
+ * @return false if there isn't a complete message yet
+ */
+bool ParseMessage(std::string_view& buffer, MessageType& type, std::string_view& payload);
+
+/* Payload encoding helpers.
+ * The Read* ones consume from the front of payload and return false if it's too short
+ */
+void AppendU32(std::string& payload, const uint32_t value);
+void AppendU64(std::string& payload, const uint64_t value);
+void AppendString(std::string& payload, const std::string_view str);
+bool ReadU32(std::string_view& payload, uint32_t& value);
+bool ReadU64(std::string_view& payload, uint64_t& value);
+bool ReadString(std::string_view& payload, std::string_view& str);
+
+#endif  // !_HISTORY_PROTOCOL_HPP_
@@ -0,0 +1,54 @@
+#ifndef _HISTORY_BACKEND_INDEXED_HPP_
+#define _HISTORY_BACKEND_INDEXED_HPP_
+
+#include <memory>
+#include <string>
+
+#include "history/HistoryBackend.hpp"
+
+/* Keeps the search index (see CTrigramIndex) up to date with the history it wraps,
+ * by appending the record of every new entry right after it's saved.
+ */
+class CHistoryBackendIndexed : public CHistoryBackend
+{
+public:
+    CHistoryBackendIndexed(std::unique_ptr<CHistoryBackend> backend, const std::string& indexPath);
+    ~CHistoryBackendIndexed();
+
+    uint32_t AddEntry(const std::string_view content) override;
+    std::vector<uint32_t> AddEntries(const std::vector<std::string_view>& contents) override;
+    bool     GetEntry(const uint32_t id, std::string& content) override;
+    bool     DeleteEntry(const uint32_t id) override;
+    void     GetEntries(const std::vector<uint32_t>& ids,
+                        const std::function<void(uint32_t, std::string_view)>& func) override;
+    std::vector<uint32_t> DeleteEntries(const std::vector<uint32_t>& ids) override;
+    void     ForEachEntry(const std::function<void(uint32_t, std::string_view)>& func) override;
+    std::vector<uint32_t> GetAllIds() override;
+    void                  GetEntryTable(EntryTable& table) override;
+    void                  GetPreviewTable(EntryTable& table, const size_t maxSize) override;
+    bool                  SetPinned(const uint32_t id, const bool pinned) override;
+    std::vector<uint32_t> EnforceRetention() override;
+    void                  Sync() override;
+    void                  Flush() override;
+
+    /*
+     * Compact the history, then rebuild the index once deleted entries take most of it,
+     * or enough entries were added since its posting lists were written.
+     */
+    void Compact() override;
+
+private:
+    /*
+     * Append the record of a new entry into the index.
+     */
+    void IndexEntry(const uint32_t id, const std::string_view content);
+
+    std::unique_ptr<CHistoryBackend> m_Backend;
+
+    std::string m_IndexPath;
+
+    // opened on the first new entry
+    int m_IndexFd = -1;
+};
+
+#endif  // !_HISTORY_BACKEND_INDEXED_HPP_
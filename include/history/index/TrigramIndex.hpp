@@ -0,0 +1,147 @@
+#ifndef _TRIGRAM_INDEX_HPP_
+#define _TRIGRAM_INDEX_HPP_
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "history/HistoryBackend.hpp"
+
+/* Persistent trigram index of the clipboard history, kept next to it in "<history>.tri".
+ * Each entry gets a record with the (ASCII case folded) trigrams of its content,
+ * so a substring query only has to check the entries having every trigram of the query.
+ * Records are only appended, entries deleted from the history get filtered out when checking the candidates.
+ *
+ * Rebuilding the file (see Rebuild()) writes the sorted posting list of every trigram before the records,
+ * those get mapped as they are, so only the records appended since have to be read and merged into memory.
+ */
+class CTrigramIndex
+{
+public:
+    CTrigramIndex(const std::string& path);
+    ~CTrigramIndex();
+
+    CTrigramIndex(const CTrigramIndex&)            = delete;
+    CTrigramIndex& operator=(const CTrigramIndex&) = delete;
+
+    /*
+     * Map the posting lists of the index file, and read the records appended to it since the last call.
+     */
+    void Load();
+
+    /*
+     * Index the entries of history the index doesn't know about yet (e.g added before the index existed),
+     * saving them into the index file too. A corrupted index file gets rebuilt from scratch.
+     */
+    void Sync(CHistoryBackend& history);
+
+    /*
+     * Get the ids of the entries that may contain query, from the oldest to the newest one.
+     * They still have to be checked, the index can only rule entries out.
+     * @return false if the query is too short to use the index, so every entry is a candidate
+     */
+    bool GetCandidates(const std::string_view query, std::vector<uint32_t>& ids) const;
+
+    /*
+     * Open the index file at path for appending records, creating it if it doesn't exist.
+     * @return The fd, or -1 if it failed (already warned)
+     */
+    static int OpenForAppend(const std::string& path);
+
+    /*
+     * Append the record of an entry into the index file opened with OpenForAppend().
+     * The record is written in a single write(), so other instances appending at the same time are fine.
+     */
+    static bool AppendEntry(const int fd, const uint32_t id, const std::string_view content);
+
+    /*
+     * Check if the index file at path is worth rebuilding for a history having this many entries:
+     * deleted entries take most of it, too many records were appended since its posting lists were written,
+     * or it's from an older version.
+     */
+    static bool ShouldRebuild(const std::string& path, const size_t entries);
+
+    /*
+     * Rewrite the index file at path with the posting lists of the entries of history, and no records.
+     * The new file is written next to the old one and renamed over it.
+     */
+    static bool Rebuild(const std::string& path, CHistoryBackend& history);
+
+    static std::string GetIndexPath(const std::string& historyPath)
+    { return historyPath + ".tri"; }
+
+    struct FileHeader
+    {
+        char     magic[8];
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t entries;   // ids having their trigrams in the posting lists
+        uint64_t trigrams;  // trigrams having a posting list
+        uint64_t postings;  // ids in all the posting lists
+    };
+
+    // After the header, in this order: u64 start of the posting list of each trigram (and the end of the last one),
+    // u32 id of each entry in the posting lists, u32 trigrams, u32 ids of every posting list,
+    // all sorted. Then the records.
+
+    struct RecordHeader
+    {
+        uint32_t checksum;  // crc32 of the rest of the header and the trigrams
+        uint32_t id;
+        uint32_t count;  // number of trigrams following the header
+    };
+
+private:
+    void AddPostings(const uint32_t id, const std::vector<uint32_t>& trigrams);
+
+    /*
+     * Map the posting lists at the start of the index file.
+     * @return false if the file is corrupted or from an older version
+     */
+    bool MapPostings(const int fd, const uint64_t fileSize);
+
+    /*
+     * Forget everything loaded, to load the file again from its start.
+     */
+    void Reset();
+
+    bool IsIndexed(const uint32_t id) const;
+
+    /*
+     * Get the mapped posting list of a trigram.
+     */
+    std::pair<const uint32_t*, size_t> GetMappedPostings(const uint32_t trigram) const;
+
+    std::string m_Path;
+
+    // the file loaded, to notice when it gets rebuilt
+    ino_t m_Inode = 0;
+
+    uint64_t m_LoadedOffset = 0;
+
+    // the index file has a record we can't read, Sync() will rebuild it
+    bool m_Corrupted = false;
+
+    // the start of the index file, up to its records
+    void*             m_Map     = nullptr;
+    size_t            m_MapSize = 0;
+    const FileHeader* m_Header  = nullptr;
+    const uint64_t*   m_Starts  = nullptr;
+    const uint32_t*   m_Ids     = nullptr;
+    const uint32_t*   m_Keys    = nullptr;
+    const uint32_t*   m_Lists   = nullptr;
+
+    // what the records appended after the mapped posting lists add to them
+    std::unordered_set<uint32_t> m_Indexed;
+
+    // trigram -> ids of the entries containing it, sorted
+    std::unordered_map<uint32_t, std::vector<uint32_t>> m_Postings;
+};
+
+#endif  // !_TRIGRAM_INDEX_HPP_
@@ -0,0 +1,99 @@
+#ifndef _HISTORY_BACKEND_JSON_HPP_
+#define _HISTORY_BACKEND_JSON_HPP_
+
+#include <sys/stat.h>
+
+#include <string>
+
+#include "history/HistoryBackend.hpp"
+#include "rapidjson/document.h"
+
+/* The old history.json format: {"entries": {"<id>": "<content>", ...}, "pinned": [<id>, ...], "next_id": <id>}
+ * Every change parses and rewrites the whole file, so it's only kept
+ * for existing histories and as import/export format.
+ *
+ * The file is mapped copy-on-write and parsed in place, so the strings of the document
+ * are views into the mapping instead of copies.
+ * The document is only loaded when needed, getting and deleting entries stream the file instead.
+ *
+ * Changes are saved right away, holding a lock on the file from reading it to renaming the new one over it,
+ * so the changes of other clippyman instances in between aren't lost. Readers don't need it, the file is
+ * always replaced whole.
+ */
+class CHistoryBackendJson : public CHistoryBackend
+{
+public:
+    CHistoryBackendJson(const std::string& path);
+    ~CHistoryBackendJson();
+
+    uint32_t AddEntry(const std::string_view content) override;
+
+    /*
+     * Load and rewrite the file once for all of them.
+     */
+    std::vector<uint32_t> AddEntries(const std::vector<std::string_view>& contents) override;
+    bool     GetEntry(const uint32_t id, std::string& content) override;
+    bool     DeleteEntry(const uint32_t id) override;
+
+    /*
+     * Scan the file until every id is found, without loading it.
+     */
+    void GetEntries(const std::vector<uint32_t>& ids,
+                    const std::function<void(uint32_t, std::string_view)>& func) override;
+
+    /*
+     * Copy the file into a new one without these entries and rename it over the old one, without loading it.
+     */
+    std::vector<uint32_t> DeleteEntries(const std::vector<uint32_t>& ids) override;
+    void     ForEachEntry(const std::function<void(uint32_t, std::string_view)>& func) override;
+    std::vector<uint32_t> GetAllIds() override;
+
+    /*
+     * The views point into the document, they stay valid until it's loaded again,
+     * by a change after another clippyman instance changed the file.
+     */
+    void GetEntryTable(EntryTable& table) override;
+    bool SetPinned(const uint32_t id, const bool pinned) override;
+
+    /*
+     * Only max-entries and max-history-size, entries don't have a time.
+     */
+    std::vector<uint32_t> EnforceRetention() override;
+
+private:
+    void Load();
+    void Save();
+
+    /*
+     * Load the document if it isn't, or if another clippyman instance replaced the file since.
+     */
+    void Refresh();
+
+    /*
+     * Take the lock of the history file, waiting for the other instances changing it.
+     * @return The fd holding it, for Unlock()
+     */
+    int  Lock();
+    void Unlock(const int fd);
+
+    /*
+     * Add or remove id from the pinned array of the document.
+     * @return true if it changed
+     */
+    bool UpdatePin(const uint32_t id, const bool pinned);
+
+    std::string m_Path;
+
+    rapidjson::Document m_Doc;
+
+    // the file parsed in place by m_Doc, it must outlive it
+    void*  m_Map     = nullptr;
+    size_t m_MapSize = 0;
+
+    bool m_Loaded = false;
+
+    // the file m_Doc is in sync with, inode numbers get reused so its size and mtime are kept too
+    struct stat m_LoadedStat {};
+};
+
+#endif  // !_HISTORY_BACKEND_JSON_HPP_
@@ -0,0 +1,355 @@
+#ifndef _HISTORY_BACKEND_LOG_HPP_
+#define _HISTORY_BACKEND_LOG_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "history/HistoryBackend.hpp"
+#include "history/log/Zstd.hpp"
+
+/* Append-only record log.
+ * The file is a header followed by framed records, a copy appends one record
+ * and a delete appends a tombstone, so nothing already written gets rewritten.
+ * Reading replays the records into an in-memory map of id -> payload location.
+ *
+ * Contents are stored once: copying something already in the history appends a link
+ * to the entry having it, with its own id and time, instead of the whole content again.
+ *
+ * The replayed map is saved next to the log (see GetIndexPath()), sorted by id,
+ * so opening it only replays what was appended since, and looking up a few ids
+ * in an unchanged log is a binary search in it without loading anything.
+ * It's a fixed-width table stored by column, with the log as the heap of the contents,
+ * so listing the entries of an unchanged log only reads the columns it needs.
+ *
+ * Several clippyman instances can share the same log.
+ * Appending takes a lock on the part of the header it moves (see LockAppend()), only for as long as the write,
+ * and compacting takes another one, so only one instance rewrites it at a time.
+ * Readers don't lock: what's before the end in the header never changes, and a compacted log
+ * is a new file renamed over the old one, with a new generation, which they switch to on their next replay.
+ *
+ * With compression on, contents are stored as zstd frames when that makes them smaller.
+ * Clipboard entries are mostly too small to compress well alone, so compacting trains a dictionary
+ * on the live entries, writes it as the first record of the new log, and compresses them all with it.
+ * It's trained again once enough entries have been copied since, and only replaces the old one if it does better.
+ */
+class CHistoryBackendLog : public CHistoryBackend
+{
+public:
+    CHistoryBackendLog(const std::string& path);
+    ~CHistoryBackendLog();
+
+    /*
+     * Save a new entry, as a link to an entry with the same content if there's one.
+     */
+    uint32_t AddEntry(const std::string_view content) override;
+    bool     GetEntry(const uint32_t id, std::string& content) override;
+    bool     DeleteEntry(const uint32_t id) override;
+    void     GetEntries(const std::vector<uint32_t>& ids,
+                        const std::function<void(uint32_t, std::string_view)>& func) override;
+    std::vector<uint32_t> DeleteEntries(const std::vector<uint32_t>& ids) override;
+    void     ForEachEntry(const std::function<void(uint32_t, std::string_view)>& func) override;
+
+    /*
+     * Straight from the id column of the side index if it's current.
+     */
+    std::vector<uint32_t> GetAllIds() override;
+
+    /*
+     * The views point into a read-only mapping of the log, kept by the table,
+     * so they stay valid even if the log gets compacted or the history destroyed meanwhile.
+     * If the side index is current, it's filled from it without replaying the log.
+     * Compressed contents can't be viewed in place, they're decompressed into the table.
+     */
+    void     GetEntryTable(EntryTable& table) override;
+
+    /*
+     * Compressed contents only get decompressed up to maxSize.
+     */
+    void     GetPreviewTable(EntryTable& table, const size_t maxSize) override;
+    bool     SetPinned(const uint32_t id, const bool pinned) override;
+
+    /*
+     * Append a tombstone for each entry past the limits, walking from the oldest one
+     * until they're satisfied, so it costs as much as what gets deleted.
+     */
+    std::vector<uint32_t> EnforceRetention() override;
+
+    /*
+     * fsync the records appended since the last time, they're grouped to not pay one fsync per copy.
+     */
+    void Sync() override;
+
+    /*
+     * Sync, then save the replayed map into the side index if it's behind the log.
+     */
+    void Flush() override;
+
+    /*
+     * Rewrite the log without tombstones and deleted entries, once they take at least half of it.
+     * The new log is written next to the old one and renamed over it.
+     * Other instances can keep appending while it's copied, then it's tried again with what they appended.
+     * The content of links to deleted entries is moved into the first entry still using it,
+     * and pin records are folded into the flags of the entries.
+     */
+    void Compact() override;
+
+    /*
+     * Check if the file at path is a record log.
+     */
+    static bool IsLogFile(const std::string& path);
+
+    /*
+     * Get the path of the side index of a log, it sits next to it.
+     */
+    static std::string GetIndexPath(const std::string& path);
+
+    enum RecordType : uint8_t
+    {
+        RECORD_ADD    = 1,
+        RECORD_DELETE = 2,
+        RECORD_LINK   = 3,  // payload: u32 id of the entry having the content
+        RECORD_PIN    = 4,  // payload: u8, 1 to pin the entry or 0 to unpin it
+        RECORD_DICT   = 5   // payload: zstd dictionary with the id of the record, only as the first record
+    };
+
+    enum RecordFlags : uint8_t
+    {
+        RECORD_FLAG_PINNED     = 1 << 0,  // on an add or link, the entry is pinned
+        RECORD_FLAG_COMPRESSED = 1 << 1,  // on an add, the payload is a zstd frame
+        RECORD_FLAG_HASHED     = 1 << 2   // on a compressed add, the frame follows the u64 xxh64_hash() of the content
+    };
+
+    struct FileHeader
+    {
+        char     magic[8];
+        uint32_t version;
+        uint32_t next_id;
+        uint64_t end;         // where the last complete record ends
+        uint64_t generation;  // random, changes whenever the log is rewritten, to tell if the side index is for it
+    };
+
+    struct RecordHeader
+    {
+        uint32_t checksum;  // crc32 of the rest of the header and the payload
+        uint8_t  type;
+        uint8_t  flags;
+        uint16_t reserved;
+        uint32_t id;
+        uint32_t size;  // payload size
+        int64_t  time;
+    };
+
+private:
+    struct IndexHeader
+    {
+        char     magic[8];
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t generation;  // of the log it was made from
+        uint64_t end;         // how much of the log it covers
+        uint64_t live_bytes;
+        uint64_t dead_bytes;
+        uint64_t count;
+    };
+
+    // After the header, one array per field with a value per entry, sorted by id, in this order.
+    // The 8 bytes wide ones start 8 bytes aligned, so they can be used right from the mapping.
+    struct IndexColumns
+    {
+        const uint32_t* ids;
+        const uint32_t* sizes;
+        const uint64_t* offsets;  // of the content in the log
+        const uint64_t* hashes;
+        const uint64_t* records;
+        const int64_t*  times;
+        const uint8_t*  flags;  // RecordFlags
+    };
+
+    /*
+     * Get the size of a side index with count entries.
+     */
+    static size_t IndexFileSize(const uint64_t count);
+
+    struct Record
+    {
+        uint64_t offset;  // content offset, in the record of the entry having it
+        uint32_t size;    // as stored, compressed or not, without the hash before compressed ones
+        uint64_t hash;    // xxh64_hash() of the content
+        uint64_t record;  // offset of the record of this entry, a link or the content itself
+        int64_t  time;
+        bool     pinned;
+        bool     compressed;
+    };
+
+    FileHeader ReadHeader() const;
+    void       WriteHeader(const FileHeader& header);
+
+    /*
+     * Append a record after the end in header, and move the end in the log header past it.
+     * The append lock must be held, and header read after taking it.
+     */
+    void AppendRecord(FileHeader& header, const RecordType type, const uint32_t id, const std::string_view payload,
+                      const uint8_t flags = 0);
+
+    /*
+     * Open the log at m_Path, writing the header if it's new.
+     */
+    void Open();
+
+    /*
+     * Open the log again, after another clippyman instance renamed a compacted one over ours.
+     * Everything replayed from the old one is dropped.
+     */
+    void Reopen();
+
+    /*
+     * Take the append lock, waiting for the other instances appending.
+     * If the log got compacted meanwhile, it's taken again on the new one.
+     */
+    void LockAppend();
+    void UnlockAppend();
+
+    /*
+     * Read a content, decompressing it if it's stored compressed.
+     */
+    void ReadContent(const uint64_t offset, const uint32_t size, const bool compressed, std::string& content);
+
+    /*
+     * Get the zstd contexts, nullptr if libzstd isn't installed.
+     */
+    CZstd* GetZstd();
+
+    /*
+     * Read the dictionary of the log, from its first record.
+     * @param time When it was trained
+     * @return false if it has none
+     */
+    bool ReadDictionary(std::string& dict, int64_t& time) const;
+
+    /*
+     * Add the dictionary of the log to the zstd contexts, once per log, and keep its id in m_DictId.
+     */
+    void LoadDictionary();
+
+    /*
+     * Check if enough entries have been copied since the dictionary was trained to train a new one,
+     * or if there are enough of them to train a first one.
+     */
+    bool ShouldTrainDictionary() const;
+
+    /*
+     * Compress a content into the payload of its add record, with the dictionary having this id, or none if it's 0.
+     * @param hash xxh64_hash() of the content, it goes before the frame
+     * @return false if compression is off, or it wouldn't make it smaller
+     */
+    bool CompressContent(const std::string_view content, const uint64_t hash, const uint32_t dictId,
+                         std::string& payload);
+    void DecompressContent(const std::string_view frame, std::string& content, const size_t max = SIZE_MAX);
+
+    /*
+     * Train a dictionary on the newest live entries, keeping some of them out to check it
+     * compresses them better than the current one.
+     * @return An empty string if there's not enough of them, or it doesn't do better
+     */
+    std::string TrainDictionary();
+
+    /*
+     * Find an entry with this content.
+     * @return false if there's none
+     */
+    bool FindContent(const std::string_view content, const uint64_t hash, uint32_t& id);
+
+    /*
+     * Check if the record of an entry is the one having its content, not a link to it.
+     */
+    static bool OwnsContent(const Record& record);
+
+    /*
+     * Get the bytes the record of an entry takes in the file, the content only counts for the entry having it.
+     */
+    static uint64_t RecordBytes(const Record& record);
+
+    /*
+     * Read the records we haven't seen yet, also the ones appended by other clippyman instances.
+     * The first time, start from the side index if there's a good one.
+     */
+    void Replay();
+
+    /*
+     * Map the side index, if it's for this log.
+     * @return false if there's none, or it's for another log
+     */
+    bool MapIndex();
+
+    /*
+     * Check if the side index covers the whole log, so ids can be looked up in it without replaying.
+     */
+    bool IndexIsCurrent();
+
+    /*
+     * Fill the table of GetEntryTable() or GetPreviewTable(), with up to maxSize bytes of each entry.
+     */
+    void FillTable(EntryTable& table, const size_t maxSize);
+
+    /*
+     * Look up an id in the side index, it must be mapped.
+     * @param pos Where it is in the columns
+     * @return false if there's no entry with that id
+     */
+    bool FindInIndex(const uint32_t id, size_t& pos) const;
+
+    /*
+     * Write the replayed map into a new side index, and rename it over the old one.
+     */
+    void SaveIndex();
+
+    std::string m_Path;
+
+    int m_Fd = -1;
+
+    // we hold the append lock on m_Fd
+    bool m_AppendLocked = false;
+
+    uint64_t m_ReplayedOffset = sizeof(FileHeader);
+
+    // records appended since the last fsync
+    size_t                                m_Unsynced = 0;
+    std::chrono::steady_clock::time_point m_LastSync;
+
+    // m_Records has been filled, until then lookups may go straight to the side index
+    bool m_Loaded = false;
+
+    // how much of the log the side index on disk covers, 0 if it's not for this log
+    uint64_t m_IndexEnd = 0;
+
+    const IndexHeader* m_Index     = nullptr;
+    size_t             m_IndexSize = 0;
+    IndexColumns       m_IndexColumns{};
+
+    std::map<uint32_t, Record> m_Records;
+
+    // content hash -> ids of the entries with it
+    std::unordered_multimap<uint64_t, uint32_t> m_Hashes;
+
+    // bytes taken by live records and by tombstones/deleted records, to know when it's worth compacting
+    uint64_t m_LiveBytes = 0;
+    uint64_t m_DeadBytes = 0;
+
+    // created the first time something gets compressed or decompressed
+    std::unique_ptr<CZstd> m_Zstd;
+
+    // id of the dictionary of the log, 0 if it has none, and when it was trained, set by LoadDictionary()
+    uint32_t m_DictId     = 0;
+    int64_t  m_DictTime   = 0;
+    bool     m_DictLoaded = false;
+
+    // the last training didn't give a better dictionary, so don't compact only for training again
+    // until the next compaction needed anyway
+    bool m_DictTrainingFailed = false;
+};
+
+#endif  // !_HISTORY_BACKEND_LOG_HPP_
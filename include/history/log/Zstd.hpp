@@ -0,0 +1,85 @@
+#ifndef _ZSTD_HPP_
+#define _ZSTD_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+struct ZSTD_CCtx_s;
+struct ZSTD_DCtx_s;
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
+
+/* zstd compression, with libzstd loaded at runtime, so it's only needed for histories using it.
+ * Frames compressed with a dictionary have its id in them, so decompressing finds it by itself
+ * among the ones added with AddDictionary().
+ */
+class CZstd
+{
+public:
+    /*
+     * Check if libzstd is installed, loading it the first time.
+     * Nothing else may be used if it's not.
+     */
+    static bool IsAvailable();
+
+    CZstd();
+    ~CZstd();
+
+    CZstd(const CZstd&)            = delete;
+    CZstd& operator=(const CZstd&) = delete;
+
+    /*
+     * Add a dictionary, for compressing with it and decompressing the frames made with it.
+     * @return Its id, or 0 if it's not a zstd dictionary
+     */
+    uint32_t AddDictionary(const std::string_view dict);
+
+    /*
+     * Check if the dictionary with this id has been added.
+     */
+    bool HasDictionary(const uint32_t id) const
+    { return m_Dicts.find(id) != m_Dicts.end(); }
+
+    /*
+     * Compress src into a frame, with the dictionary having this id, or none if it's 0.
+     * @return false if it failed
+     */
+    bool Compress(const std::string_view src, const uint32_t dictId, std::string& dst);
+
+    /*
+     * Decompress a frame, with the dictionary it was compressed with.
+     * @param max Stop after this many bytes, so getting the start of a big entry doesn't decompress all of it
+     * @return false if it's not a valid frame, or its dictionary hasn't been added
+     */
+    bool Decompress(const std::string_view src, std::string& dst, const size_t max = SIZE_MAX);
+
+    /*
+     * Get the id of the dictionary a frame needs, 0 if it doesn't need one.
+     */
+    static uint32_t GetFrameDictionary(const std::string_view src);
+
+    /*
+     * Train a dictionary of at most capacity bytes on samples of what will be compressed.
+     * @return An empty string if they're not enough for training one
+     */
+    static std::string TrainDictionary(const std::vector<std::string_view>& samples, const size_t capacity);
+
+private:
+    struct Dictionary
+    {
+        ZSTD_CDict_s* cdict;
+        ZSTD_DDict_s* ddict;
+    };
+
+    ZSTD_CCtx_s* m_CCtx = nullptr;
+    ZSTD_DCtx_s* m_DCtx = nullptr;
+
+    // dictionary id -> dictionary
+    std::unordered_map<uint32_t, Dictionary> m_Dicts;
+};
+
+#endif  // !_ZSTD_HPP_
@@ -2,6 +2,8 @@
 #define _UTIL_HPP_
 
 #include <dlfcn.h>
+#include <sys/types.h>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
 
@@ -41,6 +43,49 @@ inline bool is_xorg = false;
  */
 bool hasStart(const std::string_view fullString, const std::string_view start);
 
+/* Compute the CRC-32 (the zlib one) of a buffer
+ * @param data The buffer
+ * @param len The buffer size
+ * @param crc The CRC of the previous buffers, for checksumming in multiple steps
+ */
+uint32_t crc32_checksum(const void* data, const size_t len, uint32_t crc = 0);
+
+/* Compute the 64-bit XXH64 hash of a buffer, for telling apart contents (not for checksumming them)
+ * @param data The buffer
+ * @param len The buffer size
+ * @param seed Gives a different hash for the same buffer
+ */
+uint64_t xxh64_hash(const void* data, const size_t len, const uint64_t seed = 0);
+
+/* Get how many bytes of text fit in max, without cutting an UTF-8 character in half
+ * @param text The text to cut
+ * @param max The most bytes to keep
+ */
+size_t utf8_prefix_size(const std::string_view text, const size_t max);
+
+/* fsync the directory of a file, so a file just renamed into it survives a crash
+ * @param path The path of the file
+ * @return false if it failed
+ */
+bool sync_parent_dir(const std::string& path);
+
+/* Take a write lock on a byte range of a file, it's advisory so it only keeps out the ones asking for it too.
+ * The lock belongs to the open file (not the process), so it's released when fd is closed,
+ * but closing another fd of the same file doesn't drop it.
+ * @param len 0 means up to the end of the file, even as it grows
+ * @param wait Wait for the other holder to release it, else fail right away
+ * @return false if it couldn't be taken
+ */
+bool lock_file_range(const int fd, const off_t start, const off_t len, const bool wait = true);
+
+/* Release a lock taken with lock_file_range()
+ */
+void unlock_file_range(const int fd, const off_t start, const off_t len);
+
+/* Check if the file opened at fd is not at path anymore, because a new one got renamed over it or it got deleted
+ */
+bool file_was_replaced(const int fd, const std::string& path);
+
 /* Write error message and exit if EOF (or CTRL-D most of the time)
  * @param cin The std::cin used for getting the input
  */
@@ -0,0 +1,150 @@
+#include "EventLoop.hpp"
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include "util.hpp"
+
+CEventLoop::CEventLoop()
+{
+    m_EpollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_EpollFd < 0)
+        die("Failed to create epoll instance: {}", strerror(errno));
+
+    sigemptyset(&m_Signals);
+}
+
+CEventLoop::~CEventLoop()
+{
+    for (const int fd : m_OwnedFds)
+        close(fd);
+    close(m_EpollFd);
+}
+
+void CEventLoop::AddFd(const int fd, const std::function<void()>& func)
+{
+    epoll_event ev{};
+    ev.events  = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(m_EpollFd, EPOLL_CTL_ADD, fd, &ev) != 0)
+        die("Failed to watch fd {}: {}", fd, strerror(errno));
+
+    m_Handlers[fd] = func;
+}
+
+void CEventLoop::SetWriteHandler(const int fd, const std::function<void()>& func)
+{
+    epoll_event ev{};
+    ev.events  = func ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(m_EpollFd, EPOLL_CTL_MOD, fd, &ev) != 0)
+        die("Failed to watch fd {}: {}", fd, strerror(errno));
+
+    if (func)
+        m_WriteHandlers[fd] = func;
+    else
+        m_WriteHandlers.erase(fd);
+}
+
+void CEventLoop::RemoveFd(const int fd)
+{
+    epoll_ctl(m_EpollFd, EPOLL_CTL_DEL, fd, nullptr);
+    m_Handlers.erase(fd);
+    m_WriteHandlers.erase(fd);
+}
+
+void CEventLoop::AddTimer(const std::chrono::milliseconds interval, const std::function<void()>& func)
+{
+    const int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (fd < 0)
+        die("Failed to create timer: {}", strerror(errno));
+
+    itimerspec spec{};
+    spec.it_interval.tv_sec  = interval.count() / 1000;
+    spec.it_interval.tv_nsec = (interval.count() % 1000) * 1000000;
+    spec.it_value            = spec.it_interval;
+    if (timerfd_settime(fd, 0, &spec, nullptr) != 0)
+        die("Failed to arm timer: {}", strerror(errno));
+
+    m_OwnedFds.push_back(fd);
+    AddFd(fd, [fd, func] {
+        uint64_t expirations;
+        if (read(fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+            func();
+    });
+}
+
+void CEventLoop::AddSignal(const int signo, const std::function<void()>& func)
+{
+    sigaddset(&m_Signals, signo);
+    if (pthread_sigmask(SIG_BLOCK, &m_Signals, nullptr) != 0)
+        die("Failed to block signal {}", signo);
+
+    const bool first = m_SignalFd < 0;
+    m_SignalFd       = signalfd(m_SignalFd, &m_Signals, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (m_SignalFd < 0)
+        die("Failed to create signalfd: {}", strerror(errno));
+
+    m_SignalHandlers[signo] = func;
+    if (!first)
+        return;
+
+    m_OwnedFds.push_back(m_SignalFd);
+    AddFd(m_SignalFd, [this] {
+        signalfd_siginfo info;
+        while (read(m_SignalFd, &info, sizeof(info)) == sizeof(info))
+        {
+            const auto& it = m_SignalHandlers.find(info.ssi_signo);
+            if (it != m_SignalHandlers.end())
+                it->second();
+        }
+    });
+}
+
+void CEventLoop::Run()
+{
+    epoll_event events[32];
+    m_Running = true;
+    while (m_Running)
+    {
+        const int n = epoll_wait(m_EpollFd, events, 32, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            die("epoll_wait() failed: {}", strerror(errno));
+        }
+
+        for (int i = 0; i < n && m_Running; ++i)
+        {
+            const int fd = events[i].data.fd;
+            if (events[i].events & EPOLLOUT)
+            {
+                // an earlier callback may have removed it
+                const auto& it = m_WriteHandlers.find(fd);
+                if (it != m_WriteHandlers.end())
+                {
+                    // copy it, the callback may remove itself
+                    const std::function<void()> handler = it->second;
+                    handler();
+                }
+            }
+
+            if ((events[i].events & ~EPOLLOUT) == 0)
+                continue;
+
+            const auto& it = m_Handlers.find(fd);
+            if (it == m_Handlers.end())
+                continue;
+
+            const std::function<void()> handler = it->second;
+            handler();
+        }
+    }
+}
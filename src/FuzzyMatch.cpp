@@ -0,0 +1,426 @@
+#include "FuzzyMatch.hpp"
+
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define HAVE_AVX2_TARGET 1
+#endif
+
+// Scores taken from fzf (src/algo/algo.go)
+constexpr int SCORE_MATCH                 = 16;
+constexpr int SCORE_GAP_START             = -3;
+constexpr int SCORE_GAP_EXTENSION         = -1;
+constexpr int BONUS_BOUNDARY              = SCORE_MATCH / 2;
+constexpr int BONUS_BOUNDARY_WHITE        = BONUS_BOUNDARY + 2;
+constexpr int BONUS_BOUNDARY_DELIMITER    = BONUS_BOUNDARY + 1;
+constexpr int BONUS_NONWORD               = SCORE_MATCH / 2;
+constexpr int BONUS_CAMEL123              = BONUS_BOUNDARY + SCORE_GAP_EXTENSION;
+constexpr int BONUS_CONSECUTIVE           = -(SCORE_GAP_START + SCORE_GAP_EXTENSION);
+constexpr int BONUS_FIRST_CHAR_MULTIPLIER = 2;
+
+// above this many DP cells, score the shortest greedy match instead
+constexpr size_t MAX_DP_CELLS = 1 << 17;
+
+constexpr int SCORE_NONE = INT_MIN / 2;
+
+enum CharClass : uint8_t
+{
+    CHAR_WHITE,
+    CHAR_NONWORD,
+    CHAR_DELIMITER,
+    CHAR_LOWER,
+    CHAR_UPPER,
+    CHAR_NUMBER
+};
+
+static CharClass char_class(const unsigned char c)
+{
+    if (c >= 'a' && c <= 'z')
+        return CHAR_LOWER;
+    if (c >= 'A' && c <= 'Z')
+        return CHAR_UPPER;
+    if (c >= '0' && c <= '9')
+        return CHAR_NUMBER;
+    if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f')
+        return CHAR_WHITE;
+    if (c == '/' || c == ',' || c == ':' || c == ';' || c == '|')
+        return CHAR_DELIMITER;
+    // treat UTF-8 bytes as letters
+    if (c >= 0x80)
+        return CHAR_LOWER;
+    return CHAR_NONWORD;
+}
+
+static int bonus_for(const CharClass prev, const CharClass cur)
+{
+    if (cur > CHAR_DELIMITER)
+    {
+        switch (prev)
+        {
+            case CHAR_WHITE:     return BONUS_BOUNDARY_WHITE;
+            case CHAR_DELIMITER: return BONUS_BOUNDARY_DELIMITER;
+            case CHAR_NONWORD:   return BONUS_BOUNDARY;
+            default:             break;
+        }
+    }
+
+    if ((prev == CHAR_LOWER && cur == CHAR_UPPER) || (prev != CHAR_NUMBER && cur == CHAR_NUMBER))
+        return BONUS_CAMEL123;
+
+    switch (cur)
+    {
+        case CHAR_NONWORD:
+        case CHAR_DELIMITER: return BONUS_NONWORD;
+        case CHAR_WHITE:     return BONUS_BOUNDARY_WHITE;
+        default:             return 0;
+    }
+}
+
+static const auto char_classes = [] {
+    std::array<CharClass, 256> t{};
+    for (size_t c = 0; c < t.size(); ++c)
+        t[c] = char_class(c);
+    return t;
+}();
+
+// bonus_for() of every pair of classes
+static const auto bonuses = [] {
+    std::array<std::array<int8_t, CHAR_NUMBER + 1>, CHAR_NUMBER + 1> t{};
+    for (int prev = 0; prev <= CHAR_NUMBER; ++prev)
+        for (int cur = 0; cur <= CHAR_NUMBER; ++cur)
+            t[prev][cur] = bonus_for(static_cast<CharClass>(prev), static_cast<CharClass>(cur));
+    return t;
+}();
+
+static int bonus_at(const std::string_view text, const size_t i)
+{
+    return bonuses[i == 0 ? CHAR_WHITE : char_classes[static_cast<uint8_t>(text[i - 1])]]
+                  [char_classes[static_cast<uint8_t>(text[i])]];
+}
+
+static char fold_case(const char c)
+{ return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c; }
+
+static char other_case(const char c)
+{ return (c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c; }
+
+/*
+ * Byte scans used to reject entries before scoring them.
+ * They find the first byte equal to either a or b (the two cases of a pattern byte),
+ * the vectorized ones compare 16/32 bytes at once and only look at the mask.
+ */
+static const char* find_byte_scalar(const char* p, const char* end, const char a, const char b)
+{
+    if (a == b)
+    {
+        const void* ret = memchr(p, a, end - p);
+        return ret ? static_cast<const char*>(ret) : end;
+    }
+
+    for (; p < end; ++p)
+        if (*p == a || *p == b)
+            return p;
+    return end;
+}
+
+#if defined(__SSE2__)
+static const char* find_byte_sse2(const char* p, const char* end, const char a, const char b)
+{
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    for (; end - p >= 16; p += 16)
+    {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const int     mask  = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, va), _mm_cmpeq_epi8(chunk, vb)));
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+    }
+    return find_byte_scalar(p, end, a, b);
+}
+#endif
+
+#if defined(HAVE_AVX2_TARGET)
+__attribute__((target("avx2"))) static const char* find_byte_avx2(const char* p, const char* end, const char a,
+                                                                    const char b)
+{
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    for (; end - p >= 32; p += 32)
+    {
+        const __m256i  chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        const uint32_t mask  = _mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, va), _mm256_cmpeq_epi8(chunk, vb)));
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+    }
+    return find_byte_scalar(p, end, a, b);
+}
+#endif
+
+using find_byte_func = const char* (*)(const char*, const char*, const char, const char);
+
+static find_byte_func pick_find_byte()
+{
+#if defined(HAVE_AVX2_TARGET)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return find_byte_avx2;
+#endif
+#if defined(__SSE2__)
+    return find_byte_sse2;
+#else
+    return find_byte_scalar;
+#endif
+}
+
+static const find_byte_func find_byte = pick_find_byte();
+
+bool fuzzyIgnoreCase(const std::string_view pattern)
+{
+    return std::none_of(pattern.begin(), pattern.end(), [](const char c) { return c >= 'A' && c <= 'Z'; });
+}
+
+// greedy score of the matched positions, same formula as the DP below
+static int score_positions(const std::string_view text, const std::vector<size_t>& positions)
+{
+    int score = 0;
+    for (size_t j = 0; j < positions.size(); ++j)
+    {
+        const size_t i     = positions[j];
+        const int    bonus = bonus_at(text, i);
+        if (j == 0)
+            score += SCORE_MATCH + bonus * BONUS_FIRST_CHAR_MULTIPLIER;
+        else if (i == positions[j - 1] + 1)
+            score += SCORE_MATCH + std::max(bonus, BONUS_CONSECUTIVE);
+        else
+            score += SCORE_MATCH + bonus + SCORE_GAP_START + SCORE_GAP_EXTENSION * static_cast<int>(i - positions[j - 1] - 2);
+    }
+    return score;
+}
+
+/*
+ * Same DP as in fuzzyMatch(), but only keeping the last 2 columns (text positions),
+ * since the score alone doesn't need to walk back the matrix.
+ * It works on text[sidx, sidx + n) directly, a byte only gets classified if it's in pattern.
+ */
+static int score_columns(const std::string_view text, const size_t sidx, const size_t n, const std::string_view pattern,
+                         const bool ignore_case)
+{
+    const size_t                  m = pattern.size();
+    thread_local std::vector<int> state;
+    state.assign(4 * m, SCORE_NONE);
+
+    std::array<bool, 256> in_pattern{};
+    for (const char c : pattern)
+        in_pattern[static_cast<uint8_t>(c)] = true;
+
+    int* prev2 = &state[0];
+    int* prev  = &state[m];
+    int* cur   = &state[2 * m];
+    int* gap   = &state[3 * m];
+    int  best  = SCORE_NONE;
+
+    // columns not matching anything, after two of them the only change left is the gaps growing,
+    // so they're skipped and the gaps get extended all at once
+    bool   prev_any = false, prev2_any = false;
+    size_t skipped  = 0;
+    for (size_t i = sidx; i < sidx + n; ++i)
+    {
+        const char c = ignore_case ? fold_case(text[i]) : text[i];
+        if (!in_pattern[static_cast<uint8_t>(c)] && !prev_any && !prev2_any)
+        {
+            ++skipped;
+            continue;
+        }
+        if (skipped > 0)
+        {
+            for (size_t j = 1; j < m; ++j)
+                gap[j] = std::max(gap[j] + SCORE_GAP_EXTENSION * static_cast<int>(skipped), SCORE_NONE);
+            skipped = 0;
+        }
+
+        const int bonus = in_pattern[static_cast<uint8_t>(c)] ? bonus_at(text, i) : 0;
+
+        bool cur_any = c == pattern[0];
+        cur[0]       = cur_any ? SCORE_MATCH + bonus * BONUS_FIRST_CHAR_MULTIPLIER : SCORE_NONE;
+        for (size_t j = 1; j < m; ++j)
+        {
+            gap[j] = std::max(gap[j] + SCORE_GAP_EXTENSION, prev2[j - 1] + SCORE_GAP_START);
+            if (c != pattern[j])
+            {
+                cur[j] = SCORE_NONE;
+                continue;
+            }
+
+            const int value = std::max(prev[j - 1] + SCORE_MATCH + std::max(bonus, BONUS_CONSECUTIVE),
+                                       gap[j] + SCORE_MATCH + bonus);
+            cur[j]          = value > SCORE_NONE / 2 ? value : SCORE_NONE;
+            cur_any |= cur[j] != SCORE_NONE;
+        }
+        best = std::max(best, cur[m - 1]);
+
+        int* tmp  = prev2;
+        prev2     = prev;
+        prev      = cur;
+        cur       = tmp;
+        prev2_any = prev_any;
+        prev_any  = cur_any;
+    }
+
+    return best;
+}
+
+bool fuzzyMatch(const std::string_view text, const std::string_view pattern, const bool ignore_case, int& score,
+                std::vector<size_t>* positions)
+{
+    score = 0;
+    if (positions)
+        positions->clear();
+    if (pattern.empty())
+        return true;
+
+    const size_t m = pattern.size();
+    const auto&  eq = [&](const char c, const size_t j) { return (ignore_case ? fold_case(c) : c) == pattern[j]; };
+
+    // prefilter: the earliest position where every byte of pattern was found in order
+    const char* const begin = text.data();
+    const char* const end   = text.data() + text.size();
+    const char*       p     = begin;
+    const char*       first = nullptr;
+    for (size_t j = 0; j < m; ++j)
+    {
+        const char c = pattern[j];
+        p            = find_byte(p, end, c, ignore_case ? other_case(c) : c);
+        if (p == end)
+            return false;
+        if (j == 0)
+            first = p;
+        ++p;
+    }
+
+    // the best match can't go past the last occurrence of the last pattern byte
+    size_t last = text.size() - 1;
+    while (!eq(text[last], m - 1))
+        --last;
+
+    const size_t sidx = first - begin;
+    const size_t n    = last - sidx + 1;
+
+    thread_local std::vector<size_t> greedy;
+    if (n * m > MAX_DP_CELLS)
+    {
+        // too big to score every possibility, take the shortest match ending the earliest instead
+        size_t start = (p - begin) - 1;
+        for (size_t j = m; j > 0; --start)
+            if (eq(text[start], j - 1) && --j == 0)
+                break;
+
+        greedy.clear();
+        for (size_t i = start, j = 0; j < m; ++i)
+        {
+            if (eq(text[i], j))
+            {
+                greedy.push_back(i);
+                ++j;
+            }
+        }
+
+        score = score_positions(text, greedy);
+        if (positions)
+            *positions = greedy;
+        return true;
+    }
+
+    if (!positions)
+    {
+        score = score_columns(text, sidx, n, pattern, ignore_case);
+        return true;
+    }
+
+    // fold and classify the window once, instead of once per pattern byte
+    thread_local std::string      folded;
+    thread_local std::vector<int> bonus;
+    folded.resize(n);
+    bonus.resize(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        folded[i] = ignore_case ? fold_case(text[sidx + i]) : text[sidx + i];
+        bonus[i]  = bonus_at(text, sidx + i);
+    }
+
+    // M[j * n + i] = best score with pattern[j] matched at sidx + i, and pattern[0..j) before it
+    thread_local std::vector<int> M;
+    M.assign(n * m, SCORE_NONE);
+
+    for (size_t i = 0; i < n; ++i)
+        if (folded[i] == pattern[0])
+            M[i] = SCORE_MATCH + bonus[i] * BONUS_FIRST_CHAR_MULTIPLIER;
+
+    for (size_t j = 1; j < m; ++j)
+    {
+        const int* prev = &M[(j - 1) * n];
+        int*       cur  = &M[j * n];
+        // best score coming from pattern[j - 1] matched before i - 1, gap penalty included
+        int gap = SCORE_NONE;
+        for (size_t i = j; i < n; ++i)
+        {
+            if (i >= 2)
+                gap = std::max(gap + SCORE_GAP_EXTENSION, prev[i - 2] + SCORE_GAP_START);
+
+            if (folded[i] != pattern[j])
+                continue;
+
+            const int consecutive = prev[i - 1] + SCORE_MATCH + std::max(bonus[i], BONUS_CONSECUTIVE);
+            const int gapped      = gap + SCORE_MATCH + bonus[i];
+            const int best        = std::max(consecutive, gapped);
+            if (best > SCORE_NONE / 2)
+                cur[i] = best;
+        }
+    }
+
+    const int* row    = &M[(m - 1) * n];
+    size_t     best_i = 0;
+    for (size_t i = 1; i < n; ++i)
+        if (row[i] > row[best_i])
+            best_i = i;
+
+    score = row[best_i];
+
+    // walk back the choices that gave the best score
+    positions->resize(m);
+    size_t i = best_i;
+    for (size_t j = m - 1; j > 0; --j)
+    {
+        (*positions)[j] = sidx + i;
+
+        const int* prev   = &M[(j - 1) * n];
+        const int  target = M[j * n + i];
+        if (prev[i - 1] > SCORE_NONE / 2 && prev[i - 1] + SCORE_MATCH + std::max(bonus[i], BONUS_CONSECUTIVE) == target)
+        {
+            --i;
+            continue;
+        }
+
+        for (size_t k = i - 2;; --k)
+        {
+            if (prev[k] > SCORE_NONE / 2 &&
+                prev[k] + SCORE_GAP_START + SCORE_GAP_EXTENSION * static_cast<int>(i - k - 2) + SCORE_MATCH + bonus[i] == target)
+            {
+                i = k;
+                break;
+            }
+        }
+    }
+    (*positions)[0] = sidx + i;
+
+    return true;
+}
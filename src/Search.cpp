@@ -0,0 +1,267 @@
+#include "Search.hpp"
+
+#include <algorithm>
+
+#include "FuzzyMatch.hpp"
+
+// below this many candidates, searching right away is faster than waking up the workers
+constexpr size_t PARALLEL_THRESHOLD = 8192;
+
+// shards per worker, so a worker stuck with slow entries doesn't hold back the others
+constexpr size_t SHARDS_PER_WORKER = 4;
+
+// how often a worker checks if its job got cancelled
+constexpr size_t CANCEL_CHECK_INTERVAL = 256;
+
+// the preview may stop before a character that didn't fit whole, up to 3 bytes short of its size
+constexpr size_t UTF8_CUT_SLACK = 3;
+
+CSearch::CSearch(const std::vector<std::string_view>& entries_value, const std::vector<uint32_t>& entries_id,
+                 const CTrigramIndex& index, const bool fuzzy, const size_t previewSize, BodyLoader loadBodies)
+    : m_EntriesValue(entries_value),
+      m_EntriesId(entries_id),
+      m_Index(index),
+      m_Fuzzy(fuzzy),
+      m_PreviewSize(previewSize),
+      m_LoadBodies(std::move(loadBodies))
+{
+    if (!m_LoadBodies)
+        m_PreviewSize = SIZE_MAX;
+    m_Texts = std::make_shared<std::vector<std::string_view>>(m_EntriesValue);
+    m_BodyLoaded.resize(m_EntriesValue.size());
+
+    auto all = std::make_shared<std::vector<size_t>>(m_EntriesValue.size());
+    for (size_t i = 0; i < all->size(); ++i)
+        (*all)[i] = i;
+    m_Stack.push_back({ "", std::move(all) });
+
+    if (m_EntriesValue.size() < PARALLEL_THRESHOLD)
+        return;
+
+    const size_t workers = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < workers; ++i)
+        m_Workers.emplace_back(&CSearch::Worker, this);
+}
+
+CSearch::~CSearch()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Stop = true;
+    }
+    ++m_Generation;
+    m_WorkCond.notify_all();
+
+    for (std::thread& worker : m_Workers)
+        worker.join();
+}
+
+bool CSearch::CanNarrow(const std::string& from, const std::string& to) const
+{
+    if (!m_Fuzzy)
+        return to.find(from) != to.npos;
+
+    size_t j = 0;
+    for (size_t i = 0; i < to.size() && j < from.size(); ++i)
+        if (to[i] == from[j])
+            ++j;
+    return j == from.size();
+}
+
+bool CSearch::MatchShard(const Job& job, const size_t shard, std::vector<std::pair<int, size_t>>& out) const
+{
+    const std::vector<size_t>& candidates = *job.candidates;
+    const size_t               begin      = candidates.size() * shard / job.shards.size();
+    const size_t               end        = candidates.size() * (shard + 1) / job.shards.size();
+
+    int score = 0;
+    for (size_t k = begin; k < end; ++k)
+    {
+        if ((k - begin) % CANCEL_CHECK_INTERVAL == 0 && job.generation != m_Generation.load(std::memory_order_relaxed))
+            return false;
+
+        const size_t           i     = candidates[k];
+        const std::string_view entry = (*job.texts)[i];
+        if (m_Fuzzy ? fuzzyMatch(entry, job.query, job.ignore_case, score) : entry.find(job.query) != entry.npos)
+            out.emplace_back(score, i);
+    }
+
+    return true;
+}
+
+CSearch::Level CSearch::MergeShards(Job& job) const
+{
+    std::vector<std::pair<int, size_t>>& merged = job.shards.front();
+    for (size_t i = 1; i < job.shards.size(); ++i)
+        merged.insert(merged.end(), job.shards[i].begin(), job.shards[i].end());
+
+    // the best first, then keep the order they had
+    if (m_Fuzzy)
+        std::stable_sort(merged.begin(), merged.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+    auto results = std::make_shared<std::vector<size_t>>();
+    results->reserve(merged.size());
+    for (const auto& it : merged)
+        results->push_back(it.second);
+
+    return { job.query, std::move(results) };
+}
+
+void CSearch::Worker()
+{
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    while (true)
+    {
+        m_WorkCond.wait(lock, [this] { return m_Stop || (m_Job && m_Job->next_shard < m_Job->shards.size()); });
+        if (m_Stop)
+            return;
+
+        // keep it alive, SetQuery() may replace it meanwhile
+        const std::shared_ptr<Job> job   = m_Job;
+        const size_t               shard = job->next_shard++;
+        lock.unlock();
+
+        // every shard has its own output, so no lock needed
+        const bool complete = MatchShard(*job, shard, job->shards[shard]);
+
+        lock.lock();
+        if (!complete || ++job->done < job->shards.size())
+            continue;
+
+        // the last shard done merges them all, without blocking SetQuery() meanwhile
+        lock.unlock();
+        Level level = MergeShards(*job);
+        lock.lock();
+
+        if (job->generation == m_Generation.load())
+        {
+            m_Ready           = std::make_unique<Level>(std::move(level));
+            m_ReadyGeneration = job->generation;
+        }
+        if (m_Job == job)
+            m_Job.reset();
+    }
+}
+
+void CSearch::SetQuery(const std::string& query)
+{
+    const uint64_t generation = ++m_Generation;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Job.reset();
+        m_Ready.reset();
+    }
+    m_Searching = false;
+
+    // drop the levels that can't be narrowed into query, the empty one at the bottom always can
+    while (m_Stack.size() > 1 && !CanNarrow(m_Stack.back().query, query))
+        m_Stack.pop_back();
+
+    if (m_Stack.back().query == query)
+        return;
+
+    auto job         = std::make_shared<Job>();
+    job->generation  = generation;
+    job->query       = query;
+    job->ignore_case = m_Fuzzy && fuzzyIgnoreCase(query);
+    job->candidates  = m_Stack.back().results;
+
+    // anything matching query also matches the query on top, so check whichever has less candidates
+    std::vector<uint32_t> ids;
+    if (!m_Fuzzy && m_Index.GetCandidates(query, ids) && ids.size() < job->candidates->size())
+    {
+        auto candidates = std::make_shared<std::vector<size_t>>();
+        for (const uint32_t id : ids)
+        {
+            // deleted entries are still in the index
+            const auto& it = std::lower_bound(m_EntriesId.begin(), m_EntriesId.end(), id);
+            if (it != m_EntriesId.end() && *it == id)
+                candidates->push_back(it - m_EntriesId.begin());
+        }
+        job->candidates = std::move(candidates);
+    }
+
+    // only the start of the cut entries is matched (or their whole text if it got shown already),
+    // loading them for every query would read the whole history
+    job->texts = m_Texts;
+
+    if (m_Workers.empty() || job->candidates->size() < PARALLEL_THRESHOLD)
+    {
+        job->shards.resize(1);
+        MatchShard(*job, 0, job->shards.front());
+        m_Stack.push_back(MergeShards(*job));
+        return;
+    }
+
+    job->shards.resize(m_Workers.size() * SHARDS_PER_WORKER);
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Job = std::move(job);
+    }
+    m_Searching = true;
+    m_WorkCond.notify_all();
+}
+
+bool CSearch::Poll()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (!m_Ready || m_ReadyGeneration != m_Generation.load())
+        return false;
+
+    m_Stack.push_back(std::move(*m_Ready));
+    m_Ready.reset();
+    m_Searching = false;
+    return true;
+}
+
+void CSearch::GetMatchPositions(const size_t i, std::vector<size_t>& positions) const
+{
+    positions.clear();
+    const std::string& query = m_Stack.back().query;
+    if (query.empty())
+        return;
+
+    if (m_Fuzzy)
+    {
+        int score;
+        fuzzyMatch(GetText(i), query, fuzzyIgnoreCase(query), score, &positions);
+        return;
+    }
+
+    const size_t pos = GetText(i).find(query);
+    if (pos == std::string::npos)
+        return;
+    for (size_t j = 0; j < query.size(); ++j)
+        positions.push_back(pos + j);
+}
+
+bool CSearch::IsPartial(const size_t i) const
+{ return !m_BodyLoaded[i] && m_PreviewSize != SIZE_MAX && m_EntriesValue[i].size() + UTF8_CUT_SLACK >= m_PreviewSize; }
+
+void CSearch::LoadBodies(const std::vector<size_t>& indices)
+{
+    std::vector<uint32_t> ids;
+    for (const size_t i : indices)
+    {
+        if (!IsPartial(i))
+            continue;
+        ids.push_back(m_EntriesId[i]);
+        // even if it got deleted meanwhile, so it's not asked for again
+        m_BodyLoaded[i] = true;
+    }
+    if (ids.empty())
+        return;
+
+    // the workers may still be matching the old texts
+    if (m_Texts.use_count() > 1)
+        m_Texts = std::make_shared<std::vector<std::string_view>>(*m_Texts);
+
+    m_LoadBodies(ids, [this](const uint32_t id, const std::string_view content) {
+        const auto& it = std::lower_bound(m_EntriesId.begin(), m_EntriesId.end(), id);
+        if (it == m_EntriesId.end() || *it != id)
+            return;
+
+        m_Bodies.emplace_back(content);
+        (*m_Texts)[it - m_EntriesId.begin()] = m_Bodies.back();
+    });
+}
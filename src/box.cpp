@@ -1,30 +1,141 @@
 #include <ncurses.h>
 #include <wchar.h>
 
-#include <sstream>
+#include <algorithm>
+#include <cstdint>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
-static std::vector<std::string> wrap_text(const std::string& text, const size_t max_width)
+#include "Search.hpp"
+
+// a wrapped line, as a range of bytes of its entry
+struct LineSpan
+{
+    uint32_t offset;
+    uint32_t length;
+};
+
+static void wrap_text(const std::string_view text, const size_t max_width, std::vector<LineSpan>& lines)
+{
+    size_t start = 0;
+    while (start < text.size())
+    {
+        size_t end = text.find('\n', start);
+        if (end == text.npos)
+            end = text.size();
+
+        for (; max_width > 0 && end - start > max_width; start += max_width)
+            lines.push_back({ static_cast<uint32_t>(start), static_cast<uint32_t>(max_width) });
+
+        lines.push_back({ static_cast<uint32_t>(start), static_cast<uint32_t>(end - start) });
+        start = end + 1;
+    }
+}
+
+struct Layout
+{
+    // of the text it was wrapped from, it only grows from the start of an entry to all of it
+    size_t                size = 0;
+    std::vector<LineSpan> lines;
+};
+
+// wrapped lines of the entries drawn so far by id, all for the same width.
+// Entries never change, so they only need to be wrapped again when the terminal gets resized
+// or when their whole text replaces their start
+static std::unordered_map<uint32_t, Layout> layout_cache;
+static size_t                               layout_width = 0;
+
+static const std::vector<LineSpan>& get_layout(const uint32_t id, const std::string_view text, const size_t max_width)
+{
+    if (max_width != layout_width)
+    {
+        layout_cache.clear();
+        layout_width = max_width;
+    }
+
+    const auto& [it, inserted] = layout_cache.try_emplace(id);
+    if (inserted || it->second.size != text.size())
+    {
+        it->second.size = text.size();
+        it->second.lines.clear();
+        wrap_text(text, max_width, it->second.lines);
+    }
+    return it->second.lines;
+}
+
+// print a line of text, highlighting the bytes at positions (sorted offsets into text)
+static void print_highlighted(const std::string_view text, const LineSpan span, const std::vector<size_t>& positions)
 {
-    std::vector<std::string> lines;
-    std::stringstream        ss(text);
-    std::string              line;
+    const std::string_view line   = text.substr(span.offset, span.length);
+    const size_t           offset = span.offset;
+    auto                   it     = std::lower_bound(positions.begin(), positions.end(), offset);
 
-    while (std::getline(ss, line, '\n'))
+    size_t i = 0;
+    while (i < line.size())
     {
-        while (line.length() > max_width)
+        const bool highlight = it != positions.end() && *it == offset + i;
+        size_t     j         = i;
+        if (highlight)
+        {
+            while (j < line.size() && it != positions.end() && *it == offset + j)
+            {
+                ++j;
+                ++it;
+            }
+            attron(A_BOLD | A_UNDERLINE);
+        }
+        else
         {
-            lines.push_back(line.substr(0, max_width));
-            line = line.substr(max_width);
+            j = (it != positions.end()) ? std::min(*it - offset, line.size()) : line.size();
         }
 
-        lines.push_back(line);
+        addnstr(line.data() + i, j - i);
+        if (highlight)
+            attroff(A_BOLD | A_UNDERLINE);
+        i = j;
     }
-
-    return lines;
 }
 
+// a row of the results list: a wrapped line of an entry, or a blank one between entries
+struct Row
+{
+    uint32_t id    = UINT32_MAX;
+    uint32_t line  = 0;
+    bool     blank = true;
+    // A_REVERSE
+    bool selected = false;
+
+    // index of the entry in the table, not compared since the table gets reloaded after a delete
+    size_t index = 0;
+
+    // of the entry text, the line may change once its whole text is loaded
+    size_t size = 0;
+
+    bool operator==(const Row& other) const
+    {
+        return blank == other.blank && (blank || (id == other.id && line == other.line && selected == other.selected &&
+                                                  size == other.size));
+    }
+    bool operator!=(const Row& other) const
+    { return !(*this == other); }
+};
+
+// what was drawn last time, so only what changed gets drawn again
+static struct
+{
+    bool             valid = false;
+    int              maxy = 0, maxx = 0;
+    std::string      query;
+    size_t           results   = 0;
+    bool             searching = false;
+    std::vector<Row> rows;
+} frame;
+
+// the first row of the results list
+constexpr int LIST_TOP = 3;
+
 // Begin: some code taken from https://github.com/rofl0r/ncdu in src/delete.c and src/util.c
 #define ncaddstr(r, c, s) mvaddstr(subwinr + (r), subwinc + (c), s)
 #define ncmove(r, c) move(subwinr + (r), subwinc + (c))
@@ -78,6 +189,9 @@ static void ncprint(int r, int c, const char* fmt, ...)
 
 void delete_draw_confirm(const int seloption)
 {
+    // drawn over the search box
+    frame.valid = false;
+
     nccreate(6, 60, "Confirm delete");
 
     ncprint(1, 2, "Are you sure you want to delete this content?");
@@ -100,22 +214,67 @@ void delete_draw_confirm(const int seloption)
 }
 // End: some code taken from https://github.com/rofl0r/ncdu in src/delete.c and src/util.c
 
+static void draw_row(const int y, const Row& row, const CSearch& search, const std::vector<size_t>& positions,
+                     const int maxx)
+{
+    mvhline(y, 1, ' ', maxx - 2);
+    // scrolling doesn't keep the box borders of the new rows
+    mvaddch(y, 0, ACS_VLINE);
+    mvaddch(y, maxx - 1, ACS_VLINE);
+    if (row.blank)
+        return;
+
+    const std::string_view text = search.GetText(row.index);
+    if (row.selected)
+        attron(A_REVERSE);
+    mvprintw(y, 6, "#%u: ", row.id);
+
+    // long ids push the line past the border, and it'd wrap into the next row
+    LineSpan span = get_layout(row.id, text, maxx - 11)[row.line];
+    span.length   = std::min<uint32_t>(span.length, std::max(maxx - 1 - getcurx(stdscr), 0));
+    print_highlighted(text, span, positions);
+    if (row.selected)
+        attroff(A_REVERSE);
+}
+
 // omfg too many args
-void draw_search_box(const std::string& query, const std::vector<std::string>& results,
-                     const std::vector<std::string>& results_id, const size_t selected, size_t& scroll_offset,
-                     const size_t cursor_x, const bool is_search_tab)
+void draw_search_box(const std::string& query, const std::vector<uint32_t>& entries_id, const CSearch& search,
+                     const size_t selected, size_t& scroll_offset, const size_t cursor_x, const bool is_search_tab)
 {
-    erase();
-    box(stdscr, 0, 0);
+    const std::vector<size_t>& results = search.GetResults();
+    std::vector<size_t>        positions;
 
     int maxy, maxx;
     getmaxyx(stdscr, maxy, maxx);
 
+    if (!frame.valid || frame.maxy != maxy || frame.maxx != maxx)
+    {
+        erase();
+        box(stdscr, 0, 0);
+        frame.valid = true;
+        frame.maxy  = maxy;
+        frame.maxx  = maxx;
+        frame.query.clear();
+        frame.results = SIZE_MAX;
+        // no row matches these, so they're all drawn
+        frame.rows.assign(std::max(maxy - 1 - LIST_TOP, 0), { UINT32_MAX, 0, false });
+    }
+
     // header
-    attron(A_BOLD);
-    mvprintw(1, 2, "Search: %s", query.c_str());
-    attroff(A_BOLD);
-    mvprintw(2, 2, results.size() == 1 ? "(1 result)" : "(%zu results)", results.size());
+    if (query != frame.query || frame.results == SIZE_MAX)
+    {
+        mvhline(1, 1, ' ', maxx - 2);
+        attron(A_BOLD);
+        mvprintw(1, 2, "Search: %s", query.c_str());
+        attroff(A_BOLD);
+    }
+    if (results.size() != frame.results || search.IsSearching() != frame.searching)
+    {
+        mvhline(2, 1, ' ', maxx - 2);
+        mvprintw(2, 2, results.size() == 1 ? "(1 result)" : "(%zu results)", results.size());
+        if (search.IsSearching())
+            addstr(" searching...");
+    }
 
     // First ensure selected item is visible
     size_t lines_above = 0;
@@ -129,7 +288,7 @@ void draw_search_box(const std::string& query, const std::vector<std::string>& r
         size_t needed_lines = 3;  // header + spacing (1)
         for (size_t i = scroll_offset; i <= selected && i < results.size(); i++)
         {
-            const auto& wrapped = wrap_text(results[i], maxx - 11);
+            const auto& wrapped = get_layout(entries_id[results[i]], search.GetText(results[i]), maxx - 11);
             needed_lines += wrapped.size() + 1;
             if (needed_lines > static_cast<size_t>(maxy - 1))
             {
@@ -143,29 +302,76 @@ void draw_search_box(const std::string& query, const std::vector<std::string>& r
         }
     }
 
-    // Draw visible items
-    size_t row = 2;
+    // Lay out the visible items
+    std::vector<Row> rows(frame.rows.size());
+    size_t           row = 2;
     for (size_t i = scroll_offset; i < results.size(); i++)
     {
-        const bool is_selected = (i == selected);
-        const auto& wrapped    = wrap_text(results[i], maxx - 11);
+        const bool             is_selected = (i == selected);
+        const std::string_view text        = search.GetText(results[i]);
+        const auto&            wrapped     = get_layout(entries_id[results[i]], text, maxx - 11);
 
         // Check space for this item
         if (row + 1 + wrapped.size() >= static_cast<size_t>(maxy - 1))
             break;
 
-        // Draw item
         ++row;
-        for (const std::string& line : wrapped)
+        for (size_t line = 0; line < wrapped.size(); ++line)
+            rows[++row - LIST_TOP] = { entries_id[results[i]], static_cast<uint32_t>(line), false,
+                                       is_selected && !is_search_tab, results[i], text.size() };
+    }
+
+    // the highlighted bytes change with the query, so every row needs drawing again
+    if (query != frame.query)
+        frame.rows.assign(frame.rows.size(), { UINT32_MAX, 0, false });
+
+    // if the list just got scrolled, scroll what's already on the screen
+    // instead of drawing it again, ncurses turns it into a scroll region
+    const auto& first = std::find_if(rows.begin(), rows.end(), [](const Row& r) { return !r.blank; });
+    if (first != rows.end())
+    {
+        const auto& old = std::find_if(frame.rows.begin(), frame.rows.end(), [&](const Row& r) {
+            return !r.blank && r.id == first->id && r.line == first->line;
+        });
+        const long shift = (old - frame.rows.begin()) - (first - rows.begin());
+        if (old != frame.rows.end() && shift != 0)
         {
-            if (is_selected && !is_search_tab)
-                attron(A_REVERSE);
-            mvprintw(++row, 6, "#%s: %s", results_id[i].c_str(), line.c_str());
-            if (is_selected && !is_search_tab)
-                attroff(A_REVERSE);
+            const long height = frame.rows.size();
+            setscrreg(LIST_TOP, LIST_TOP + height - 1);
+            scrollok(stdscr, TRUE);
+            scrl(shift);
+            scrollok(stdscr, FALSE);
+            setscrreg(0, maxy - 1);
+
+            // the rows scrolled in are empty, even of the borders
+            std::vector<Row> scrolled(height, { UINT32_MAX, 0, false });
+            for (long i = 0; i < height; ++i)
+                if (i + shift >= 0 && i + shift < height)
+                    scrolled[i] = frame.rows[i + shift];
+            frame.rows = std::move(scrolled);
+        }
+    }
+
+    // Draw the rows that changed
+    size_t positions_index = SIZE_MAX;
+    for (size_t i = 0; i < rows.size(); ++i)
+    {
+        if (rows[i] == frame.rows[i])
+            continue;
+
+        if (!rows[i].blank && rows[i].index != positions_index)
+        {
+            search.GetMatchPositions(rows[i].index, positions);
+            positions_index = rows[i].index;
         }
+        draw_row(LIST_TOP + i, rows[i], search, positions, maxx);
     }
 
+    frame.query     = query;
+    frame.results   = results.size();
+    frame.searching = search.IsSearching();
+    frame.rows      = std::move(rows);
+
     if (is_search_tab)
         move(1, cursor_x);
     else
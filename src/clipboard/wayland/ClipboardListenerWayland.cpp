@@ -3,24 +3,28 @@
 #include "clipboard/wayland/ClipboardListenerWayland.hpp"
 
 #include <dlfcn.h>
-#include <fcntl.h>
-#include <linux/limits.h>
-#include <sys/stat.h>
+#include <poll.h>
+#include <sys/epoll.h>
 #include <unistd.h>
 
+#include <cerrno>
 #include <cstdlib>
 #include <cstring>
-#include <fstream>
 #include <string>
 
 #include "util.hpp"
 
 static void *m_handle;
-const char* const tempname = "/clippyman-buffer-XXXXXX";
 
 LIB_SYMBOL(wl_display*, wl_display_connect, const char *name);
 LIB_SYMBOL(void, wl_display_disconnect, wl_display *display);
-LIB_SYMBOL(int, wl_display_roundtrip, wl_display *display);
+LIB_SYMBOL(int, wl_display_dispatch, wl_display *display);
+LIB_SYMBOL(int, wl_display_dispatch_pending, wl_display *display);
+LIB_SYMBOL(int, wl_display_prepare_read, wl_display *display);
+LIB_SYMBOL(int, wl_display_read_events, wl_display *display);
+LIB_SYMBOL(void, wl_display_cancel_read, wl_display *display);
+LIB_SYMBOL(int, wl_display_flush, wl_display *display);
+LIB_SYMBOL(int, wl_display_get_fd, wl_display *display);
 
 CClipboardListenerWayland::CClipboardListenerWayland()
 {
@@ -30,39 +34,40 @@ CClipboardListenerWayland::CClipboardListenerWayland()
 
     LOAD_LIB_SYMBOL(m_handle, wl_display*, wl_display_connect, const char *name);
     LOAD_LIB_SYMBOL(m_handle, void, wl_display_disconnect, wl_display *display);
-    LOAD_LIB_SYMBOL(m_handle, int, wl_display_roundtrip, wl_display *display);
+    LOAD_LIB_SYMBOL(m_handle, int, wl_display_dispatch, wl_display *display);
+    LOAD_LIB_SYMBOL(m_handle, int, wl_display_dispatch_pending, wl_display *display);
+    LOAD_LIB_SYMBOL(m_handle, int, wl_display_prepare_read, wl_display *display);
+    LOAD_LIB_SYMBOL(m_handle, int, wl_display_read_events, wl_display *display);
+    LOAD_LIB_SYMBOL(m_handle, void, wl_display_cancel_read, wl_display *display);
+    LOAD_LIB_SYMBOL(m_handle, int, wl_display_flush, wl_display *display);
+    LOAD_LIB_SYMBOL(m_handle, int, wl_display_get_fd, wl_display *display);
 
     m_display = cf_wl_display_connect(NULL);
     if (!m_display)
         die("Failed to connect to wayland display!");
 
-    const char* env = getenv("TMPDIR");
-    if (env != NULL)
-    {
-        if (strlen(env) > PATH_MAX - strlen(tempname))
-            die("TMPDIR has too long of a path");
-
-        m_path = env;
-    }
+    m_EpollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_EpollFd == -1)
+        die("Failed to create epoll fd: {}", strerror(errno));
 
-    m_path += tempname;
-    m_fd = mkstemp(m_path.data());
-    if (m_fd == -1)
-        die("Failed to create temporary file for copy buffer");
+    epoll_event event{};
+    event.events  = EPOLLIN;
+    event.data.fd = cf_wl_display_get_fd(m_display);
+    if (epoll_ctl(m_EpollFd, EPOLL_CTL_ADD, event.data.fd, &event) == -1)
+        die("Failed to watch the wayland display: {}", strerror(errno));
 
     if (!config.arg_search)
     {
         close(STDIN_FILENO);
         main_waycopy(m_display, wl_options, STDIN_FILENO);
-        main_waypaste(m_display, m_fd);
+        main_waypaste(m_display, config.max_copy_size, OnPasteStarted, OnSelection, this);
     }
 }
 
 CClipboardListenerWayland::~CClipboardListenerWayland()
 {
+    close(m_EpollFd);
     cf_wl_display_disconnect(m_display);
-    if (unlink(m_path.c_str()) == -1)
-        warn("Failed to remove temporary file '{}", m_path);
 }
 
 void CClipboardListenerWayland::AddCopyCallback(const std::function<void(const CopyEvent&)>& func)
@@ -72,56 +77,72 @@ void CClipboardListenerWayland::AddCopyCallback(const std::function<void(const C
 
 void CClipboardListenerWayland::PollClipboard()
 {
-    cf_wl_display_roundtrip(m_display);
-
-    // for checking duplicated every 50ms
-    // instead of:
-    // * opening the file
-    // * get each line of the file
-    // * compare it with the m_LastClipboardContent
-    // * do the rest
-    // We could instead:
-    // * check the file attributes
-    // * check if the last time we checked the file is either newer or older than the current
-    // * do the rest
-    // Optimization moment
-    /* -----------------------------------------------------
-     * Benchmark           Time             CPU   Iterations
-     * -----------------------------------------------------
-     *  stat              844 ns          842 ns       827300
-     *  fstream          2199 ns         2193 ns       318829
-     */
-    struct stat attrib;
-    if (stat(m_path.c_str(), &attrib) != 0)
-        return;
-    if (attrib.st_mtim.tv_sec <= m_lastModifiedFileTime)
-        return;
-    m_lastModifiedFileTime = attrib.st_mtim.tv_sec;
-    debug("the file is newer");
+    cf_wl_display_flush(m_display);
+
+    pollfd pfd{ m_EpollFd, POLLIN, 0 };
+    if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+        die("Failed to poll the wayland display: {}", strerror(errno));
 
-    std::ifstream f(m_path);
-    if (!f.is_open())
-        die("temp file was deleted");
+    ProcessEvents();
+}
 
-    CopyEvent   copyEvent;
-    std::string line;
-    while (std::getline(f, line))
+int CClipboardListenerWayland::GetFd() const
+{ return m_EpollFd; }
+
+void CClipboardListenerWayland::ProcessEvents()
+{
+    // the usual prepare_read/read_events dance, but never blocking
+    while (cf_wl_display_prepare_read(m_display) != 0)
+        cf_wl_display_dispatch_pending(m_display);
+    cf_wl_display_flush(m_display);
+
+    pollfd pfd{ cf_wl_display_get_fd(m_display), POLLIN, 0 };
+    if (poll(&pfd, 1, 0) > 0)
     {
-        copyEvent.content += line;
-        copyEvent.content += "\n";
+        if (cf_wl_display_read_events(m_display) == -1)
+            die("Lost connection to the wayland display: {}", strerror(errno));
+    }
+    else
+    {
+        cf_wl_display_cancel_read(m_display);
     }
 
-    if (!copyEvent.content.empty() && copyEvent.content.back() == '\n')
-        copyEvent.content.pop_back();
+    if (cf_wl_display_dispatch_pending(m_display) == -1)
+        die("Lost connection to the wayland display: {}", strerror(errno));
+    cf_wl_display_flush(m_display);
+
+    wc_paste_read();
+}
+
+void CClipboardListenerWayland::OnPasteStarted(int fd, void* userdata)
+{
+    CClipboardListenerWayland* self = static_cast<CClipboardListenerWayland*>(userdata);
+
+    epoll_event event{};
+    event.events  = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(self->m_EpollFd, EPOLL_CTL_ADD, fd, &event) == -1)
+        die("Failed to watch the selection pipe: {}", strerror(errno));
+}
+
+void CClipboardListenerWayland::OnSelection(const char* data, size_t len, void* userdata)
+{
+    CClipboardListenerWayland* self = static_cast<CClipboardListenerWayland*>(userdata);
+
+    // we used to read it line by line, which dropped the trailing newline
+    if (len > 0 && data[len - 1] == '\n')
+        --len;
+
+    CopyEvent copyEvent{ std::string(data, len) };
 
     /* Simple but fine approach */
-    if (copyEvent.content == m_LastClipboardContent)
-        goto end;
+    if (copyEvent.content == self->m_LastClipboardContent)
+        return;
 
     if (copyEvent.content.find_first_not_of(' ') == std::string::npos)
-        goto end;
+        return;
 
-    if (copyEvent.content[0] == '\0')
+    if (copyEvent.content.find('\0') != std::string::npos)
     {
         std::string tmp{ copyEvent.content };
         copyEvent.content.clear();
@@ -131,16 +152,13 @@ void CClipboardListenerWayland::PollClipboard()
                 copyEvent.content += c;
         }
 
-        if (copyEvent.content == m_LastClipboardContent)
-            goto end;
+        if (copyEvent.content == self->m_LastClipboardContent)
+            return;
     }
 
-    m_LastClipboardContent = copyEvent.content;
-    for (const auto& callback : m_CopyEventCallbacks)
+    self->m_LastClipboardContent = copyEvent.content;
+    for (const auto& callback : self->m_CopyEventCallbacks)
         callback(copyEvent);
-
-end:
-    truncate(m_path.c_str(), 0);
 }
 
 /*void CClipboardListenerWayland::CopyToClipboard(const std::string& str) const
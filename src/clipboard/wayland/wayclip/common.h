@@ -6,6 +6,7 @@ extern "C" {
 #endif
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <wayland-client.h>
 
 #pragma GCC diagnostic ignored "-Wunused-parameter"
@@ -25,8 +26,26 @@ void wc_die(const char *const error);
 void wc_warn(const char *const error);
 void copyfd(int in, int out);
 
+/* Called with the whole content of each new selection.
+ * data is only valid until the callback returns
+ */
+typedef void (*wc_receive_callback)(const char *data, size_t len, void *userdata);
+
+/* Called when a new selection starts being received through fd,
+ * call wc_paste_read() whenever it's readable until it's closed
+ */
+typedef void (*wc_watch_callback)(int fd, void *userdata);
+
 int main_waycopy(struct wl_display *display, struct wc_options options, const int fd);
-void main_waypaste(struct wl_display *display, const int fd);
+
+/* Selections bigger than max_size are dropped, without reading them past it */
+void main_waypaste(struct wl_display *display, size_t max_size, wc_watch_callback watch, wc_receive_callback callback,
+		   void *userdata);
+
+/* Read what's there of the selection being received without blocking,
+ * the receive callback gets it once it's whole
+ */
+void wc_paste_read(void);
 
 #ifdef __cplusplus
 }
@@ -1,6 +1,10 @@
 #define _POSIX_C_SOURCE 200809L
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <wayland-client.h>
 #include <unistd.h>
@@ -10,25 +14,95 @@
 
 struct wl_display *g_display;
 struct zwlr_data_control_offer_v1 *acceptedoffer = NULL;
-int g_fd;
-int pipes[2];
+wc_receive_callback g_callback;
+wc_watch_callback g_watch;
+void *g_userdata;
+size_t g_max_size;
+
+/* read end of the pipe of the selection being received, -1 if none */
+static int pastefd = -1;
+
+/* kept between offers, so it only grows up to the biggest selection we've seen */
+static char *buffer = NULL;
+static size_t buffer_cap = 0;
+static size_t buffer_len = 0;
+
+static void
+stop_reading(void)
+{
+	close(pastefd);
+	pastefd = -1;
+	buffer_len = 0;
+}
+
+void
+wc_paste_read(void)
+{
+	if (pastefd == -1)
+		return;
+
+	do {
+		if (buffer_len == buffer_cap) {
+			/* one more byte than the max, to know when it's past it */
+			buffer_cap = buffer_cap ? buffer_cap * 2 : BUFSIZ;
+			if (buffer_cap > g_max_size + 1)
+				buffer_cap = g_max_size + 1;
+			buffer = realloc(buffer, buffer_cap);
+			if (buffer == NULL)
+				wc_die("failed to allocate the selection buffer");
+		}
+
+		ssize_t rcount = read(pastefd, buffer + buffer_len, buffer_cap - buffer_len);
+		if (rcount == -1) {
+			if (errno == EINTR)
+				continue;
+			/* the rest isn't there yet */
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			wc_warn("failed to read the selection");
+			stop_reading();
+			return;
+		}
+		if (!rcount)
+			break;
+
+		buffer_len += rcount;
+		if (buffer_len > g_max_size) {
+			wc_warn("Ignoring a copy bigger than max-copy-size");
+			stop_reading();
+			return;
+		}
+	} while (1);
+
+	const size_t len = buffer_len;
+	stop_reading();
+	g_callback(buffer, len, g_userdata);
+}
 
 static void
 receive(int cond, struct zwlr_data_control_offer_v1 *offer)
 {
 	if (cond && acceptedoffer == offer) {
-		zwlr_data_control_offer_v1_receive(offer, options.type, pipes[1]);
-		wl_display_roundtrip(g_display);
-		close(pipes[1]);
-                ftruncate(g_fd, 0);
-
-		copyfd(pipes[0], g_fd);
-		close(pipes[0]);
+		/* a new selection replaces the one still being received */
+		if (pastefd != -1)
+			stop_reading();
 
+		int pipes[2];
 		if (pipe(pipes) == -1)
 			wc_die("failed to create pipe");
 
-		// exit(0);
+		/* only our end, whoever owns the selection may write it blocking */
+		if (fcntl(pipes[0], F_SETFL, O_NONBLOCK) == -1 || fcntl(pipes[0], F_SETFD, FD_CLOEXEC) == -1 ||
+		    fcntl(pipes[1], F_SETFD, FD_CLOEXEC) == -1)
+			wc_die("failed to set up the pipe");
+
+		/* the request keeps its own copy of the fd */
+		zwlr_data_control_offer_v1_receive(offer, options.type, pipes[1]);
+		wl_display_flush(g_display);
+		close(pipes[1]);
+
+		pastefd = pipes[0];
+		g_watch(pastefd, g_userdata);
 	}
 
 	if (acceptedoffer)
@@ -78,10 +152,14 @@ static const struct zwlr_data_control_device_v1_listener device_listener = {
 };
 
 void
-main_waypaste(struct wl_display *display, const int fd)
+main_waypaste(struct wl_display *display, size_t max_size, wc_watch_callback watch, wc_receive_callback callback,
+	      void *userdata)
 {
         g_display = display;
-        g_fd = fd;
+        g_max_size = max_size;
+        g_watch = watch;
+        g_callback = callback;
+        g_userdata = userdata;
 
         struct wl_registry *const registry = wl_display_get_registry(display);
 	if (registry == NULL)
@@ -102,9 +180,6 @@ main_waypaste(struct wl_display *display, const int fd)
                         "Please either use 'clippyman' or 'clippyman-x11' if you have Xwayland working.\n"
                         "If not, just install 'wl-clipboard' and pipe the clipboard like \"wl-paste | clippyman -i\"");
 
-	if (pipe(pipes) == -1)
-		wc_die("failed to create pipe");
-
 	struct zwlr_data_control_device_v1 *device = zwlr_data_control_manager_v1_get_data_device(data_control_manager, seat);
 	if (device == NULL)
 		wc_die("data device is null");
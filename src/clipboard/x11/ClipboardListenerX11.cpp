@@ -5,6 +5,7 @@
 #include <dlfcn.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cstdint>
 #include <cstring>
 #include <ctime>
@@ -45,10 +46,33 @@ LIB_SYMBOL(xcb_get_property_reply_t*, xcb_get_property_reply,
            xcb_generic_error_t **e);
 LIB_SYMBOL(void*, xcb_get_property_value,
            const xcb_get_property_reply_t *reply);
+LIB_SYMBOL(int, xcb_get_property_value_length,
+           const xcb_get_property_reply_t *reply);
+LIB_SYMBOL(const xcb_query_extension_reply_t*, xcb_get_extension_data,
+           xcb_connection_t *c, xcb_extension_t *ext);
 LIB_SYMBOL(xcb_generic_event_t*, xcb_wait_for_event, xcb_connection_t *c);
+LIB_SYMBOL(xcb_generic_event_t*, xcb_poll_for_event, xcb_connection_t *c);
+LIB_SYMBOL(int, xcb_get_file_descriptor, xcb_connection_t *c);
 LIB_SYMBOL(xcb_void_cookie_t, xcb_send_event, xcb_connection_t *c, uint8_t propagate, xcb_window_t destination, uint32_t event_mask, const char *event);
 LIB_SYMBOL(xcb_void_cookie_t, xcb_set_selection_owner, xcb_connection_t *c, xcb_window_t owner, xcb_atom_t selection, xcb_timestamp_t time);
 LIB_SYMBOL(xcb_void_cookie_t, xcb_change_property, xcb_connection_t *c, uint8_t mode, xcb_window_t window, xcb_atom_t property, xcb_atom_t type, uint8_t format, uint32_t data_len, const void *data)
+LIB_SYMBOL(xcb_void_cookie_t, xcb_delete_property, xcb_connection_t *c, xcb_window_t window, xcb_atom_t property);
+LIB_SYMBOL(xcb_void_cookie_t, xcb_change_window_attributes, xcb_connection_t *c, xcb_window_t window, uint32_t value_mask, const void *value_list);
+
+// libxcb-xfixes
+LIB_SYMBOL(xcb_xfixes_query_version_cookie_t, xcb_xfixes_query_version,
+           xcb_connection_t *c, uint32_t client_major_version, uint32_t client_minor_version);
+LIB_SYMBOL(xcb_xfixes_query_version_reply_t*, xcb_xfixes_query_version_reply,
+           xcb_connection_t *c, xcb_xfixes_query_version_cookie_t cookie, xcb_generic_error_t **e);
+LIB_SYMBOL(xcb_void_cookie_t, xcb_xfixes_select_selection_input,
+           xcb_connection_t *c, xcb_window_t window, xcb_atom_t selection, uint32_t event_mask);
+
+// how much of a property to read per request, in 32-bit units
+constexpr uint32_t PROPERTY_CHUNK_LEN = 1 << 18;
+
+// how much of the selection we own to send per request, bigger ones are sent with INCR.
+// Well below the smallest maximum request size of X11 (256KiB)
+constexpr size_t INCR_CHUNK_SIZE = 1 << 17;
 
 xcb_atom_t CClipboardListenerX11::getAtom(xcb_connection_t* connection, const std::string& name)
 {
@@ -94,11 +118,21 @@ CClipboardListenerX11::CClipboardListenerX11()
                     xcb_connection_t*, xcb_get_property_cookie_t, xcb_generic_error_t**);
     LOAD_LIB_SYMBOL(m_handle, void*, xcb_get_property_value,
                     const xcb_get_property_reply_t*);
+    LOAD_LIB_SYMBOL(m_handle, int, xcb_get_property_value_length,
+                    const xcb_get_property_reply_t*);
+    LOAD_LIB_SYMBOL(m_handle, const xcb_query_extension_reply_t*, xcb_get_extension_data,
+                    xcb_connection_t*, xcb_extension_t*);
     LOAD_LIB_SYMBOL(m_handle, xcb_generic_event_t*, xcb_wait_for_event,
                     xcb_connection_t*);
+    LOAD_LIB_SYMBOL(m_handle, xcb_generic_event_t*, xcb_poll_for_event,
+                    xcb_connection_t*);
+    LOAD_LIB_SYMBOL(m_handle, int, xcb_get_file_descriptor,
+                    xcb_connection_t*);
     LOAD_LIB_SYMBOL(m_handle, xcb_void_cookie_t, xcb_send_event, xcb_connection_t *c, uint8_t propagate, xcb_window_t destination, uint32_t event_mask, const char *event);
     LOAD_LIB_SYMBOL(m_handle, xcb_void_cookie_t, xcb_change_property, xcb_connection_t *c, uint8_t mode, xcb_window_t window, xcb_atom_t property, xcb_atom_t type, uint8_t format, uint32_t data_len, const void *data);
     LOAD_LIB_SYMBOL(m_handle, xcb_void_cookie_t, xcb_set_selection_owner, xcb_connection_t *c, xcb_window_t owner, xcb_atom_t selection, xcb_timestamp_t time);
+    LOAD_LIB_SYMBOL(m_handle, xcb_void_cookie_t, xcb_delete_property, xcb_connection_t *c, xcb_window_t window, xcb_atom_t property);
+    LOAD_LIB_SYMBOL(m_handle, xcb_void_cookie_t, xcb_change_window_attributes, xcb_connection_t *c, xcb_window_t window, uint32_t value_mask, const void *value_list);
 
     m_XCBConnection = cf_xcb_connect(nullptr, nullptr);
     if (cf_xcb_connection_has_error(m_XCBConnection) != 0)
@@ -111,14 +145,64 @@ CClipboardListenerX11::CClipboardListenerX11()
     if (!screen)
         die("Failed to get X11 root window!");
 
+    // PropertyNotify tells us when the next INCR chunk is there
+    const uint32_t event_mask = XCB_EVENT_MASK_PROPERTY_CHANGE;
+
     m_Window = cf_xcb_generate_id(m_XCBConnection);
     cf_xcb_create_window(m_XCBConnection, XCB_COPY_FROM_PARENT, m_Window, screen->root, 0, 0, 1, 1, 0,
-                      XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual, 0, NULL);
+                      XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual, XCB_CW_EVENT_MASK, &event_mask);
     cf_xcb_flush(m_XCBConnection);
 
     m_Clipboard         = getAtom(m_XCBConnection, config.primary_clip ? "PRIMARY" : "CLIPBOARD");
     m_UTF8String        = getAtom(m_XCBConnection, "UTF8_STRING");
     m_ClipboardProperty = getAtom(m_XCBConnection, "XCB_CLIPBOARD");
+    m_Incr              = getAtom(m_XCBConnection, "INCR");
+    m_CopySelection     = getAtom(m_XCBConnection, "CLIPBOARD");
+    m_Targets           = getAtom(m_XCBConnection, "TARGETS");
+    m_Multiple          = getAtom(m_XCBConnection, "MULTIPLE");
+    m_AtomPair          = getAtom(m_XCBConnection, "ATOM_PAIR");
+
+    // XFixes tells us when the selection owner changes, so we don't have to keep asking for it
+    static void* m_xfixes_handle = LOAD_LIBRARY("libxcb-xfixes.so");
+    xcb_extension_t* xfixes_id = m_xfixes_handle ? static_cast<xcb_extension_t*>(dlsym(m_xfixes_handle, "xcb_xfixes_id")) : nullptr;
+    if (!xfixes_id)
+    {
+        warn("Failed to load libxcb-xfixes.so, falling back to checking the clipboard every 50ms");
+        return;
+    }
+
+    LOAD_LIB_SYMBOL(m_xfixes_handle, xcb_xfixes_query_version_cookie_t, xcb_xfixes_query_version,
+                    xcb_connection_t*, uint32_t, uint32_t);
+    LOAD_LIB_SYMBOL(m_xfixes_handle, xcb_xfixes_query_version_reply_t*, xcb_xfixes_query_version_reply,
+                    xcb_connection_t*, xcb_xfixes_query_version_cookie_t, xcb_generic_error_t**);
+    LOAD_LIB_SYMBOL(m_xfixes_handle, xcb_void_cookie_t, xcb_xfixes_select_selection_input,
+                    xcb_connection_t*, xcb_window_t, xcb_atom_t, uint32_t);
+
+    const xcb_query_extension_reply_t* ext = cf_xcb_get_extension_data(m_XCBConnection, xfixes_id);
+    if (!ext || !ext->present)
+    {
+        warn("The X11 server doesn't support XFixes, falling back to checking the clipboard every 50ms");
+        return;
+    }
+
+    // the version must be negotiated before using any other XFixes request
+    xcb_xfixes_query_version_reply_t* version = cf_xcb_xfixes_query_version_reply(
+        m_XCBConnection, cf_xcb_xfixes_query_version(m_XCBConnection, 1, 0), nullptr);
+    if (!version)
+    {
+        warn("Failed to query the XFixes version, falling back to checking the clipboard every 50ms");
+        return;
+    }
+    free(version);
+
+    cf_xcb_xfixes_select_selection_input(m_XCBConnection, m_Window, m_Clipboard,
+                                         XCB_XFIXES_SELECTION_EVENT_MASK_SET_SELECTION_OWNER |
+                                         XCB_XFIXES_SELECTION_EVENT_MASK_SELECTION_WINDOW_DESTROY |
+                                         XCB_XFIXES_SELECTION_EVENT_MASK_SELECTION_CLIENT_CLOSE);
+    cf_xcb_flush(m_XCBConnection);
+
+    m_HasXFixes       = true;
+    m_XFixesEventBase = ext->first_event;
 }
 
 CClipboardListenerX11::~CClipboardListenerX11()
@@ -135,17 +219,21 @@ void CClipboardListenerX11::AddCopyCallback(const std::function<void(const CopyE
     m_CopyEventCallbacks.push_back(func);
 }
 
-void CClipboardListenerX11::PollClipboard()
+void CClipboardListenerX11::RequestSelection()
 {
-    /* Request the clipboard contents */
     cf_xcb_convert_selection(m_XCBConnection, m_Window, m_Clipboard, m_UTF8String, m_ClipboardProperty, XCB_CURRENT_TIME);
     cf_xcb_flush(m_XCBConnection);
+}
 
-    xcb_generic_event_t* event;
-    if ((event = cf_xcb_wait_for_event(m_XCBConnection)))
+xcb_atom_t CClipboardListenerX11::ReadProperty(size_t& size)
+{
+    xcb_atom_t type = XCB_NONE;
+    size            = 0;
+    for (uint32_t offset = 0;;)
     {
-        xcb_get_property_cookie_t propertyCookie = cf_xcb_get_property(m_XCBConnection, 0, m_Window, m_ClipboardProperty,
-                                                                    XCB_GET_PROPERTY_TYPE_ANY, 0, UINT16_MAX);
+        // with delete set, the property only gets deleted by the request reading the end of it
+        xcb_get_property_cookie_t propertyCookie = cf_xcb_get_property(
+            m_XCBConnection, 1, m_Window, m_ClipboardProperty, XCB_GET_PROPERTY_TYPE_ANY, offset, PROPERTY_CHUNK_LEN);
 
         xcb_generic_error_t*      error         = nullptr;
         xcb_get_property_reply_t* propertyReply = cf_xcb_get_property_reply(m_XCBConnection, propertyCookie, &error);
@@ -153,134 +241,362 @@ void CClipboardListenerX11::PollClipboard()
         if (error)
             die("Unknown libxcb error: {}", error->error_code);
 
-        CopyEvent copyEvent{ reinterpret_cast<char*>(cf_xcb_get_property_value(propertyReply)) };
+        const size_t len   = cf_xcb_get_property_value_length(propertyReply) * (propertyReply->format / 8);
+        const size_t after = propertyReply->bytes_after;
+        type               = propertyReply->type;
+        if (offset == 0)
+            size = len + after;
 
-        /* Simple but fine approach */
-        if (copyEvent.content == m_LastClipboardContent)
-            goto end;
-
-        if (copyEvent.content.find_first_not_of(' ') == std::string::npos)
-            goto end;
-
-        if (copyEvent.content[0] == '\0')
+        if (m_Overflow || m_Buffer.size() + size - offset * 4 > config.max_copy_size)
         {
-            std::string tmp{ copyEvent.content };
-            copyEvent.content.clear();
-            for (char c : tmp)
-            {
-                if (c != '\0')
-                    copyEvent.content += c;
-            }
-
-            if (copyEvent.content == m_LastClipboardContent)
-                goto end;
+            m_Overflow = true;
+            if (after > 0)
+                cf_xcb_delete_property(m_XCBConnection, m_Window, m_ClipboardProperty);
+            free(propertyReply);
+            break;
         }
 
-        m_LastClipboardContent = copyEvent.content;
-        for (const auto& callback : m_CopyEventCallbacks)
-            callback(copyEvent);
-
-    end:
+        // the whole thing fits, so allocate it only once
+        if (offset == 0)
+            m_Buffer.reserve(m_Buffer.size() + size);
+        m_Buffer.append(reinterpret_cast<const char*>(cf_xcb_get_property_value(propertyReply)), len);
         free(propertyReply);
+
+        if (after == 0)
+            break;
+        offset += len / 4;
+    }
+
+    cf_xcb_flush(m_XCBConnection);
+    return type;
+}
+
+void CClipboardListenerX11::ReadSelection()
+{
+    m_Buffer.clear();
+    m_Incremental = false;
+    m_Overflow    = false;
+
+    size_t           size;
+    const xcb_atom_t type = ReadProperty(size);
+    if (type == m_Incr)
+    {
+        // reading it deleted the property, telling the owner to send the first chunk.
+        // Its value is the lower bound of the selection size
+        uint32_t lower_bound = 0;
+        if (m_Buffer.size() >= sizeof(lower_bound))
+            memcpy(&lower_bound, m_Buffer.data(), sizeof(lower_bound));
+
+        m_Buffer.clear();
+        m_Buffer.reserve(std::min<uint64_t>(lower_bound, config.max_copy_size));
+        m_Incremental = true;
+        return;
     }
 
-    free(event);
+    FinishSelection();
+}
+
+void CClipboardListenerX11::ReadSelectionChunk()
+{
+    // deleting the property after reading it asks for the next one,
+    // so the owner can't send more than we can handle
+    size_t size;
+    ReadProperty(size);
+    if (size > 0)
+        return;
+
+    m_Incremental = false;
+    FinishSelection();
 }
 
-static void runInBg(xcb_connection_t* m_XCBConnection, xcb_atom_t selection, xcb_atom_t target, xcb_atom_t property, const std::string& str)
+void CClipboardListenerX11::FinishSelection()
 {
-    // handle selection requests in event loop
-    while (true)
+    if (m_Overflow)
+    {
+        warn("Ignoring a copy bigger than {} MiB (see max-copy-size in the config)", config.max_copy_size >> 20);
+        m_Buffer.clear();
+        m_Buffer.shrink_to_fit();
+        return;
+    }
+
+    CopyEvent copyEvent{ std::move(m_Buffer) };
+    m_Buffer.clear();
+
+    /* Simple but fine approach */
+    if (copyEvent.content == m_LastClipboardContent)
+        return;
+
+    if (copyEvent.content.find_first_not_of(' ') == std::string::npos)
+        return;
+
+    if (copyEvent.content.find('\0') != std::string::npos)
+    {
+        copyEvent.content.erase(std::remove(copyEvent.content.begin(), copyEvent.content.end(), '\0'),
+                                copyEvent.content.end());
+
+        if (copyEvent.content == m_LastClipboardContent)
+            return;
+    }
+
+    m_LastClipboardContent = copyEvent.content;
+    for (const auto& callback : m_CopyEventCallbacks)
+        callback(copyEvent);
+}
+
+void CClipboardListenerX11::HandleEvent(const xcb_generic_event_t* event)
+{
+    if (HandleOwnerEvent(event))
+        return;
+
+    const uint8_t type = event->response_type & ~0x80;
+
+    if (m_HasXFixes && type == m_XFixesEventBase + XCB_XFIXES_SELECTION_NOTIFY)
+    {
+        // someone took the selection, ask them what's in it
+        const auto* notify = reinterpret_cast<const xcb_xfixes_selection_notify_event_t*>(event);
+        if (notify->selection == m_Clipboard && notify->owner != XCB_NONE)
+            RequestSelection();
+    }
+    else if (type == XCB_SELECTION_NOTIFY)
+    {
+        // the owner answered, property is none if it couldn't convert it
+        const auto* notify = reinterpret_cast<const xcb_selection_notify_event_t*>(event);
+        if (notify->requestor == m_Window && notify->property != XCB_NONE)
+            ReadSelection();
+    }
+    else if (type == XCB_PROPERTY_NOTIFY && m_Incremental)
+    {
+        // the owner set the next chunk
+        const auto* notify = reinterpret_cast<const xcb_property_notify_event_t*>(event);
+        if (notify->window == m_Window && notify->atom == m_ClipboardProperty &&
+            notify->state == XCB_PROPERTY_NEW_VALUE)
+            ReadSelectionChunk();
+    }
+}
+
+void CClipboardListenerX11::PollClipboard()
+{
+    m_FirstPoll = false;
+    RequestSelection();
+
+    // wait for the answer, and all of its chunks if it's sent with INCR
+    bool answered = false;
+    while (!answered || m_Incremental)
     {
         xcb_generic_event_t* event = cf_xcb_wait_for_event(m_XCBConnection);
         if (!event)
-        {
-            free(event);
-            continue;
-        }
+            die("Lost connection to the X11 display");
 
-        if ((event->response_type & ~0x80) == XCB_SELECTION_CLEAR)
-        {
-            // someone else took ownership of the clipboard, we should exit
-            free(event);
-            break;
-        }
-        else if ((event->response_type & ~0x80) == XCB_SELECTION_NOTIFY)
+        answered |= (event->response_type & ~0x80) == XCB_SELECTION_NOTIFY;
+        HandleEvent(event);
+        free(event);
+    }
+}
+
+int CClipboardListenerX11::GetFd() const
+{ return m_HasXFixes ? cf_xcb_get_file_descriptor(m_XCBConnection) : -1; }
+
+void CClipboardListenerX11::ProcessEvents()
+{
+    // get what's already in the clipboard when we start
+    if (m_FirstPoll)
+    {
+        m_FirstPoll = false;
+        RequestSelection();
+    }
+
+    xcb_generic_event_t* event;
+    while ((event = cf_xcb_poll_for_event(m_XCBConnection)))
+    {
+        HandleEvent(event);
+        free(event);
+    }
+
+    if (cf_xcb_connection_has_error(m_XCBConnection) != 0)
+        die("Lost connection to the X11 display");
+
+    cf_xcb_flush(m_XCBConnection);
+}
+
+void CClipboardListenerX11::SendNextChunk(IncrTransfer& transfer)
+{
+    // an empty chunk tells the requestor it's done
+    const size_t len = std::min(transfer.content->size() - transfer.offset, INCR_CHUNK_SIZE);
+    cf_xcb_change_property(m_XCBConnection, XCB_PROP_MODE_REPLACE, transfer.requestor, transfer.property,
+                           transfer.target, 8, len, transfer.content->data() + transfer.offset);
+    transfer.offset += len;
+    transfer.done = len == 0;
+}
+
+xcb_atom_t CClipboardListenerX11::ConvertSelection(const xcb_window_t requestor, const xcb_atom_t target,
+                                                   const xcb_atom_t property)
+{
+    if (target == m_Targets)
+    {
+        const xcb_atom_t targets[] = { m_Targets, m_Multiple, m_UTF8String, XCB_ATOM_STRING };
+        cf_xcb_change_property(m_XCBConnection, XCB_PROP_MODE_REPLACE, requestor, property, XCB_ATOM_ATOM, 32,
+                               sizeof(targets) / sizeof(targets[0]), targets);
+        return property;
+    }
+
+    if (target != m_UTF8String && target != XCB_ATOM_STRING)
+        return XCB_NONE;
+
+    const std::string& content = *m_OwnedContent;
+    if (content.size() <= INCR_CHUNK_SIZE)
+    {
+        cf_xcb_change_property(m_XCBConnection, XCB_PROP_MODE_REPLACE, requestor, property, target, 8,
+                               content.size(), content.data());
+        return property;
+    }
+
+    // too big for a single request, send it in chunks each time the requestor deletes the property.
+    // Its value is the lower bound of the size
+    const uint32_t event_mask = XCB_EVENT_MASK_PROPERTY_CHANGE;
+    const uint32_t size       = std::min<size_t>(content.size(), UINT32_MAX);
+    cf_xcb_change_window_attributes(m_XCBConnection, requestor, XCB_CW_EVENT_MASK, &event_mask);
+    cf_xcb_change_property(m_XCBConnection, XCB_PROP_MODE_REPLACE, requestor, property, m_Incr, 32, 1, &size);
+
+    m_Transfers.push_back({ requestor, property, target, m_OwnedContent, 0, false });
+    return property;
+}
+
+void CClipboardListenerX11::HandleSelectionRequest(const xcb_selection_request_event_t* request)
+{
+    // obsolete clients don't say where they want it
+    xcb_atom_t property = request->property != XCB_NONE ? request->property : request->target;
+
+    if (!m_OwnedContent || request->selection != m_CopySelection)
+    {
+        property = XCB_NONE;
+    }
+    else if (request->target == m_Multiple)
+    {
+        // the property has (target, property) pairs, convert each one like its own request
+        // and replace the property of the ones we can't with none
+        xcb_get_property_reply_t* pairsReply = cf_xcb_get_property_reply(
+            m_XCBConnection,
+            cf_xcb_get_property(m_XCBConnection, 0, request->requestor, property, m_AtomPair, 0, PROPERTY_CHUNK_LEN),
+            nullptr);
+
+        if (!pairsReply || pairsReply->format != 32)
         {
-            // check if we lost ownership
-            xcb_selection_notify_event_t* notify = reinterpret_cast<xcb_selection_notify_event_t*>(event);
-            if (notify->selection == selection && notify->property == XCB_NONE)
-            {
-                free(event);
-                break;
-            }
+            property = XCB_NONE;
         }
-        else if ((event->response_type & ~0x80) == XCB_SELECTION_REQUEST)
+        else
         {
-            xcb_selection_request_event_t* request = reinterpret_cast<xcb_selection_request_event_t*>(event);
-            if (request->target == target)
-            {
-                xcb_selection_notify_event_t notify_event = {};
-                // setting the property
-                cf_xcb_change_property(m_XCBConnection, XCB_PROP_MODE_REPLACE, request->requestor, property, target, 8,
-                                    str.size(), str.c_str());
-                notify_event.response_type = XCB_SELECTION_NOTIFY;
-                notify_event.requestor     = request->requestor;
-                notify_event.selection     = request->selection;
-                notify_event.target        = request->target;
-                notify_event.property      = property;
-                notify_event.time          = request->time;
-
-                cf_xcb_send_event(m_XCBConnection, false, request->requestor, XCB_EVENT_MASK_NO_EVENT,
-                               reinterpret_cast<const char*>(&notify_event));
-                cf_xcb_flush(m_XCBConnection);
-                break;
-            }
+            const int   len   = cf_xcb_get_property_value_length(pairsReply) / 4;
+            xcb_atom_t* pairs = reinterpret_cast<xcb_atom_t*>(cf_xcb_get_property_value(pairsReply));
+            for (int i = 0; i + 1 < len; i += 2)
+                if (ConvertSelection(request->requestor, pairs[i], pairs[i + 1]) == XCB_NONE)
+                    pairs[i + 1] = XCB_NONE;
+
+            cf_xcb_change_property(m_XCBConnection, XCB_PROP_MODE_REPLACE, request->requestor, property, m_AtomPair,
+                                   32, len, pairs);
         }
-        free(event);
+        free(pairsReply);
+    }
+    else
+    {
+        property = ConvertSelection(request->requestor, request->target, property);
     }
+
+    xcb_selection_notify_event_t notify_event = {};
+    notify_event.response_type                = XCB_SELECTION_NOTIFY;
+    notify_event.time                         = request->time;
+    notify_event.requestor                    = request->requestor;
+    notify_event.selection                    = request->selection;
+    notify_event.target                       = request->target;
+    notify_event.property                     = property;
+
+    cf_xcb_send_event(m_XCBConnection, false, request->requestor, XCB_EVENT_MASK_NO_EVENT,
+                      reinterpret_cast<const char*>(&notify_event));
+    cf_xcb_flush(m_XCBConnection);
 }
 
-void CClipboardListenerX11::CopyToClipboard(const std::string& str) const
+bool CClipboardListenerX11::HandleOwnerEvent(const xcb_generic_event_t* event)
 {
-    xcb_intern_atom_cookie_t cookie_selection = cf_xcb_intern_atom(m_XCBConnection, 1, 9, "CLIPBOARD");
-    xcb_intern_atom_cookie_t cookie_target    = cf_xcb_intern_atom(m_XCBConnection, 1, 11, "UTF8_STRING");
-    xcb_intern_atom_cookie_t cookie_property  = cf_xcb_intern_atom(m_XCBConnection, 1, 9, "XSEL_DATA");
+    const uint8_t type = event->response_type & ~0x80;
+
+    if (type == XCB_SELECTION_REQUEST)
+    {
+        HandleSelectionRequest(reinterpret_cast<const xcb_selection_request_event_t*>(event));
+        return true;
+    }
+
+    if (type == XCB_SELECTION_CLEAR)
+    {
+        // someone else copied something, the INCR transfers still going keep their own reference to it
+        if (reinterpret_cast<const xcb_selection_clear_event_t*>(event)->selection == m_CopySelection)
+            m_OwnedContent.reset();
+        return true;
+    }
 
-    xcb_intern_atom_reply_t* reply_selection = cf_xcb_intern_atom_reply(m_XCBConnection, cookie_selection, NULL);
-    xcb_intern_atom_reply_t* reply_target    = cf_xcb_intern_atom_reply(m_XCBConnection, cookie_target, NULL);
-    xcb_intern_atom_reply_t* reply_property  = cf_xcb_intern_atom_reply(m_XCBConnection, cookie_property, NULL);
+    if (type != XCB_PROPERTY_NOTIFY)
+        return false;
 
-    if (!reply_selection || !reply_target || !reply_property)
+    // the requestor of an INCR transfer deleted the property, it wants the next chunk
+    const auto* notify = reinterpret_cast<const xcb_property_notify_event_t*>(event);
+    if (notify->state != XCB_PROPERTY_DELETE)
+        return false;
+
+    const auto& it = std::find_if(m_Transfers.begin(), m_Transfers.end(), [&](const IncrTransfer& transfer) {
+        return transfer.requestor == notify->window && transfer.property == notify->atom;
+    });
+    if (it == m_Transfers.end())
+        return false;
+
+    if (it->done)
+    {
+        // stop getting its events, unless it's us receiving it
+        if (it->requestor != m_Window)
+        {
+            const uint32_t event_mask = XCB_EVENT_MASK_NO_EVENT;
+            cf_xcb_change_window_attributes(m_XCBConnection, it->requestor, XCB_CW_EVENT_MASK, &event_mask);
+        }
+        m_Transfers.erase(it);
+    }
+    else
     {
-        free(reply_selection);
-        free(reply_target);
-        free(reply_property);
-        die("Failed to get reply atoms");
+        SendNextChunk(*it);
     }
 
-    xcb_atom_t selection = reply_selection->atom;
-    xcb_atom_t target    = reply_target->atom;
-    xcb_atom_t property  = reply_property->atom;
+    cf_xcb_flush(m_XCBConnection);
+    return true;
+}
 
-    free(reply_selection);
-    free(reply_target);
-    free(reply_property);
+bool CClipboardListenerX11::OwnSelection(std::string content)
+{
+    m_OwnedContent = std::make_shared<const std::string>(std::move(content));
 
-    // set our window as the selection owner
-    cf_xcb_set_selection_owner(m_XCBConnection, m_Window, selection, XCB_CURRENT_TIME);
+    cf_xcb_set_selection_owner(m_XCBConnection, m_Window, m_CopySelection, XCB_CURRENT_TIME);
     cf_xcb_flush(m_XCBConnection);
+    return true;
+}
+
+void CClipboardListenerX11::CopyToClipboard(const std::string& str)
+{
+    OwnSelection(str);
     if (!config.silent)
         info("Copied to clipboard! (maybe)");
 
-    // run the task in the background, waiting for any event
+    // without the daemon, keep serving it from the background until someone else copies something
     pid_t pid = fork();
     if (pid < 0)
         die("failed to fork(): {}", strerror(errno));
-    else if (pid == 0)
-        runInBg(m_XCBConnection, selection, target, property, str);
-    else
+    else if (pid > 0)
         exit(0);
+
+    while (m_OwnedContent)
+    {
+        xcb_generic_event_t* event = cf_xcb_wait_for_event(m_XCBConnection);
+        if (!event)
+            break;
+
+        HandleOwnerEvent(event);
+        free(event);
+    }
+    exit(0);
 }
 
 #endif  // __linux__
@@ -1,5 +1,6 @@
 #include "config.hpp"
 
+#include <algorithm>
 #include <cstdlib>
 #include <filesystem>
 #include <string_view>
@@ -36,10 +37,21 @@ void Config::loadConfigFile(const std::string_view filename)
             filename, err.description(), err.source().begin.line, err.source().begin.column);
     }
 
-    this->path         = getValue<std::string>("config.path", "~/.cache/clippyman/history.json");
+    this->path         = getValue<std::string>("config.path", "~/.cache/clippyman/history");
+    this->backend      = getValue<std::string>("config.backend", "log");
     this->wl_seat      = getValue<std::string>("config.wl-seat", "");
     this->primary_clip = getValue<bool>("config.primary", false);
     this->silent       = getValue<bool>("config.silent", false);
+    this->fuzzy_search = getValue<bool>("config.fuzzy", true);
+
+    this->max_copy_size = static_cast<uint64_t>(std::max<int64_t>(getValue<int64_t>("config.max-copy-size", 64), 0)) << 20;
+
+    this->max_entries      = std::max<int64_t>(getValue<int64_t>("config.max-entries", 0), 0);
+    this->max_history_size = static_cast<uint64_t>(std::max<int64_t>(getValue<int64_t>("config.max-history-size", 0), 0)) << 20;
+    this->max_age          = std::max<int64_t>(getValue<int64_t>("config.max-age", 0), 0) * 24 * 60 * 60;
+
+    this->compress       = getValue<bool>("config.compress", false);
+    this->blob_threshold = static_cast<uint64_t>(std::max<int64_t>(getValue<int64_t>("config.blob-threshold", 1024), 0)) << 10;
 }
 
 void Config::generateConfig(const std::string_view filename)
@@ -0,0 +1,215 @@
+#include "history/HistoryBackend.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <string>
+
+#include "config.hpp"
+#include "fmt/format.h"
+#include "history/blob/HistoryBackendBlob.hpp"
+#include "history/index/HistoryBackendIndexed.hpp"
+#include "history/index/TrigramIndex.hpp"
+#include "history/json/HistoryBackendJson.hpp"
+#include "history/log/HistoryBackendLog.hpp"
+#include "rapidjson/document.h"
+#include "rapidjson/error/en.h"
+#include "rapidjson/filereadstream.h"
+#include "rapidjson/filewritestream.h"
+#include "rapidjson/prettywriter.h"
+#include "util.hpp"
+
+// the default history used to be a history.json, it's moved to the new default the first time
+constexpr std::string_view DEFAULT_HISTORY_PATH     = "~/.cache/clippyman/history";
+constexpr std::string_view OLD_DEFAULT_HISTORY_PATH = "~/.cache/clippyman/history.json";
+
+static std::unique_ptr<CHistoryBackend> open_existing_storage(const std::string& path)
+{
+    if (CHistoryBackendLog::IsLogFile(path))
+        return std::make_unique<CHistoryBackendLog>(path);
+    return std::make_unique<CHistoryBackendJson>(path);
+}
+
+static std::unique_ptr<CHistoryBackend> create_storage(const std::string& path)
+{
+    const size_t pos = path.rfind('/');
+    if (pos != path.npos)
+        std::filesystem::create_directories(path.substr(0, pos));
+
+    if (config.backend == "log")
+        return std::make_unique<CHistoryBackendLog>(path);
+    if (config.backend == "json")
+        return std::make_unique<CHistoryBackendJson>(path);
+
+    die("Unknown history backend '{}', it must be either \"log\" or \"json\"", config.backend);
+    return nullptr;
+}
+
+/*
+ * Copy the entries of the old default history into the new one, if it's the one in use and doesn't exist yet.
+ * The old file is left as it was.
+ */
+static void migrate_old_history(const std::string& path)
+{
+    const std::string& oldPath = expandVar(std::string(OLD_DEFAULT_HISTORY_PATH));
+    if (path != expandVar(std::string(DEFAULT_HISTORY_PATH)) || access(oldPath.c_str(), F_OK) != 0)
+        return;
+
+    // built aside then linked in place, so if several instances do it at once, only one of them wins
+    const std::string& tmpPath = fmt::format("{}.migrating.{}", path, getpid());
+    size_t             count   = 0;
+    {
+        std::unique_ptr<CHistoryBackend> old     = open_existing_storage(oldPath);
+        std::unique_ptr<CHistoryBackend> storage = create_storage(tmpPath);
+
+        std::vector<std::string> contents;
+        old->ForEachEntry([&](const uint32_t, const std::string_view content) { contents.emplace_back(content); });
+
+        storage->AddEntries({ contents.begin(), contents.end() });
+        storage->Flush();
+        count = contents.size();
+    }
+
+    if (link(tmpPath.c_str(), path.c_str()) == 0)
+        debug("Moved {} entries of the clipboard history from '{}' to '{}'", count, oldPath, path);
+    else if (errno != EEXIST)
+        warn("Failed to move the clipboard history from '{}' to '{}': {}", oldPath, path, strerror(errno));
+
+    unlink(tmpPath.c_str());
+    unlink(CHistoryBackendLog::GetIndexPath(tmpPath).c_str());
+}
+
+static std::unique_ptr<CHistoryBackend> open_storage(const std::string& path)
+{
+    if (access(path.c_str(), F_OK) != 0)
+        migrate_old_history(path);
+
+    if (access(path.c_str(), F_OK) == 0)
+        return open_existing_storage(path);
+    return create_storage(path);
+}
+
+std::vector<uint32_t> CHistoryBackend::AddEntries(const std::vector<std::string_view>& contents)
+{
+    std::vector<uint32_t> ids;
+    ids.reserve(contents.size());
+    for (const std::string_view content : contents)
+        ids.push_back(AddEntry(content));
+
+    return ids;
+}
+
+void CHistoryBackend::GetEntries(const std::vector<uint32_t>& ids,
+                                 const std::function<void(uint32_t, std::string_view)>& func)
+{
+    std::vector<uint32_t> sorted(ids);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    std::string content;
+    for (const uint32_t id : sorted)
+        if (GetEntry(id, content))
+            func(id, content);
+}
+
+std::vector<uint32_t> CHistoryBackend::DeleteEntries(const std::vector<uint32_t>& ids)
+{
+    std::vector<uint32_t> deleted;
+    for (const uint32_t id : ids)
+        if (DeleteEntry(id))
+            deleted.push_back(id);
+
+    return deleted;
+}
+
+void CHistoryBackend::GetEntryTable(EntryTable& table)
+{
+    table.ids.clear();
+    table.values.clear();
+    table.storage.clear();
+
+    // storage may move while it grows, so only take the views once it's full
+    std::vector<size_t> offsets;
+    ForEachEntry([&](const uint32_t id, const std::string_view content) {
+        table.ids.push_back(id);
+        offsets.push_back(table.storage.size());
+        table.storage += content;
+    });
+
+    offsets.push_back(table.storage.size());
+    table.values.reserve(table.ids.size());
+    for (size_t i = 0; i < table.ids.size(); ++i)
+        table.values.emplace_back(table.storage.data() + offsets[i], offsets[i + 1] - offsets[i]);
+}
+
+void CHistoryBackend::GetPreviewTable(EntryTable& table, const size_t maxSize)
+{
+    GetEntryTable(table);
+    for (std::string_view& value : table.values)
+        value = value.substr(0, utf8_prefix_size(value, maxSize));
+}
+
+std::unique_ptr<CHistoryBackend> OpenHistoryBackend(const std::string& path)
+{
+    // the search index only gets the start of the entries stored in their own file
+    return std::make_unique<CHistoryBackendBlob>(
+        std::make_unique<CHistoryBackendIndexed>(open_storage(path), CTrigramIndex::GetIndexPath(path)), path);
+}
+
+void ExportHistoryJson(CHistoryBackend& history, FILE* out)
+{
+    char                                                writeBuffer[UINT16_MAX] = { 0 };
+    rapidjson::FileWriteStream                          writeStream(out, writeBuffer, sizeof(writeBuffer));
+    rapidjson::PrettyWriter<rapidjson::FileWriteStream> writer(writeStream);
+
+    writer.StartObject();
+    writer.Key("entries");
+    writer.StartObject();
+    history.ForEachEntry([&](const uint32_t id, const std::string_view content) {
+        const std::string& id_str = fmt::to_string(id);
+        writer.Key(id_str.c_str(), id_str.size());
+        writer.String(content.data(), content.size());
+    });
+    writer.EndObject();
+    writer.EndObject();
+
+    writeStream.Put('\n');
+    writeStream.Flush();
+}
+
+size_t ImportHistoryJson(CHistoryBackend& history, FILE* in)
+{
+    rapidjson::Document       doc;
+    char                      buf[UINT16_MAX] = { 0 };
+    rapidjson::FileReadStream stream(in, buf, sizeof(buf));
+
+    if (doc.ParseStream(stream).HasParseError())
+        die("Failed to parse JSON history: {} at offset {}", rapidjson::GetParseError_En(doc.GetParseError()),
+            doc.GetErrorOffset());
+
+    if (!doc.IsObject() || !doc.HasMember("entries") || !doc["entries"].IsObject())
+        die("Failed to parse JSON history: missing \"entries\" object");
+
+    std::vector<std::string_view> contents;
+    for (auto it = doc["entries"].MemberBegin(); it != doc["entries"].MemberEnd(); ++it)
+    {
+        if (!it->value.IsString())
+            continue;
+
+        if (it->value.GetStringLength() > config.max_copy_size)
+        {
+            warn("Not importing an entry of {} bytes, max-copy-size is {} MiB", it->value.GetStringLength(),
+                 config.max_copy_size >> 20);
+            continue;
+        }
+        contents.emplace_back(it->value.GetString(), it->value.GetStringLength());
+    }
+
+    // all at once, so the backend saves them in a single go
+    history.AddEntries(contents);
+    history.Flush();
+    return contents.size();
+}
@@ -0,0 +1,345 @@
+#include "history/blob/HistoryBackendBlob.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <unordered_set>
+
+#include "config.hpp"
+#include "fmt/format.h"
+#include "util.hpp"
+
+// what the history has for a content stored in its own file, followed by the start of the content
+struct BlobRef
+{
+    char     magic[8];
+    uint64_t hash;  // xxh64_hash() of the content, its file is named after it
+    uint64_t size;
+};
+
+// Starts with a NUL byte, so copied text doesn't start with it by chance.
+// Contents that do are stored in their own file whatever their size, so they're never taken for a reference.
+constexpr char BLOB_MAGIC[8] = { '\0', 'C', 'L', 'P', 'Y', 'B', 'L', 'B' };
+
+// how much of the content the history keeps, for listing and searching it
+constexpr size_t BLOB_PREVIEW_SIZE = 1024;
+
+// Compact() leaves newer files alone, another instance may have just written one for an entry it's adding
+constexpr time_t BLOB_GRACE_SECONDS = 60;
+
+static bool is_blob_ref(const std::string_view stored)
+{ return stored.size() >= sizeof(BlobRef) && memcmp(stored.data(), BLOB_MAGIC, sizeof(BLOB_MAGIC)) == 0; }
+
+static std::string blob_name(const uint64_t hash)
+{ return fmt::format("{:016x}", hash); }
+
+/*
+ * Write a content into its file, written aside and renamed over so it's never seen half written,
+ * and synced before the history refers to it.
+ */
+static bool write_blob(const std::string& path, const std::string_view content)
+{
+    const std::string& tmpPath = path + fmt::format(".{}.tmp", getpid());
+    const int          fd      = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return false;
+
+    size_t written = 0;
+    while (written < content.size())
+    {
+        const ssize_t ret = write(fd, content.data() + written, content.size() - written);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            break;
+        written += ret;
+    }
+
+    const bool ret = written == content.size() && fsync(fd) == 0;
+    close(fd);
+    if (!ret || rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        unlink(tmpPath.c_str());
+        return false;
+    }
+
+    sync_parent_dir(path);
+    return true;
+}
+
+/*
+ * Check if the file at path has exactly content, for sharing it.
+ * Its name is only the hash of what it has, another content could have the same one.
+ */
+static bool has_content(const std::string& path, const std::string_view content)
+{
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    char   buf[65536];
+    size_t offset = 0;
+    bool   same   = true;
+    while (same)
+    {
+        const ssize_t ret = pread(fd, buf, sizeof(buf), offset);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+        {
+            same = ret == 0 && offset == content.size();
+            break;
+        }
+
+        const size_t size = ret;
+        same              = offset + size <= content.size() && memcmp(buf, content.data() + offset, size) == 0;
+        offset += size;
+    }
+
+    close(fd);
+    return same;
+}
+
+std::string CHistoryBackendBlob::GetBlobDir(const std::string& path)
+{
+    return path + ".blobs";
+}
+
+CHistoryBackendBlob::CHistoryBackendBlob(std::unique_ptr<CHistoryBackend> backend, const std::string& path)
+    : m_Backend(std::move(backend)), m_BlobDir(GetBlobDir(path))
+{}
+
+std::string_view CHistoryBackendBlob::StoreContent(const std::string_view content, std::string& stored)
+{
+    const bool looksLikeRef = content.size() >= sizeof(BLOB_MAGIC) && memcmp(content.data(), BLOB_MAGIC, sizeof(BLOB_MAGIC)) == 0;
+    if (!looksLikeRef && (config.blob_threshold == 0 || content.size() <= config.blob_threshold))
+        return content;
+
+    BlobRef ref;
+    memcpy(ref.magic, BLOB_MAGIC, sizeof(BLOB_MAGIC));
+    ref.hash = xxh64_hash(content.data(), content.size());
+    ref.size = content.size();
+
+    // the same content copied again shares the file
+    const std::string& path = m_BlobDir + '/' + blob_name(ref.hash);
+    struct stat        st;
+    if (stat(path.c_str(), &st) == 0)
+    {
+        // never replace the file of another content having the same hash, it may be in use
+        if (static_cast<uint64_t>(st.st_size) != ref.size || !has_content(path, content))
+        {
+            warn("'{}' has another content with the same hash as a {} bytes entry, keeping it in the history", path,
+                 content.size());
+            return content;
+        }
+
+        // so Compact() in another instance doesn't take it for unused before our entry is saved
+        utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+    }
+    else if ((mkdir(m_BlobDir.c_str(), 0755) != 0 && errno != EEXIST) || !write_blob(path, content))
+    {
+        warn("Failed to save a {} bytes entry into '{}': {}, keeping it in the history", content.size(), path,
+             strerror(errno));
+        return content;
+    }
+
+    stored.assign(reinterpret_cast<const char*>(&ref), sizeof(ref));
+    stored.append(content.substr(0, utf8_prefix_size(content, BLOB_PREVIEW_SIZE)));
+    return stored;
+}
+
+void CHistoryBackendBlob::LoadContent(const std::string_view stored, std::string& content)
+{
+    BlobRef ref;
+    memcpy(&ref, stored.data(), sizeof(ref));
+
+    const std::string& path = m_BlobDir + '/' + blob_name(ref.hash);
+    const int          fd   = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    content.resize(ref.size);
+    const bool ret = fd >= 0 && pread(fd, content.data(), ref.size, 0) == static_cast<ssize_t>(ref.size);
+    if (fd >= 0)
+        close(fd);
+
+    if (!ret)
+    {
+        warn("Failed to read the content of a {} bytes entry from '{}', only its start is left", ref.size, path);
+        content.assign(stored.substr(sizeof(ref)));
+    }
+}
+
+uint32_t CHistoryBackendBlob::AddEntry(const std::string_view content)
+{
+    std::string stored;
+    return AddEntry(content, stored);
+}
+
+uint32_t CHistoryBackendBlob::AddEntry(const std::string_view content, std::string& stored)
+{
+    stored.clear();
+    return m_Backend->AddEntry(StoreContent(content, stored));
+}
+
+std::vector<uint32_t> CHistoryBackendBlob::AddEntries(const std::vector<std::string_view>& contents)
+{
+    std::vector<std::string> stored;
+    return AddEntries(contents, stored);
+}
+
+std::vector<uint32_t> CHistoryBackendBlob::AddEntries(const std::vector<std::string_view>& contents,
+                                                      std::vector<std::string>&            stored)
+{
+    stored.assign(contents.size(), std::string());
+    std::vector<std::string_view> views;
+    views.reserve(contents.size());
+    for (size_t i = 0; i < contents.size(); ++i)
+        views.push_back(StoreContent(contents[i], stored[i]));
+
+    return m_Backend->AddEntries(views);
+}
+
+void CHistoryBackendBlob::ForEachStored(const std::function<void(uint32_t, std::string_view)>& func)
+{ m_Backend->ForEachEntry(func); }
+
+void CHistoryBackendBlob::LoadStored(const std::string_view stored, std::string& content)
+{
+    if (is_blob_ref(stored))
+        LoadContent(stored, content);
+    else
+        content.assign(stored);
+}
+
+bool CHistoryBackendBlob::HasOwnFile(const std::string_view stored)
+{ return is_blob_ref(stored); }
+
+std::string_view CHistoryBackendBlob::GetStoredPreview(const std::string_view stored)
+{ return is_blob_ref(stored) ? stored.substr(sizeof(BlobRef)) : stored; }
+
+bool CHistoryBackendBlob::GetEntry(const uint32_t id, std::string& content)
+{
+    if (!m_Backend->GetEntry(id, content))
+        return false;
+
+    if (is_blob_ref(content))
+    {
+        const std::string stored = std::move(content);
+        LoadContent(stored, content);
+    }
+    return true;
+}
+
+void CHistoryBackendBlob::GetEntries(const std::vector<uint32_t>& ids,
+                                     const std::function<void(uint32_t, std::string_view)>& func)
+{
+    std::string content;
+    m_Backend->GetEntries(ids, [&](const uint32_t id, const std::string_view stored) {
+        if (!is_blob_ref(stored))
+            return func(id, stored);
+
+        LoadContent(stored, content);
+        func(id, content);
+    });
+}
+
+void CHistoryBackendBlob::ForEachEntry(const std::function<void(uint32_t, std::string_view)>& func)
+{
+    std::string content;
+    m_Backend->ForEachEntry([&](const uint32_t id, const std::string_view stored) {
+        if (!is_blob_ref(stored))
+            return func(id, stored);
+
+        LoadContent(stored, content);
+        func(id, content);
+    });
+}
+
+void CHistoryBackendBlob::GetEntryTable(EntryTable& table)
+{
+    m_Backend->GetEntryTable(table);
+    for (std::string_view& value : table.values)
+        value = GetStoredPreview(value);
+}
+
+void CHistoryBackendBlob::GetPreviewTable(EntryTable& table, const size_t maxSize)
+{
+    // the references take some of the bytes
+    m_Backend->GetPreviewTable(table, maxSize + sizeof(BlobRef));
+    for (std::string_view& value : table.values)
+    {
+        value = GetStoredPreview(value);
+        value = value.substr(0, utf8_prefix_size(value, maxSize));
+    }
+}
+
+bool CHistoryBackendBlob::DeleteEntry(const uint32_t id)
+{ return m_Backend->DeleteEntry(id); }
+
+std::vector<uint32_t> CHistoryBackendBlob::DeleteEntries(const std::vector<uint32_t>& ids)
+{ return m_Backend->DeleteEntries(ids); }
+
+std::vector<uint32_t> CHistoryBackendBlob::GetAllIds()
+{ return m_Backend->GetAllIds(); }
+
+bool CHistoryBackendBlob::SetPinned(const uint32_t id, const bool pinned)
+{ return m_Backend->SetPinned(id, pinned); }
+
+std::vector<uint32_t> CHistoryBackendBlob::EnforceRetention()
+{ return m_Backend->EnforceRetention(); }
+
+void CHistoryBackendBlob::Sync()
+{ m_Backend->Sync(); }
+
+void CHistoryBackendBlob::Flush()
+{ m_Backend->Flush(); }
+
+void CHistoryBackendBlob::Compact()
+{
+    m_Backend->Compact();
+
+    DIR* dir = opendir(m_BlobDir.c_str());
+    if (!dir)
+        return;
+
+    std::vector<std::string> names;
+    while (const dirent* entry = readdir(dir))
+        if (entry->d_name[0] != '.')
+            names.emplace_back(entry->d_name);
+    closedir(dir);
+    if (names.empty())
+        return;
+
+    // the references are at the start of what the history has, no need to read the files
+    EntryTable table;
+    m_Backend->GetEntryTable(table);
+    std::unordered_set<std::string> used;
+    for (const std::string_view value : table.values)
+    {
+        if (!is_blob_ref(value))
+            continue;
+
+        BlobRef ref;
+        memcpy(&ref, value.data(), sizeof(ref));
+        used.insert(blob_name(ref.hash));
+    }
+
+    // leftovers of writes that never finished go too
+    const time_t now     = std::time(nullptr);
+    size_t       deleted = 0;
+    for (const std::string& name : names)
+    {
+        const std::string& path = m_BlobDir + '/' + name;
+        struct stat        st;
+        if (used.find(name) != used.end() || stat(path.c_str(), &st) != 0 || now - st.st_mtime < BLOB_GRACE_SECONDS)
+            continue;
+
+        if (unlink(path.c_str()) == 0)
+            ++deleted;
+    }
+
+    if (deleted > 0)
+        debug("deleted {} files in '{}' no entry refers to anymore", deleted, m_BlobDir);
+}
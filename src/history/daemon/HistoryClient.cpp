@@ -0,0 +1,243 @@
+#include "history/daemon/HistoryClient.hpp"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "util.hpp"
+
+// ids per MSG_ENTRIES request
+constexpr size_t ENTRIES_BATCH_SIZE = 256;
+
+// contents per MSG_ADDS request, and how big it gets before they go in the next one
+constexpr size_t ADDS_BATCH_SIZE  = 1024;
+constexpr size_t ADDS_BATCH_BYTES = 16 << 20;
+
+std::unique_ptr<CHistoryClient> CHistoryClient::Connect(const std::string& socketPath)
+{
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(addr.sun_path))
+        return nullptr;
+    strcpy(addr.sun_path, socketPath.c_str());
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return nullptr;
+
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    return std::unique_ptr<CHistoryClient>(new CHistoryClient(fd));
+}
+
+CHistoryClient::~CHistoryClient()
+{
+    if (m_Fd >= 0)
+        close(m_Fd);
+}
+
+std::string CHistoryClient::Request(const MessageType type, const std::string_view payload)
+{
+    MessageType reply_type;
+    std::string reply;
+    if (!SendMessage(m_Fd, type, payload) || !RecvMessage(m_Fd, reply_type, reply))
+        die("Lost connection to the clippyman daemon");
+    if (reply_type != type)
+        die("The clippyman daemon refused the request");
+
+    return reply;
+}
+
+uint32_t CHistoryClient::AddEntry(const std::string_view content)
+{
+    const std::string& reply = Request(MSG_ADD, content);
+    std::string_view   view  = reply;
+    uint32_t           id    = 0;
+    if (!ReadU32(view, id))
+        die("Malformed reply from the clippyman daemon");
+
+    return id;
+}
+
+bool CHistoryClient::GetEntry(const uint32_t id, std::string& content)
+{
+    std::string request;
+    AppendU32(request, id);
+
+    const std::string& reply = Request(MSG_GET, request);
+    std::string_view   view  = reply;
+    std::string_view   str;
+    if (view.empty())
+        die("Malformed reply from the clippyman daemon");
+
+    const bool found = view.front();
+    view.remove_prefix(1);
+    if (!ReadString(view, str))
+        die("Malformed reply from the clippyman daemon");
+
+    if (found)
+        content = str;
+    return found;
+}
+
+std::vector<uint32_t> CHistoryClient::AddEntries(const std::vector<std::string_view>& contents)
+{
+    std::vector<uint32_t> ids;
+    ids.reserve(contents.size());
+
+    std::string request;
+    for (size_t i = 0; i < contents.size();)
+    {
+        // at least one, even if it's bigger than a batch
+        request.clear();
+        size_t count = 0;
+        do
+        {
+            AppendString(request, contents[i++]);
+            ++count;
+        } while (i < contents.size() && count < ADDS_BATCH_SIZE &&
+                 request.size() + contents[i].size() <= ADDS_BATCH_BYTES);
+
+        const std::string& reply = Request(MSG_ADDS, request);
+        std::string_view   view  = reply;
+        uint32_t           id    = 0;
+        while (ReadU32(view, id))
+            ids.push_back(id);
+        if (!view.empty() || ids.size() != i)
+            die("Malformed reply from the clippyman daemon");
+    }
+
+    return ids;
+}
+
+bool CHistoryClient::DeleteEntry(const uint32_t id)
+{
+    std::string request;
+    AppendU32(request, id);
+
+    const std::string& reply = Request(MSG_DELETE, request);
+    if (reply.empty())
+        die("Malformed reply from the clippyman daemon");
+
+    return reply.front();
+}
+
+void CHistoryClient::GetEntries(const std::vector<uint32_t>& ids,
+                                const std::function<void(uint32_t, std::string_view)>& func)
+{
+    std::vector<uint32_t> sorted(ids);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    std::string request;
+    for (size_t i = 0; i < sorted.size(); i += ENTRIES_BATCH_SIZE)
+    {
+        request.clear();
+        for (size_t j = i; j < std::min(i + ENTRIES_BATCH_SIZE, sorted.size()); ++j)
+            AppendU32(request, sorted[j]);
+
+        const std::string& reply = Request(MSG_ENTRIES, request);
+        std::string_view   view  = reply;
+        uint32_t           id    = 0;
+        std::string_view   content;
+        while (!view.empty())
+        {
+            if (!ReadU32(view, id) || !ReadString(view, content))
+                die("Malformed reply from the clippyman daemon");
+
+            func(id, content);
+        }
+    }
+}
+
+void CHistoryClient::ForEachEntry(const std::function<void(uint32_t, std::string_view)>& func)
+{
+    // the list only has the start of the entries stored in their own file
+    GetEntries(GetAllIds(), func);
+}
+
+void CHistoryClient::GetEntryTable(EntryTable& table)
+{
+    table.storage = Request(MSG_LIST);
+    ReadTable(table);
+}
+
+void CHistoryClient::GetPreviewTable(EntryTable& table, const size_t maxSize)
+{
+    std::string request;
+    AppendU32(request, std::min<size_t>(maxSize, UINT32_MAX));
+    table.storage = Request(MSG_PREVIEWS, request);
+    ReadTable(table);
+}
+
+void CHistoryClient::ReadTable(EntryTable& table)
+{
+    table.ids.clear();
+    table.values.clear();
+
+    std::string_view view = table.storage;
+    uint32_t         id   = 0;
+    std::string_view content;
+    while (!view.empty())
+    {
+        if (!ReadU32(view, id) || !ReadString(view, content))
+            die("Malformed reply from the clippyman daemon");
+
+        table.ids.push_back(id);
+        table.values.push_back(content);
+    }
+}
+
+std::vector<uint32_t> CHistoryClient::GetAllIds()
+{
+    const std::string&    reply = Request(MSG_IDS);
+    std::string_view      view  = reply;
+    std::vector<uint32_t> ids;
+    ids.reserve(reply.size() / sizeof(uint32_t));
+
+    uint32_t id = 0;
+    while (ReadU32(view, id))
+        ids.push_back(id);
+
+    return ids;
+}
+
+bool CHistoryClient::SetPinned(const uint32_t id, const bool pinned)
+{
+    std::string request;
+    AppendU32(request, id);
+    request += static_cast<char>(pinned);
+
+    const std::string& reply = Request(MSG_PIN, request);
+    if (reply.empty())
+        die("Malformed reply from the clippyman daemon");
+
+    return reply.front();
+}
+
+void CHistoryClient::Flush()
+{ Request(MSG_FLUSH); }
+
+bool CHistoryClient::CopyToClipboard(const std::string_view content)
+{
+    const std::string& reply = Request(MSG_COPY, content);
+    if (reply.empty())
+        die("Malformed reply from the clippyman daemon");
+
+    return reply.front();
+}
+
+void CHistoryClient::GetStats(uint32_t& entries, uint32_t& queued, uint64_t& dropped)
+{
+    const std::string& reply = Request(MSG_STATS);
+    std::string_view   view  = reply;
+    if (!ReadU32(view, entries) || !ReadU32(view, queued) || !ReadU64(view, dropped))
+        die("Malformed reply from the clippyman daemon");
+}
@@ -0,0 +1,767 @@
+#include "history/daemon/HistoryServer.hpp"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+
+#include "util.hpp"
+
+// how much of a reply is made ready to send at once, list replies are made as the client reads them
+constexpr size_t OUTPUT_CHUNK_SIZE = 256 * 1024;
+
+CHistoryServer::CHistoryServer(std::unique_ptr<CHistoryBackend> backend, const std::string& socketPath,
+                               CEventLoop& loop)
+    : m_Backend(std::move(backend)), m_Loop(loop), m_SocketPath(socketPath)
+{
+    const auto& add = [&](const uint32_t id, const std::string_view stored) {
+        m_Entries.emplace(id, ShareContent(stored));
+    };
+
+    // the big contents stay in their files
+    m_Blob = dynamic_cast<CHistoryBackendBlob*>(m_Backend.get());
+    if (m_Blob)
+        m_Blob->ForEachStored(add);
+    else
+        m_Backend->ForEachEntry(add);
+
+    m_WriterWakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    m_WritesDoneFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_WriterWakeFd < 0 || m_WritesDoneFd < 0)
+        die("Failed to create eventfd: {}", strerror(errno));
+
+    m_Loop.AddFd(m_WritesDoneFd, [this] { ApplyWrites(); });
+    m_Writer = std::thread(&CHistoryServer::Writer, this);
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (m_SocketPath.size() >= sizeof(addr.sun_path))
+    {
+        warn("Daemon socket path '{}' is too long, other clippyman instances will read the history directly",
+             m_SocketPath);
+        return;
+    }
+    strcpy(addr.sun_path, m_SocketPath.c_str());
+
+    m_ListenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (m_ListenFd < 0)
+        die("Failed to create daemon socket: {}", strerror(errno));
+
+    // the caller already checked there's no other daemon alive, so it's a leftover
+    unlink(m_SocketPath.c_str());
+
+    // only the user can talk to us
+    const mode_t old_mask = umask(0077);
+    const int    ret      = bind(m_ListenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    umask(old_mask);
+    if (ret != 0 || listen(m_ListenFd, 16) != 0)
+        die("Failed to listen on daemon socket '{}': {}", m_SocketPath, strerror(errno));
+
+    m_Loop.AddFd(m_ListenFd, [this] { Accept(); });
+}
+
+CHistoryServer::~CHistoryServer()
+{
+    // it saves what's still queued before leaving
+    m_StopWriter = true;
+    WakeWriter();
+    m_Writer.join();
+
+    m_Loop.RemoveFd(m_WritesDoneFd);
+    close(m_WritesDoneFd);
+    close(m_WriterWakeFd);
+
+    for (const auto& it : m_Clients)
+    {
+        m_Loop.RemoveFd(it.first);
+        close(it.first);
+    }
+
+    if (m_ListenFd >= 0)
+    {
+        m_Loop.RemoveFd(m_ListenFd);
+        close(m_ListenFd);
+        unlink(m_SocketPath.c_str());
+    }
+
+    m_Backend->Flush();
+}
+
+void CHistoryServer::Accept()
+{
+    int fd;
+    while ((fd = accept4(m_ListenFd, nullptr, nullptr, SOCK_CLOEXEC)) >= 0)
+    {
+        Client client;
+        client.serial = m_NextClientSerial++;
+        m_Clients.emplace(fd, std::move(client));
+        m_Loop.AddFd(fd, [this, fd] { HandleClient(fd); });
+    }
+}
+
+void CHistoryServer::CloseClient(const int fd)
+{
+    const auto& it = m_Clients.find(fd);
+    if (it != m_Clients.end())
+        for (auto& listed : it->second.listing)
+            ReleaseContent(std::move(listed.second));
+
+    m_Loop.RemoveFd(fd);
+    m_Clients.erase(fd);
+    close(fd);
+}
+
+void CHistoryServer::HandleClient(const int fd)
+{
+    const auto& it = m_Clients.find(fd);
+    if (it == m_Clients.end())
+        return;
+
+    Client& client = it->second;
+    char    buf[UINT16_MAX];
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+        client.received.append(buf, n);
+
+    const bool closed = n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+
+    // if it was waiting for a reply, it's dropped
+    if (closed)
+        CloseClient(fd);
+    else
+        HandleRequests(fd, client);
+}
+
+void CHistoryServer::HandleWritable(const int fd)
+{
+    const auto& it = m_Clients.find(fd);
+    if (it != m_Clients.end() && SendReplies(fd, it->second))
+        HandleRequests(fd, it->second);
+}
+
+bool CHistoryServer::HandleRequests(const int fd, Client& client)
+{
+    std::string_view view = client.received;
+    MessageType      type;
+    std::string_view request;
+    while (!client.waiting && !client.IsSending() && ParseMessage(view, type, request))
+    {
+        if (!HandleRequest(client, type, request))
+            QueueReply(client, MSG_ERROR, {});
+
+        // most replies go out right away, it only has to wait for the big ones
+        if (!SendReplies(fd, client))
+            return false;
+    }
+    client.received.erase(0, client.received.size() - view.size());
+    return true;
+}
+
+void CHistoryServer::QueueReply(Client& client, const MessageType type, const std::string_view reply)
+{
+    AppendMessageHeader(client.output, type, reply.size());
+    client.output += reply;
+}
+
+void CHistoryServer::QueueListing(Client& client, const MessageType type, const uint32_t maxSize)
+{
+    // a snapshot, so what gets added or deleted meanwhile doesn't change it, the contents are shared
+    client.listing.assign(m_Entries.begin(), m_Entries.end());
+    client.listed      = 0;
+    client.listMaxSize = maxSize;
+
+    uint64_t size = 0;
+    for (const auto& [id, stored] : client.listing)
+        size += sizeof(uint32_t) * 2 + GetListedCut(*stored, maxSize).size();
+    AppendMessageHeader(client.output, type, size);
+}
+
+bool CHistoryServer::SendReplies(const int fd, Client& client)
+{
+    while (true)
+    {
+        // the listing is only turned into bytes as the client reads them
+        if (client.listed < client.listing.size() && client.output.size() - client.sent < OUTPUT_CHUNK_SIZE)
+        {
+            // what's sent goes away first, so the buffer stays about a chunk big
+            client.output.erase(0, client.sent);
+            client.sent = 0;
+            while (client.output.size() < OUTPUT_CHUNK_SIZE && client.listed < client.listing.size())
+            {
+                const auto& [id, stored] = client.listing[client.listed++];
+                AppendU32(client.output, id);
+                AppendString(client.output, GetListedCut(*stored, client.listMaxSize));
+            }
+        }
+
+        if (client.sent == client.output.size())
+            break;
+
+        const ssize_t n = send(fd, client.output.data() + client.sent, client.output.size() - client.sent,
+                               MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0)
+        {
+            CloseClient(fd);
+            return false;
+        }
+
+        client.sent += n;
+    }
+
+    if (!client.IsSending())
+    {
+        // don't keep the memory of a big reply around
+        if (client.output.capacity() > OUTPUT_CHUNK_SIZE * 2)
+            std::string().swap(client.output);
+        client.output.clear();
+        client.sent = 0;
+
+        // the entries deleted while they were listed
+        for (auto& it : client.listing)
+            ReleaseContent(std::move(it.second));
+        client.listing.clear();
+        client.listed = 0;
+    }
+
+    // only watch it while there's something left, it's writable most of the time
+    if (client.watchingWritable != client.IsSending())
+    {
+        client.watchingWritable = client.IsSending();
+        m_Loop.SetWriteHandler(fd, client.watchingWritable ? std::function<void()>([this, fd] { HandleWritable(fd); })
+                                                           : nullptr);
+    }
+    return true;
+}
+
+std::string_view CHistoryServer::GetListedCut(const std::string_view stored, const uint32_t maxSize) const
+{
+    const std::string_view listed = GetListed(stored);
+    return listed.substr(0, utf8_prefix_size(listed, maxSize));
+}
+
+bool CHistoryServer::HandleRequest(Client& client, const MessageType type, std::string_view request)
+{
+    uint32_t    id = 0;
+    std::string reply;
+    switch (type)
+    {
+        case MSG_ADD:
+            client.waiting = true;
+            QueueRequest({ MSG_ADD, 0, false, std::string(request), client.serial, {} });
+            return true;
+
+        case MSG_ADDS:
+        {
+            // checked here, so the writer thread doesn't have to
+            std::string_view content;
+            std::string_view contents = request;
+            while (ReadString(contents, content))
+                continue;
+            if (!contents.empty())
+                return false;
+
+            client.waiting = true;
+            QueueRequest({ MSG_ADDS, 0, false, std::string(request), client.serial, {} });
+            return true;
+        }
+
+        case MSG_GET:
+        case MSG_ENTRIES:
+        {
+            WriterRequest read{ type, 0, false, {}, client.serial, {} };
+            bool          ownFile = false;
+            while (ReadU32(request, id))
+            {
+                const auto& it = m_Entries.find(id);
+                if (it == m_Entries.end())
+                    continue;
+                read.entries.emplace_back(id, it->second);
+                ownFile |= m_Blob && CHistoryBackendBlob::HasOwnFile(*it->second);
+            }
+            if (!request.empty() || (type == MSG_GET && read.entries.size() > 1))
+                return false;
+
+            // the files may be big, so the writer thread reads them
+            if (ownFile)
+            {
+                client.waiting = true;
+                QueueRequest(std::move(read));
+                return true;
+            }
+
+            if (type == MSG_GET && read.entries.empty())
+            {
+                reply += static_cast<char>(false);
+                AppendString(reply, {});
+                break;
+            }
+
+            client.output += ReadEntries(read);
+            return true;
+        }
+
+        case MSG_DELETE:
+            if (!ReadU32(request, id))
+                return false;
+            reply += static_cast<char>(DeleteEntry(id));
+            break;
+
+        case MSG_LIST: QueueListing(client, type, UINT32_MAX); return true;
+
+        case MSG_PREVIEWS:
+        {
+            uint32_t maxSize = 0;
+            if (!ReadU32(request, maxSize))
+                return false;
+
+            QueueListing(client, type, maxSize);
+            return true;
+        }
+
+        case MSG_IDS:
+        {
+            for (const auto& it : m_Entries)
+                AppendU32(reply, it.first);
+            break;
+        }
+
+        case MSG_STATS:
+            AppendU32(reply, m_Entries.size());
+            AppendU32(reply, GetQueueDepth());
+            AppendU64(reply, GetDroppedCount());
+            break;
+
+        case MSG_FLUSH:
+            client.waiting = true;
+            QueueRequest({ MSG_FLUSH, 0, false, {}, client.serial, {} });
+            return true;
+
+        case MSG_COPY:
+            reply += static_cast<char>(m_CopyHandler && m_CopyHandler(std::string(request)));
+            break;
+
+        case MSG_PIN:
+            if (!ReadU32(request, id) || request.size() != 1)
+                return false;
+            if (m_Entries.find(id) == m_Entries.end())
+            {
+                reply += static_cast<char>(false);
+                break;
+            }
+
+            client.waiting = true;
+            QueueRequest({ MSG_PIN, id, request.front() != 0, {}, client.serial, {} });
+            return true;
+
+        default: return false;
+    }
+
+    QueueReply(client, type, reply);
+    return true;
+}
+
+uint32_t CHistoryServer::AddEntry(const std::string_view content)
+{
+    uint32_t    id;
+    std::string stored;
+    {
+        std::lock_guard<std::mutex> lock(m_BackendMutex);
+        id = m_Blob ? m_Blob->AddEntry(content, stored) : m_Backend->AddEntry(content);
+    }
+    m_Entries.emplace(id, ShareContent(stored.empty() ? content : stored));
+    return id;
+}
+
+bool CHistoryServer::QueueEntry(std::string content)
+{
+    if (!m_Queue.Push(content))
+    {
+        // don't flood the terminal while it's stuck, only warn at every power of two
+        ++m_Dropped;
+        if ((m_Dropped & (m_Dropped - 1)) == 0)
+            warn("The clipboard history can't keep up, {} copies dropped so far", m_Dropped);
+        return false;
+    }
+
+    WakeWriter();
+    return true;
+}
+
+void CHistoryServer::QueueRequest(WriterRequest request)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_RequestsMutex);
+        m_Requests.push_back(std::move(request));
+    }
+    WakeWriter();
+}
+
+void CHistoryServer::WakeWriter()
+{
+    const uint64_t one = 1;
+    if (write(m_WriterWakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        warn("Failed to wake the history writer: {}", strerror(errno));
+}
+
+void CHistoryServer::Writer()
+{
+    std::vector<std::string>      batch;
+    std::vector<std::string_view> views;
+    std::string                   content;
+    while (true)
+    {
+        // wake up every second anyway, to fsync what clients added meanwhile
+        pollfd pfd{ m_WriterWakeFd, POLLIN, 0 };
+        poll(&pfd, 1, 1000);
+
+        uint64_t wakes;
+        if (read(m_WriterWakeFd, &wakes, sizeof(wakes)) < 0 && errno != EAGAIN)
+            warn("Failed to read the history writer eventfd: {}", strerror(errno));
+
+        // checked before draining, so what got queued before stopping is still saved
+        const bool stop = m_StopWriter;
+
+        batch.clear();
+        while (m_Queue.Pop(content))
+            batch.push_back(std::move(content));
+
+        views.assign(batch.begin(), batch.end());
+
+        std::vector<WriterRequest> requests, reads;
+        {
+            std::lock_guard<std::mutex> lock(m_RequestsMutex);
+            for (WriterRequest& request : m_Requests)
+                (request.type == MSG_GET || request.type == MSG_ENTRIES ? reads : requests).push_back(std::move(request));
+            m_Requests.clear();
+        }
+
+        std::vector<std::pair<uint32_t, std::string>> saved;
+        std::vector<uint32_t>                         evicted;
+        std::vector<WriterReply>                      replies;
+        {
+            std::lock_guard<std::mutex> lock(m_BackendMutex);
+            if (!batch.empty())
+            {
+                std::vector<std::string>     stored;
+                const std::vector<uint32_t>& ids =
+                    m_Blob ? m_Blob->AddEntries(views, stored) : m_Backend->AddEntries(views);
+                for (size_t i = 0; i < ids.size(); ++i)
+                {
+                    // the big contents only live in their files from now on
+                    std::string& kept = i < stored.size() && !stored[i].empty() ? stored[i] : batch[i];
+                    saved.emplace_back(ids[i], std::move(kept));
+                }
+            }
+
+            for (WriterRequest& request : requests)
+            {
+                const std::string& reply = DoRequest(request, saved);
+                if (request.client == 0)
+                    continue;
+
+                std::string message;
+                AppendMessageHeader(message, request.type, reply.size());
+                message += reply;
+                replies.push_back({ request.client, std::move(message) });
+            }
+
+            if (!saved.empty())
+                evicted = m_Backend->EnforceRetention();
+
+            if (m_CompactRequested.exchange(false))
+            {
+                // entries only get older, so some may have expired since the last copy
+                const std::vector<uint32_t>& expired = m_Backend->EnforceRetention();
+                evicted.insert(evicted.end(), expired.begin(), expired.end());
+                m_Backend->Compact();
+            }
+
+            m_Backend->Sync();
+        }
+
+        for (const WriterRequest& request : reads)
+            replies.push_back({ request.client, ReadEntries(request) });
+
+        if (!batch.empty())
+            debug("Saved {} copies in the clipboard history, {} still queued", batch.size(), m_Queue.Size());
+
+        if (!saved.empty() || !evicted.empty() || !replies.empty())
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_DoneMutex);
+                m_DoneEntries.insert(m_DoneEntries.end(), std::make_move_iterator(saved.begin()),
+                                     std::make_move_iterator(saved.end()));
+                m_DoneEvicted.insert(m_DoneEvicted.end(), evicted.begin(), evicted.end());
+                m_DoneReplies.insert(m_DoneReplies.end(), std::make_move_iterator(replies.begin()),
+                                     std::make_move_iterator(replies.end()));
+            }
+
+            const uint64_t one = 1;
+            if (write(m_WritesDoneFd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+                warn("Failed to notify the saved clipboard history entries: {}", strerror(errno));
+        }
+
+        if (stop)
+            return;
+    }
+}
+
+std::string CHistoryServer::DoRequest(WriterRequest& request, std::vector<std::pair<uint32_t, std::string>>& saved)
+{
+    std::string reply;
+    switch (request.type)
+    {
+        case MSG_ADD:
+        {
+            std::string    stored;
+            const uint32_t id =
+                m_Blob ? m_Blob->AddEntry(request.content, stored) : m_Backend->AddEntry(request.content);
+            saved.emplace_back(id, stored.empty() ? std::move(request.content) : std::move(stored));
+            AppendU32(reply, id);
+            break;
+        }
+
+        case MSG_ADDS:
+        {
+            std::vector<std::string_view> contents;
+            std::string_view              content;
+            std::string_view              view = request.content;
+            while (ReadString(view, content))
+                contents.push_back(content);
+
+            std::vector<std::string>     stored;
+            const std::vector<uint32_t>& ids =
+                m_Blob ? m_Blob->AddEntries(contents, stored) : m_Backend->AddEntries(contents);
+            for (size_t i = 0; i < ids.size(); ++i)
+            {
+                const bool ownFile = i < stored.size() && !stored[i].empty();
+                saved.emplace_back(ids[i], ownFile ? std::move(stored[i]) : std::string(contents[i]));
+                AppendU32(reply, ids[i]);
+            }
+            break;
+        }
+
+        case MSG_DELETE: m_Backend->DeleteEntry(request.id); break;
+        case MSG_PIN:    reply += static_cast<char>(m_Backend->SetPinned(request.id, request.pinned)); break;
+        case MSG_FLUSH:  m_Backend->Flush(); break;
+        default:         break;
+    }
+    return reply;
+}
+
+std::string CHistoryServer::ReadEntries(const WriterRequest& request) const
+{
+    // the header goes first with the size set once the contents are in
+    std::string reply;
+    AppendMessageHeader(reply, request.type, 0);
+    const size_t headerSize = reply.size();
+
+    std::string content;
+    for (const auto& [id, stored] : request.entries)
+    {
+        if (request.type == MSG_GET)
+            reply += static_cast<char>(true);
+        else
+            AppendU32(reply, id);
+
+        if (m_Blob)
+        {
+            m_Blob->LoadStored(*stored, content);
+            AppendString(reply, content);
+        }
+        else
+        {
+            AppendString(reply, *stored);
+        }
+    }
+
+    std::string header;
+    AppendMessageHeader(header, request.type, reply.size() - headerSize);
+    reply.replace(0, headerSize, header);
+    return reply;
+}
+
+void CHistoryServer::ApplyWrites()
+{
+    uint64_t n;
+    if (read(m_WritesDoneFd, &n, sizeof(n)) < 0 && errno != EAGAIN)
+        warn("Failed to read the saved clipboard history entries eventfd: {}", strerror(errno));
+
+    std::vector<std::pair<uint32_t, std::string>> entries;
+    std::vector<uint32_t>                         evicted;
+    std::vector<WriterReply>                      replies;
+    {
+        std::lock_guard<std::mutex> lock(m_DoneMutex);
+        entries.swap(m_DoneEntries);
+        evicted.swap(m_DoneEvicted);
+        replies.swap(m_DoneReplies);
+    }
+
+    // evictions may be about entries of the same batch
+    for (const auto& [id, content] : entries)
+        m_Entries.emplace(id, ShareContent(content));
+
+    for (const uint32_t id : evicted)
+    {
+        const auto& it = m_Entries.find(id);
+        if (it != m_Entries.end())
+            ForgetEntry(it);
+    }
+
+    // after the entries are in memory, so what a client added is there once it knows its id
+    for (WriterReply& reply : replies)
+    {
+        const auto& it = std::find_if(m_Clients.begin(), m_Clients.end(),
+                                      [&](const auto& client) { return client.second.serial == reply.client; });
+        if (it == m_Clients.end())
+            continue;
+
+        const int fd       = it->first;
+        it->second.waiting = false;
+        if (it->second.output.empty())
+            it->second.output.swap(reply.message);
+        else
+            it->second.output += reply.message;
+        if (SendReplies(fd, it->second))
+            HandleRequests(fd, it->second);
+    }
+}
+
+std::shared_ptr<const std::string> CHistoryServer::ShareContent(const std::string_view content)
+{
+    std::weak_ptr<const std::string>&  weak   = m_Contents[xxh64_hash(content.data(), content.size())];
+    std::shared_ptr<const std::string> shared = weak.lock();
+
+    // the slot of a content that's gone is taken over, on a hash collision the newest one gets shared
+    if (!shared || *shared != content)
+    {
+        shared = std::make_shared<const std::string>(content);
+        weak   = shared;
+    }
+    return shared;
+}
+
+bool CHistoryServer::GetEntry(const uint32_t id, std::string& content)
+{
+    const auto& it = m_Entries.find(id);
+    if (it == m_Entries.end())
+        return false;
+
+    if (m_Blob)
+        m_Blob->LoadStored(*it->second, content);
+    else
+        content = *it->second;
+    return true;
+}
+
+bool CHistoryServer::DeleteEntry(const uint32_t id)
+{
+    const auto& it = m_Entries.find(id);
+    if (it == m_Entries.end())
+        return false;
+
+    ForgetEntry(it);
+    QueueRequest({ MSG_DELETE, id, false, {}, 0, {} });
+    return true;
+}
+
+void CHistoryServer::ForgetEntry(const std::map<uint32_t, std::shared_ptr<const std::string>>::iterator it)
+{
+    std::shared_ptr<const std::string> content = std::move(it->second);
+    m_Entries.erase(it);
+    ReleaseContent(std::move(content));
+}
+
+void CHistoryServer::ReleaseContent(std::shared_ptr<const std::string> content)
+{
+    // a listing may still have it, then it goes once the listing is done
+    if (content.use_count() != 1)
+        return;
+
+    // on a hash collision, the slot may be shared by another content
+    const auto& it = m_Contents.find(xxh64_hash(content->data(), content->size()));
+    if (it != m_Contents.end() && it->second.lock() == content)
+        m_Contents.erase(it);
+}
+
+bool CHistoryServer::SetPinned(const uint32_t id, const bool pinned)
+{
+    if (m_Entries.find(id) == m_Entries.end())
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_BackendMutex);
+    return m_Backend->SetPinned(id, pinned);
+}
+
+std::vector<uint32_t> CHistoryServer::EnforceRetention()
+{
+    std::vector<uint32_t> evicted;
+    {
+        std::lock_guard<std::mutex> lock(m_BackendMutex);
+        evicted = m_Backend->EnforceRetention();
+    }
+
+    for (const uint32_t id : evicted)
+    {
+        const auto& it = m_Entries.find(id);
+        if (it != m_Entries.end())
+            ForgetEntry(it);
+    }
+    return evicted;
+}
+
+void CHistoryServer::ForEachEntry(const std::function<void(uint32_t, std::string_view)>& func)
+{
+    std::string content;
+    for (const auto& [id, stored] : m_Entries)
+    {
+        if (!m_Blob)
+        {
+            func(id, *stored);
+            continue;
+        }
+
+        m_Blob->LoadStored(*stored, content);
+        func(id, content);
+    }
+}
+
+std::vector<uint32_t> CHistoryServer::GetAllIds()
+{
+    std::vector<uint32_t> ids;
+    ids.reserve(m_Entries.size());
+    for (const auto& it : m_Entries)
+        ids.push_back(it.first);
+
+    return ids;
+}
+
+void CHistoryServer::Sync()
+{
+    std::lock_guard<std::mutex> lock(m_BackendMutex);
+    m_Backend->Sync();
+}
+
+void CHistoryServer::Flush()
+{
+    std::lock_guard<std::mutex> lock(m_BackendMutex);
+    m_Backend->Flush();
+}
+
+void CHistoryServer::Compact()
+{
+    // compacting may rewrite the whole history, so keep it off the loop too
+    m_CompactRequested = true;
+    WakeWriter();
+}
@@ -0,0 +1,145 @@
+#include "history/daemon/Protocol.hpp"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+// how much of a message is read at once
+constexpr size_t RECV_CHUNK_SIZE = 16 << 20;
+
+std::string GetHistorySocketPath(const std::string& historyPath)
+{ return historyPath + ".sock"; }
+
+static bool write_all(const int fd, const char* buf, size_t len)
+{
+    while (len > 0)
+    {
+        const ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool read_all(const int fd, char* buf, size_t len)
+{
+    while (len > 0)
+    {
+        const ssize_t n = read(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool SendMessage(const int fd, const MessageType type, const std::string_view payload)
+{
+    MessageHeader header{};
+    header.type = type;
+    header.size = payload.size();
+
+    return write_all(fd, reinterpret_cast<const char*>(&header), sizeof(header)) &&
+           write_all(fd, payload.data(), payload.size());
+}
+
+void AppendMessageHeader(std::string& buffer, const MessageType type, const uint64_t size)
+{
+    MessageHeader header{};
+    header.type = type;
+    header.size = size;
+    buffer.append(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+bool RecvMessage(const int fd, MessageType& type, std::string& payload)
+{
+    MessageHeader header;
+    if (!read_all(fd, reinterpret_cast<char*>(&header), sizeof(header)))
+        return false;
+
+    if (header.size > MAX_MESSAGE_SIZE)
+        return false;
+
+    // grown as it comes, so the header alone can't make us allocate all of it
+    type = static_cast<MessageType>(header.type);
+    payload.clear();
+    while (payload.size() < header.size)
+    {
+        const size_t offset = payload.size();
+        payload.resize(offset + std::min<uint64_t>(header.size - offset, RECV_CHUNK_SIZE));
+        if (!read_all(fd, payload.data() + offset, payload.size() - offset))
+            return false;
+    }
+    return true;
+}
+
+bool ParseMessage(std::string_view& buffer, MessageType& type, std::string_view& payload)
+{
+    MessageHeader header;
+    if (buffer.size() < sizeof(header))
+        return false;
+
+    memcpy(&header, buffer.data(), sizeof(header));
+    if (buffer.size() - sizeof(header) < header.size)
+        return false;
+
+    type    = static_cast<MessageType>(header.type);
+    payload = buffer.substr(sizeof(header), header.size);
+    buffer.remove_prefix(sizeof(header) + header.size);
+    return true;
+}
+
+void AppendU32(std::string& payload, const uint32_t value)
+{ payload.append(reinterpret_cast<const char*>(&value), sizeof(value)); }
+
+void AppendU64(std::string& payload, const uint64_t value)
+{ payload.append(reinterpret_cast<const char*>(&value), sizeof(value)); }
+
+void AppendString(std::string& payload, const std::string_view str)
+{
+    AppendU32(payload, str.size());
+    payload.append(str);
+}
+
+bool ReadU32(std::string_view& payload, uint32_t& value)
+{
+    if (payload.size() < sizeof(value))
+        return false;
+
+    memcpy(&value, payload.data(), sizeof(value));
+    payload.remove_prefix(sizeof(value));
+    return true;
+}
+
+bool ReadU64(std::string_view& payload, uint64_t& value)
+{
+    if (payload.size() < sizeof(value))
+        return false;
+
+    memcpy(&value, payload.data(), sizeof(value));
+    payload.remove_prefix(sizeof(value));
+    return true;
+}
+
+bool ReadString(std::string_view& payload, std::string_view& str)
+{
+    uint32_t size = 0;
+    if (!ReadU32(payload, size) || payload.size() < size)
+        return false;
+
+    str = payload.substr(0, size);
+    payload.remove_prefix(size);
+    return true;
+}
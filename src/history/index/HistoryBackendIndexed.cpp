@@ -0,0 +1,95 @@
+#include "history/index/HistoryBackendIndexed.hpp"
+
+#include <unistd.h>
+
+#include "history/index/TrigramIndex.hpp"
+
+CHistoryBackendIndexed::CHistoryBackendIndexed(std::unique_ptr<CHistoryBackend> backend, const std::string& indexPath)
+    : m_Backend(std::move(backend)), m_IndexPath(indexPath)
+{}
+
+CHistoryBackendIndexed::~CHistoryBackendIndexed()
+{
+    if (m_IndexFd >= 0)
+        close(m_IndexFd);
+}
+
+uint32_t CHistoryBackendIndexed::AddEntry(const std::string_view content)
+{
+    const uint32_t id = m_Backend->AddEntry(content);
+    IndexEntry(id, content);
+    return id;
+}
+
+std::vector<uint32_t> CHistoryBackendIndexed::AddEntries(const std::vector<std::string_view>& contents)
+{
+    const std::vector<uint32_t>& ids = m_Backend->AddEntries(contents);
+    for (size_t i = 0; i < ids.size(); ++i)
+        IndexEntry(ids[i], contents[i]);
+
+    return ids;
+}
+
+void CHistoryBackendIndexed::IndexEntry(const uint32_t id, const std::string_view content)
+{
+    // a missing record isn't fatal, the next search will index the entry by itself
+    if (m_IndexFd < 0)
+        m_IndexFd = CTrigramIndex::OpenForAppend(m_IndexPath);
+    if (m_IndexFd >= 0 && !CTrigramIndex::AppendEntry(m_IndexFd, id, content))
+    {
+        close(m_IndexFd);
+        m_IndexFd = -1;
+    }
+}
+
+bool CHistoryBackendIndexed::GetEntry(const uint32_t id, std::string& content)
+{ return m_Backend->GetEntry(id, content); }
+
+bool CHistoryBackendIndexed::DeleteEntry(const uint32_t id)
+{ return m_Backend->DeleteEntry(id); }
+
+void CHistoryBackendIndexed::GetEntries(const std::vector<uint32_t>& ids,
+                                        const std::function<void(uint32_t, std::string_view)>& func)
+{ m_Backend->GetEntries(ids, func); }
+
+std::vector<uint32_t> CHistoryBackendIndexed::DeleteEntries(const std::vector<uint32_t>& ids)
+{ return m_Backend->DeleteEntries(ids); }
+
+void CHistoryBackendIndexed::GetEntryTable(EntryTable& table)
+{ m_Backend->GetEntryTable(table); }
+
+void CHistoryBackendIndexed::GetPreviewTable(EntryTable& table, const size_t maxSize)
+{ m_Backend->GetPreviewTable(table, maxSize); }
+
+bool CHistoryBackendIndexed::SetPinned(const uint32_t id, const bool pinned)
+{ return m_Backend->SetPinned(id, pinned); }
+
+std::vector<uint32_t> CHistoryBackendIndexed::EnforceRetention()
+{ return m_Backend->EnforceRetention(); }
+
+void CHistoryBackendIndexed::ForEachEntry(const std::function<void(uint32_t, std::string_view)>& func)
+{ m_Backend->ForEachEntry(func); }
+
+std::vector<uint32_t> CHistoryBackendIndexed::GetAllIds()
+{ return m_Backend->GetAllIds(); }
+
+void CHistoryBackendIndexed::Sync()
+{ m_Backend->Sync(); }
+
+void CHistoryBackendIndexed::Flush()
+{ m_Backend->Flush(); }
+
+void CHistoryBackendIndexed::Compact()
+{
+    m_Backend->Compact();
+
+    if (!CTrigramIndex::ShouldRebuild(m_IndexPath, m_Backend->GetAllIds().size()))
+        return;
+
+    // our fd would keep appending into the old file
+    if (CTrigramIndex::Rebuild(m_IndexPath, *m_Backend) && m_IndexFd >= 0)
+    {
+        close(m_IndexFd);
+        m_IndexFd = -1;
+    }
+}
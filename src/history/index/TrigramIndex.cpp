@@ -0,0 +1,501 @@
+#include "history/index/TrigramIndex.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+
+#include "fmt/format.h"
+#include "util.hpp"
+
+constexpr char     INDEX_MAGIC[8]  = { 'C', 'L', 'P', 'Y', 'T', 'R', 'I', 0 };
+constexpr uint32_t INDEX_VERSION   = 2;
+constexpr size_t   CHECKSUM_SKIP   = sizeof(CTrigramIndex::RecordHeader::checksum);
+constexpr uint32_t MAX_TRIGRAMS    = 1 << 24;
+
+// the posting lists get rebuilt once the records appended since are at least that many,
+// and at least that fraction of the entries in them, as those records are read again by every search
+constexpr size_t REBUILD_MIN_RECORDS      = 1024;
+constexpr size_t REBUILD_RECORDS_FRACTION = 8;
+
+static char fold_case(const char c)
+{ return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c; }
+
+// every distinct trigram of str, sorted
+static std::vector<uint32_t> get_trigrams(const std::string_view str)
+{
+    std::vector<uint32_t> trigrams;
+    if (str.size() < 3)
+        return trigrams;
+
+    trigrams.reserve(str.size() - 2);
+    for (size_t i = 0; i + 3 <= str.size(); ++i)
+        trigrams.push_back(static_cast<uint32_t>(static_cast<uint8_t>(fold_case(str[i]))) << 16 |
+                           static_cast<uint32_t>(static_cast<uint8_t>(fold_case(str[i + 1]))) << 8 |
+                           static_cast<uint32_t>(static_cast<uint8_t>(fold_case(str[i + 2]))));
+
+    std::sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+    return trigrams;
+}
+
+static uint32_t record_checksum(const CTrigramIndex::RecordHeader& rec, const void* trigrams)
+{
+    const uint32_t crc = crc32_checksum(reinterpret_cast<const char*>(&rec) + CHECKSUM_SKIP, sizeof(rec) - CHECKSUM_SKIP);
+    return crc32_checksum(trigrams, rec.count * sizeof(uint32_t), crc);
+}
+
+static bool write_all(const int fd, const std::string_view buf)
+{
+    size_t done = 0;
+    while (done < buf.size())
+    {
+        const ssize_t n = write(fd, buf.data() + done, buf.size() - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+static std::string make_record(const uint32_t id, const std::vector<uint32_t>& trigrams)
+{
+    CTrigramIndex::RecordHeader rec{};
+    rec.id       = id;
+    rec.count    = trigrams.size();
+    rec.checksum = record_checksum(rec, trigrams.data());
+
+    std::string buf(sizeof(rec) + trigrams.size() * sizeof(uint32_t), '\0');
+    memcpy(buf.data(), &rec, sizeof(rec));
+    memcpy(buf.data() + sizeof(rec), trigrams.data(), trigrams.size() * sizeof(uint32_t));
+    return buf;
+}
+
+// size of the index file before its records
+static uint64_t postings_size(const CTrigramIndex::FileHeader& header)
+{
+    return sizeof(header) + (header.trigrams + 1) * sizeof(uint64_t) +
+           (header.entries + header.trigrams + header.postings) * sizeof(uint32_t);
+}
+
+// read the header of the index file, and check the posting lists after it are all there
+static bool read_file_header(const int fd, const uint64_t fileSize, CTrigramIndex::FileHeader& header)
+{
+    return pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+           memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0 && header.version == INDEX_VERSION &&
+           header.entries <= fileSize && header.trigrams <= fileSize && header.postings <= fileSize &&
+           postings_size(header) <= fileSize;
+}
+
+template <typename T>
+static bool write_array(const int fd, const std::vector<T>& array)
+{ return write_all(fd, { reinterpret_cast<const char*>(array.data()), array.size() * sizeof(T) }); }
+
+// create the index file at tmpPath with these posting lists in it (see FileHeader), and no records yet
+static int create_index_file(const std::string& tmpPath, const std::vector<uint32_t>& ids = {},
+                             const std::vector<uint64_t>& starts = { 0 }, const std::vector<uint32_t>& keys = {},
+                             const std::vector<uint32_t>& lists = {})
+{
+    const int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -1;
+
+    CTrigramIndex::FileHeader header{};
+    memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version  = INDEX_VERSION;
+    header.entries  = ids.size();
+    header.trigrams = keys.size();
+    header.postings = lists.size();
+    if (!write_all(fd, { reinterpret_cast<const char*>(&header), sizeof(header) }) || !write_array(fd, starts) ||
+        !write_array(fd, ids) || !write_array(fd, keys) || !write_array(fd, lists))
+    {
+        close(fd);
+        unlink(tmpPath.c_str());
+        return -1;
+    }
+
+    return fd;
+}
+
+CTrigramIndex::CTrigramIndex(const std::string& path) : m_Path(path)
+{}
+
+CTrigramIndex::~CTrigramIndex()
+{
+    if (m_Map)
+        munmap(m_Map, m_MapSize);
+}
+
+void CTrigramIndex::Reset()
+{
+    if (m_Map)
+        munmap(m_Map, m_MapSize);
+    m_Map          = nullptr;
+    m_MapSize      = 0;
+    m_Header       = nullptr;
+    m_Inode        = 0;
+    m_LoadedOffset = 0;
+    m_Corrupted    = false;
+    m_Indexed.clear();
+    m_Postings.clear();
+}
+
+bool CTrigramIndex::MapPostings(const int fd, const uint64_t fileSize)
+{
+    FileHeader header;
+    if (!read_file_header(fd, fileSize, header))
+        return false;
+
+    const size_t size = postings_size(header);
+    void*        map  = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        warn("Failed to map the search index '{}': {}", m_Path, strerror(errno));
+        return false;
+    }
+
+    m_Map          = map;
+    m_MapSize      = size;
+    m_Header       = static_cast<const FileHeader*>(map);
+    m_Starts       = reinterpret_cast<const uint64_t*>(m_Header + 1);
+    m_Ids          = reinterpret_cast<const uint32_t*>(m_Starts + header.trigrams + 1);
+    m_Keys         = m_Ids + header.entries;
+    m_Lists        = m_Keys + header.trigrams;
+    m_LoadedOffset = size;
+    return true;
+}
+
+std::pair<const uint32_t*, size_t> CTrigramIndex::GetMappedPostings(const uint32_t trigram) const
+{
+    if (!m_Header)
+        return { nullptr, 0 };
+
+    const uint32_t* end = m_Keys + m_Header->trigrams;
+    const uint32_t* it  = std::lower_bound(m_Keys, end, trigram);
+    if (it == end || *it != trigram)
+        return { nullptr, 0 };
+
+    // don't trust the file to stay in the map
+    const uint64_t start = m_Starts[it - m_Keys];
+    const uint64_t stop  = m_Starts[it - m_Keys + 1];
+    if (start > stop || stop > m_Header->postings)
+        return { nullptr, 0 };
+    return { m_Lists + start, stop - start };
+}
+
+bool CTrigramIndex::IsIndexed(const uint32_t id) const
+{
+    return m_Indexed.find(id) != m_Indexed.end() ||
+           (m_Header && std::binary_search(m_Ids, m_Ids + m_Header->entries, id));
+}
+
+void CTrigramIndex::Load()
+{
+    const int fd = open(m_Path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return;
+    }
+
+    // someone rebuilt it since, start over
+    if (m_Inode != 0 && st.st_ino != m_Inode)
+        Reset();
+    m_Inode = st.st_ino;
+
+    if (m_LoadedOffset == 0 && !MapPostings(fd, st.st_size))
+    {
+        close(fd);
+        m_Corrupted = true;
+        return;
+    }
+
+    if (static_cast<uint64_t>(st.st_size) <= m_LoadedOffset)
+    {
+        close(fd);
+        return;
+    }
+
+    std::string buf(st.st_size - m_LoadedOffset, '\0');
+    const ssize_t len = pread(fd, buf.data(), buf.size(), m_LoadedOffset);
+    close(fd);
+    if (len < 0)
+    {
+        warn("Failed to read the search index '{}': {}", m_Path, strerror(errno));
+        return;
+    }
+
+    std::vector<uint32_t> trigrams;
+    size_t                pos = 0;
+    while (pos + sizeof(RecordHeader) <= static_cast<size_t>(len))
+    {
+        RecordHeader rec;
+        memcpy(&rec, buf.data() + pos, sizeof(rec));
+
+        // there can't be more distinct trigrams than that
+        if (rec.count > MAX_TRIGRAMS)
+        {
+            m_Corrupted = true;
+            break;
+        }
+
+        const size_t size = sizeof(rec) + static_cast<size_t>(rec.count) * sizeof(uint32_t);
+        // another instance may be appending it right now
+        if (pos + size > static_cast<size_t>(len))
+            break;
+
+        if (record_checksum(rec, buf.data() + pos + sizeof(rec)) != rec.checksum)
+        {
+            m_Corrupted = true;
+            break;
+        }
+
+        trigrams.resize(rec.count);
+        memcpy(trigrams.data(), buf.data() + pos + sizeof(rec), rec.count * sizeof(uint32_t));
+        AddPostings(rec.id, trigrams);
+        pos += size;
+    }
+
+    m_LoadedOffset += pos;
+}
+
+void CTrigramIndex::AddPostings(const uint32_t id, const std::vector<uint32_t>& trigrams)
+{
+    // records of the same id are merged, with each other and with the mapped lists,
+    // extra trigrams just make more candidates
+    m_Indexed.insert(id);
+    for (const uint32_t trigram : trigrams)
+    {
+        std::vector<uint32_t>& ids = m_Postings[trigram];
+        if (ids.empty() || ids.back() < id)
+        {
+            ids.push_back(id);
+        }
+        else
+        {
+            const auto& it = std::lower_bound(ids.begin(), ids.end(), id);
+            if (*it != id)
+                ids.insert(it, id);
+        }
+    }
+}
+
+void CTrigramIndex::Sync(CHistoryBackend& history)
+{
+    Load();
+    if (m_Corrupted)
+    {
+        warn("Search index '{}' is corrupted or from an older clippyman, rebuilding it", m_Path);
+        Reset();
+        if (Rebuild(m_Path, history))
+            Load();
+    }
+
+    std::vector<uint32_t> missing;
+    for (const uint32_t id : history.GetAllIds())
+        if (!IsIndexed(id))
+            missing.push_back(id);
+
+    int fd = -1;
+    history.GetEntries(missing, [&](const uint32_t id, const std::string_view content) {
+        if (fd < 0)
+            fd = OpenForAppend(m_Path);
+        if (fd >= 0 && !AppendEntry(fd, id, content))
+        {
+            close(fd);
+            fd = -1;
+        }
+
+        AddPostings(id, get_trigrams(content));
+    });
+
+    // what we appended gets read again by the next Load(), it's merged like any duplicate
+    if (fd >= 0)
+        close(fd);
+}
+
+bool CTrigramIndex::GetCandidates(const std::string_view query, std::vector<uint32_t>& ids) const
+{
+    ids.clear();
+    const std::vector<uint32_t>& trigrams = get_trigrams(query);
+    if (trigrams.empty())
+        return false;
+
+    // the mapped list of each trigram, or the one of the records read since, or both merged
+    std::vector<std::pair<const uint32_t*, size_t>> lists;
+    std::vector<std::vector<uint32_t>>              merged;
+    lists.reserve(trigrams.size());
+    merged.reserve(trigrams.size());
+    for (const uint32_t trigram : trigrams)
+    {
+        const auto& mapped = GetMappedPostings(trigram);
+        const auto& it     = m_Postings.find(trigram);
+        if (it == m_Postings.end())
+        {
+            if (mapped.second == 0)
+                return true;
+            lists.push_back(mapped);
+        }
+        else if (mapped.second == 0)
+        {
+            lists.emplace_back(it->second.data(), it->second.size());
+        }
+        else
+        {
+            std::vector<uint32_t>& list = merged.emplace_back();
+            std::set_union(mapped.first, mapped.first + mapped.second, it->second.begin(), it->second.end(),
+                           std::back_inserter(list));
+            lists.emplace_back(list.data(), list.size());
+        }
+    }
+
+    // start from the shortest list, so the intersection stays as small as possible
+    std::sort(lists.begin(), lists.end(), [](const auto& a, const auto& b) { return a.second < b.second; });
+
+    ids.assign(lists.front().first, lists.front().first + lists.front().second);
+    std::vector<uint32_t> tmp;
+    for (size_t i = 1; i < lists.size() && !ids.empty(); ++i)
+    {
+        tmp.clear();
+        std::set_intersection(ids.begin(), ids.end(), lists[i].first, lists[i].first + lists[i].second,
+                              std::back_inserter(tmp));
+        ids.swap(tmp);
+    }
+
+    return true;
+}
+
+int CTrigramIndex::OpenForAppend(const std::string& path)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd >= 0 || errno != ENOENT)
+    {
+        if (fd < 0)
+            warn("Failed to open the search index '{}': {}", path, strerror(errno));
+        return fd;
+    }
+
+    // create it with the header already in, so nobody can append before it
+    const std::string& tmpPath = path + fmt::format(".{}.tmp", getpid());
+    fd                         = create_index_file(tmpPath);
+    if (fd < 0)
+    {
+        warn("Failed to create the search index '{}': {}", path, strerror(errno));
+        return -1;
+    }
+    close(fd);
+
+    // if someone else made it first, just use theirs
+    link(tmpPath.c_str(), path.c_str());
+    unlink(tmpPath.c_str());
+
+    fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd < 0)
+        warn("Failed to open the search index '{}': {}", path, strerror(errno));
+    return fd;
+}
+
+bool CTrigramIndex::AppendEntry(const int fd, const uint32_t id, const std::string_view content)
+{
+    if (!write_all(fd, make_record(id, get_trigrams(content))))
+    {
+        warn("Failed to write into the search index: {}", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool CTrigramIndex::ShouldRebuild(const std::string& path, const size_t entries)
+{
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    FileHeader  header;
+    if (fstat(fd, &st) != 0 || !read_file_header(fd, st.st_size, header))
+    {
+        close(fd);
+        return true;
+    }
+
+    size_t       records = 0;
+    uint64_t     offset  = postings_size(header);
+    RecordHeader rec;
+    while (pread(fd, &rec, sizeof(rec), offset) == sizeof(rec))
+    {
+        ++records;
+        offset += sizeof(rec) + static_cast<uint64_t>(rec.count) * sizeof(uint32_t);
+    }
+    close(fd);
+
+    return header.entries + records >= entries * 2 + 1024 ||
+           records >= std::max<size_t>(REBUILD_MIN_RECORDS, header.entries / REBUILD_RECORDS_FRACTION);
+}
+
+bool CTrigramIndex::Rebuild(const std::string& path, CHistoryBackend& history)
+{
+    std::vector<uint32_t>                               ids;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> postings;
+    history.ForEachEntry([&](const uint32_t id, const std::string_view content) {
+        ids.push_back(id);
+        for (const uint32_t trigram : get_trigrams(content))
+            postings[trigram].push_back(id);
+    });
+
+    // the entries usually come from the oldest to the newest one already
+    const bool sorted = std::is_sorted(ids.begin(), ids.end());
+    if (!sorted)
+        std::sort(ids.begin(), ids.end());
+
+    std::vector<uint32_t> keys;
+    keys.reserve(postings.size());
+    for (const auto& it : postings)
+        keys.push_back(it.first);
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<uint64_t> starts;
+    std::vector<uint32_t> lists;
+    starts.reserve(keys.size() + 1);
+    for (const uint32_t trigram : keys)
+    {
+        std::vector<uint32_t>& list = postings[trigram];
+        if (!sorted)
+            std::sort(list.begin(), list.end());
+
+        starts.push_back(lists.size());
+        lists.insert(lists.end(), list.begin(), list.end());
+        std::vector<uint32_t>().swap(list);
+    }
+    starts.push_back(lists.size());
+
+    const std::string& tmpPath = path + fmt::format(".{}.tmp", getpid());
+    const int          fd      = create_index_file(tmpPath, ids, starts, keys, lists);
+    if (fd < 0)
+    {
+        warn("Failed to rebuild the search index, couldn't write '{}': {}", tmpPath, strerror(errno));
+        return false;
+    }
+
+    if (fsync(fd) != 0 || rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        warn("Failed to rebuild the search index: {}", strerror(errno));
+        close(fd);
+        unlink(tmpPath.c_str());
+        return false;
+    }
+
+    close(fd);
+    return true;
+}
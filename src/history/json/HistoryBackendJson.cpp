@@ -0,0 +1,595 @@
+#include "history/json/HistoryBackendJson.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "config.hpp"
+#include "fmt/format.h"
+#include "fmt/os.h"
+#include "rapidjson/error/en.h"
+#include "rapidjson/filereadstream.h"
+#include "rapidjson/filewritestream.h"
+#include "rapidjson/prettywriter.h"
+#include "rapidjson/reader.h"
+#include "util.hpp"
+
+using FileWriter = rapidjson::PrettyWriter<rapidjson::FileWriteStream>;
+
+/* Where a SAX parse is in a history, to tell the entries apart from the rest. */
+struct HistoryPath
+{
+    unsigned depth      = 0;
+    bool     in_entries = false;  // in the "entries" object
+    bool     in_pinned  = false;  // in the "pinned" array
+
+    /*
+     * Follow a key.
+     * @return true if it's the id of an entry, then id is set
+     */
+    bool Key(const char* str, const rapidjson::SizeType len, uint32_t& id)
+    {
+        if (depth == 1)
+        {
+            in_entries = std::string_view(str, len) == "entries";
+            in_pinned  = std::string_view(str, len) == "pinned";
+        }
+
+        if (depth != 2 || !in_entries)
+            return false;
+
+        const auto& [ptr, ec] = std::from_chars(str, str + len, id);
+        return ec == std::errc() && ptr == str + len;
+    }
+};
+
+/* Calls func on the entries with the wanted ids, and stops the parse once they're all found. */
+struct EntryLookup : rapidjson::BaseReaderHandler<rapidjson::UTF8<>, EntryLookup>
+{
+    EntryLookup(const std::unordered_set<uint32_t>& wanted, const std::function<void(uint32_t, std::string_view)>& func)
+        : wanted(wanted), func(func)
+    {}
+
+    bool StartObject() { ++path.depth; return true; }
+    bool EndObject(rapidjson::SizeType) { --path.depth; return true; }
+    bool StartArray() { ++path.depth; return true; }
+    bool EndArray(rapidjson::SizeType) { --path.depth; return true; }
+
+    bool Key(const char* str, const rapidjson::SizeType len, bool)
+    {
+        found_key = path.Key(str, len, id) && wanted.find(id) != wanted.end();
+        return true;
+    }
+
+    bool String(const char* str, const rapidjson::SizeType len, bool)
+    {
+        if (!found_key || path.depth != 2)
+            return true;
+
+        found_key = false;
+        func(id, { str, len });
+        return ++found < wanted.size();
+    }
+
+    const std::unordered_set<uint32_t>&                    wanted;
+    const std::function<void(uint32_t, std::string_view)>& func;
+
+    HistoryPath path;
+    uint32_t    id        = 0;
+    bool        found_key = false;
+    size_t      found     = 0;
+};
+
+/* Writes everything it reads into writer, except the entries with the doomed ids and their pins. */
+struct EntryFilter : rapidjson::BaseReaderHandler<rapidjson::UTF8<>, EntryFilter>
+{
+    EntryFilter(const std::unordered_set<uint32_t>& doomed, FileWriter& writer) : doomed(doomed), writer(writer) {}
+
+    // a value ends the skipped entry once we're back at its depth
+    bool Skipped()
+    {
+        skipping = path.depth > 2;
+        return true;
+    }
+
+    bool Null() { return skipping ? Skipped() : writer.Null(); }
+    bool Bool(bool b) { return skipping ? Skipped() : writer.Bool(b); }
+    bool Int(int i) { return skipping ? Skipped() : writer.Int(i); }
+    bool Uint(unsigned u)
+    {
+        if (skipping)
+            return Skipped();
+        if (path.depth == 2 && path.in_pinned && doomed.find(u) != doomed.end())
+            return true;
+        return writer.Uint(u);
+    }
+
+    bool Int64(int64_t i) { return skipping ? Skipped() : writer.Int64(i); }
+    bool Uint64(uint64_t u) { return skipping ? Skipped() : writer.Uint64(u); }
+    bool Double(double d) { return skipping ? Skipped() : writer.Double(d); }
+
+    bool String(const char* str, const rapidjson::SizeType len, bool copy)
+    { return skipping ? Skipped() : writer.String(str, len, copy); }
+
+    bool StartObject()
+    {
+        ++path.depth;
+        return skipping || writer.StartObject();
+    }
+
+    bool EndObject(rapidjson::SizeType count)
+    {
+        --path.depth;
+        return skipping ? Skipped() : writer.EndObject(count);
+    }
+
+    bool StartArray()
+    {
+        ++path.depth;
+        return skipping || writer.StartArray();
+    }
+
+    bool EndArray(rapidjson::SizeType count)
+    {
+        --path.depth;
+        return skipping ? Skipped() : writer.EndArray(count);
+    }
+
+    bool Key(const char* str, const rapidjson::SizeType len, bool copy)
+    {
+        if (skipping)
+            return true;
+
+        uint32_t id = 0;
+        if (path.Key(str, len, id) && doomed.find(id) != doomed.end())
+        {
+            deleted.push_back(id);
+            skipping = true;
+            return true;
+        }
+        return writer.Key(str, len, copy);
+    }
+
+    const std::unordered_set<uint32_t>& doomed;
+    FileWriter&                         writer;
+
+    HistoryPath           path;
+    bool                  skipping = false;
+    std::vector<uint32_t> deleted;
+};
+
+/*
+ * Write a history with write into a new file, then rename it over path.
+ * @param write Returns false to give up, then path is left as it was
+ */
+static void write_history(const std::string& path, const std::function<bool(FileWriter&)>& write)
+{
+    const std::string& tmpPath = path + ".tmp";
+    FILE*              file    = fopen(tmpPath.c_str(), "w");
+    if (!file)
+        die("Failed to open clipboard history at '{}': {}", tmpPath, strerror(errno));
+
+    char                       writeBuffer[UINT16_MAX] = { 0 };
+    rapidjson::FileWriteStream writeStream(file, writeBuffer, sizeof(writeBuffer));
+    FileWriter                 fileWriter(writeStream);
+    fileWriter.SetFormatOptions(rapidjson::kFormatSingleLineArray);  // Disable newlines between array elements
+
+    if (!write(fileWriter))
+    {
+        fclose(file);
+        unlink(tmpPath.c_str());
+        return;
+    }
+
+    // the rename must not reach the disk before the content, else a crash leaves an empty history
+    if (fflush(file) != 0 || fsync(fileno(file)) != 0 || fclose(file) != 0 ||
+        rename(tmpPath.c_str(), path.c_str()) != 0)
+        die("Failed to write clipboard history at '{}': {}", path, strerror(errno));
+    sync_parent_dir(path);
+}
+
+CHistoryBackendJson::CHistoryBackendJson(const std::string& path) : m_Path(path)
+{
+    if (access(m_Path.c_str(), F_OK) != 0)
+    {
+        constexpr std::string_view json =
+R"({
+    "entries": {}
+})";
+
+        auto f = fmt::output_file(m_Path, fmt::file::CREATE | fmt::file::RDWR | fmt::file::TRUNC);
+        f.print("{}", json);
+        f.close();
+    }
+}
+
+CHistoryBackendJson::~CHistoryBackendJson()
+{
+    m_Doc = rapidjson::Document();
+    if (m_Map)
+        munmap(m_Map, m_MapSize);
+}
+
+void CHistoryBackendJson::Load()
+{
+    const int fd = open(m_Path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        die("Failed to open clipboard history at '{}': {}", m_Path, strerror(errno));
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        die("Failed to stat clipboard history at '{}': {}", m_Path, strerror(errno));
+
+    // the old document still points into the old mapping
+    m_Doc = rapidjson::Document();
+    if (m_Map)
+        munmap(m_Map, m_MapSize);
+
+    // Parsing in place needs a '\0' after the content, the rest of the last page of a file mapping is zeroed,
+    // but a file ending right at a page boundary has none, so map it over a zeroed area one page bigger.
+    const size_t page = sysconf(_SC_PAGESIZE);
+    m_MapSize         = (st.st_size / page + 1) * page;
+    m_Map             = mmap(nullptr, m_MapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m_Map == MAP_FAILED ||
+        (st.st_size > 0 &&
+         mmap(m_Map, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED))
+        die("Failed to map clipboard history at '{}': {}", m_Path, strerror(errno));
+    close(fd);
+
+    if (m_Doc.ParseInsitu(static_cast<char*>(m_Map)).HasParseError())
+        die("Failed to parse {}: {} at offset {}", m_Path, rapidjson::GetParseError_En(m_Doc.GetParseError()),
+            m_Doc.GetErrorOffset());
+
+    if (!m_Doc.IsObject() || !m_Doc.HasMember("entries") || !m_Doc["entries"].IsObject())
+        die("Failed to parse clipboard history at '{}'", m_Path);
+
+    m_Loaded     = true;
+    m_LoadedStat = st;
+}
+
+void CHistoryBackendJson::Save()
+{
+    // Truncating the file would pull the pages we didn't write to yet from under m_Doc,
+    // so write_history() writes a new one and renames it over the old one, which stays mapped.
+    write_history(m_Path, [this](FileWriter& writer) { return m_Doc.Accept(writer); });
+
+    // it's what we have in m_Doc, no need to load it again
+    stat(m_Path.c_str(), &m_LoadedStat);
+}
+
+void CHistoryBackendJson::Refresh()
+{
+    struct stat st;
+    if (!m_Loaded || stat(m_Path.c_str(), &st) != 0 || st.st_dev != m_LoadedStat.st_dev ||
+        st.st_ino != m_LoadedStat.st_ino || st.st_size != m_LoadedStat.st_size ||
+        st.st_mtim.tv_sec != m_LoadedStat.st_mtim.tv_sec || st.st_mtim.tv_nsec != m_LoadedStat.st_mtim.tv_nsec)
+        Load();
+}
+
+int CHistoryBackendJson::Lock()
+{
+    while (true)
+    {
+        const int fd = open(m_Path.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd < 0)
+            die("Failed to open clipboard history at '{}': {}", m_Path, strerror(errno));
+        if (!lock_file_range(fd, 0, 0))
+            die("Failed to lock clipboard history at '{}': {}", m_Path, strerror(errno));
+
+        // we may have waited on the lock of a file that has been replaced meanwhile, then take the new one's
+        if (!file_was_replaced(fd, m_Path))
+            return fd;
+        close(fd);
+    }
+}
+
+void CHistoryBackendJson::Unlock(const int fd)
+{
+    close(fd);
+}
+
+/*
+ * Parse the history at path with handler.
+ * @return false if handler stopped the parse early
+ */
+template <typename Handler>
+static bool parse_history(const std::string& path, Handler& handler)
+{
+    FILE* file = fopen(path.c_str(), "r");
+    if (!file)
+        die("Failed to open clipboard history at '{}': {}", path, strerror(errno));
+
+    char                      buf[UINT16_MAX];
+    rapidjson::FileReadStream stream(file, buf, sizeof(buf));
+    rapidjson::Reader         reader;
+
+    const rapidjson::ParseResult& result = reader.Parse(stream, handler);
+    fclose(file);
+    if (result.Code() == rapidjson::kParseErrorTermination)
+        return false;
+    if (result.IsError())
+        die("Failed to parse {}: {} at offset {}", path, rapidjson::GetParseError_En(result.Code()), result.Offset());
+
+    return true;
+}
+
+uint32_t CHistoryBackendJson::AddEntry(const std::string_view content)
+{
+    return AddEntries({ content }).front();
+}
+
+std::vector<uint32_t> CHistoryBackendJson::AddEntries(const std::vector<std::string_view>& contents)
+{
+    if (contents.empty())
+        return {};
+
+    // another clippyman instance may have changed it meanwhile
+    const int lock = Lock();
+    Refresh();
+
+    rapidjson::Document::AllocatorType& allocator = m_Doc.GetAllocator();
+    rapidjson::Value&                   entries   = m_Doc["entries"];
+
+    // set the id from the previous incremented id,
+    // or from the counter if the newest entries got deleted, so their ids aren't given again
+    uint32_t id = 0;
+    if (!entries.ObjectEmpty())
+        id = std::stoul((entries.MemberEnd() - 1)->name.GetString()) + 1;
+    if (m_Doc.HasMember("next_id") && m_Doc["next_id"].IsUint())
+        id = std::max(id, m_Doc["next_id"].GetUint());
+
+    std::vector<uint32_t> ids;
+    ids.reserve(contents.size());
+    for (const std::string_view content : contents)
+    {
+        const std::string& id_str = fmt::to_string(id);
+        rapidjson::Value   value_id(id_str.c_str(), id_str.size(), allocator);
+        rapidjson::Value   value_content(content.data(), content.size(), allocator);
+        entries.AddMember(value_id, value_content, allocator);
+        ids.push_back(id++);
+    }
+
+    m_Doc.RemoveMember("next_id");
+    m_Doc.AddMember("next_id", id, allocator);
+
+    Save();
+    Unlock(lock);
+    return ids;
+}
+
+bool CHistoryBackendJson::GetEntry(const uint32_t id, std::string& content)
+{
+    if (!m_Loaded)
+    {
+        bool found = false;
+        GetEntries({ id }, [&](const uint32_t, const std::string_view str) {
+            content = str;
+            found   = true;
+        });
+        return found;
+    }
+
+    const std::string& id_str = fmt::to_string(id);
+    const auto&        it     = m_Doc["entries"].FindMember(id_str.c_str());
+    if (it == m_Doc["entries"].MemberEnd())
+        return false;
+
+    content.assign(it->value.GetString(), it->value.GetStringLength());
+    return true;
+}
+
+bool CHistoryBackendJson::DeleteEntry(const uint32_t id)
+{
+    return !DeleteEntries({ id }).empty();
+}
+
+void CHistoryBackendJson::GetEntries(const std::vector<uint32_t>& ids,
+                                     const std::function<void(uint32_t, std::string_view)>& func)
+{
+    const std::unordered_set<uint32_t> wanted(ids.begin(), ids.end());
+    if (wanted.empty())
+        return;
+
+    // FindMember() is a linear scan too, so one pass over the document beats one per id
+    if (m_Loaded)
+    {
+        size_t found = 0;
+        for (auto it = m_Doc["entries"].MemberBegin(); it != m_Doc["entries"].MemberEnd() && found < wanted.size(); ++it)
+        {
+            const uint32_t id = std::stoul(it->name.GetString());
+            if (wanted.find(id) == wanted.end())
+                continue;
+
+            func(id, { it->value.GetString(), it->value.GetStringLength() });
+            ++found;
+        }
+        return;
+    }
+
+    EntryLookup handler(wanted, func);
+    parse_history(m_Path, handler);
+}
+
+std::vector<uint32_t> CHistoryBackendJson::DeleteEntries(const std::vector<uint32_t>& ids)
+{
+    const std::unordered_set<uint32_t> doomed(ids.begin(), ids.end());
+    std::vector<uint32_t>              deleted;
+    if (doomed.empty())
+        return deleted;
+
+    const int lock = Lock();
+    if (m_Loaded)
+    {
+        Refresh();
+        rapidjson::Value& entries = m_Doc["entries"];
+        for (auto it = entries.MemberBegin(); it != entries.MemberEnd();)
+        {
+            const uint32_t id = std::stoul(it->name.GetString());
+            if (doomed.find(id) == doomed.end())
+            {
+                ++it;
+                continue;
+            }
+
+            // drop its pin too, else a new entry getting the same id would be pinned
+            UpdatePin(id, false);
+            deleted.push_back(id);
+            it = entries.EraseMember(it);
+        }
+
+        if (!deleted.empty())
+            Save();
+        Unlock(lock);
+        return deleted;
+    }
+
+    write_history(m_Path, [&](FileWriter& writer) {
+        EntryFilter handler(doomed, writer);
+        parse_history(m_Path, handler);
+        deleted = std::move(handler.deleted);
+
+        // nothing to delete, keep the file as it is
+        return !deleted.empty();
+    });
+    Unlock(lock);
+    return deleted;
+}
+
+void CHistoryBackendJson::ForEachEntry(const std::function<void(uint32_t, std::string_view)>& func)
+{
+    if (!m_Loaded)
+        Load();
+
+    for (auto it = m_Doc["entries"].MemberBegin(); it != m_Doc["entries"].MemberEnd(); ++it)
+        func(std::stoul(it->name.GetString()), { it->value.GetString(), it->value.GetStringLength() });
+}
+
+void CHistoryBackendJson::GetEntryTable(EntryTable& table)
+{
+    if (!m_Loaded)
+        Load();
+
+    const rapidjson::Value& entries = m_Doc["entries"];
+    table.ids.clear();
+    table.values.clear();
+    table.storage.clear();
+    table.ids.reserve(entries.MemberCount());
+    table.values.reserve(entries.MemberCount());
+
+    for (auto it = entries.MemberBegin(); it != entries.MemberEnd(); ++it)
+    {
+        table.ids.push_back(std::stoul(it->name.GetString()));
+        table.values.emplace_back(it->value.GetString(), it->value.GetStringLength());
+    }
+}
+
+std::vector<uint32_t> CHistoryBackendJson::GetAllIds()
+{
+    if (!m_Loaded)
+        Load();
+
+    std::vector<uint32_t> ids;
+    ids.reserve(m_Doc["entries"].MemberCount());
+    for (auto it = m_Doc["entries"].MemberBegin(); it != m_Doc["entries"].MemberEnd(); ++it)
+        ids.push_back(std::stoul(it->name.GetString()));
+
+    return ids;
+}
+
+bool CHistoryBackendJson::SetPinned(const uint32_t id, const bool pinned)
+{
+    const int lock = Lock();
+    Refresh();
+
+    const bool found = m_Doc["entries"].HasMember(fmt::to_string(id).c_str());
+    if (found && UpdatePin(id, pinned))
+        Save();
+
+    Unlock(lock);
+    return found;
+}
+
+bool CHistoryBackendJson::UpdatePin(const uint32_t id, const bool pinned)
+{
+    rapidjson::Document::AllocatorType& allocator = m_Doc.GetAllocator();
+    if (!m_Doc.HasMember("pinned") || !m_Doc["pinned"].IsArray())
+    {
+        m_Doc.RemoveMember("pinned");
+        m_Doc.AddMember("pinned", rapidjson::Value(rapidjson::kArrayType), allocator);
+    }
+
+    rapidjson::Value& pins = m_Doc["pinned"];
+    for (auto it = pins.Begin(); it != pins.End(); ++it)
+    {
+        if (it->IsUint() && it->GetUint() == id)
+        {
+            if (pinned)
+                return false;
+
+            pins.Erase(it);
+            return true;
+        }
+    }
+
+    if (pinned)
+        pins.PushBack(id, allocator);
+    return pinned;
+}
+
+std::vector<uint32_t> CHistoryBackendJson::EnforceRetention()
+{
+    std::vector<uint32_t> evicted;
+    if (config.max_entries == 0 && config.max_history_size == 0)
+        return evicted;
+
+    const int lock = Lock();
+    Refresh();
+
+    std::unordered_set<uint32_t> pins;
+    if (m_Doc.HasMember("pinned") && m_Doc["pinned"].IsArray())
+        for (const rapidjson::Value& pin : m_Doc["pinned"].GetArray())
+            if (pin.IsUint())
+                pins.insert(pin.GetUint());
+
+    rapidjson::Value& entries = m_Doc["entries"];
+    uint64_t          count   = entries.MemberCount();
+    uint64_t          bytes   = 0;
+    for (auto it = entries.MemberBegin(); it != entries.MemberEnd(); ++it)
+        bytes += it->value.GetStringLength();
+
+    // the oldest entries are the first ones
+    for (auto it = entries.MemberBegin(); it != entries.MemberEnd();)
+    {
+        if ((config.max_entries == 0 || count <= config.max_entries) &&
+            (config.max_history_size == 0 || bytes <= config.max_history_size))
+            break;
+
+        const uint32_t id = std::stoul(it->name.GetString());
+        if (pins.find(id) != pins.end())
+        {
+            ++it;
+            continue;
+        }
+
+        evicted.push_back(id);
+        --count;
+        bytes -= it->value.GetStringLength();
+        it = entries.EraseMember(it);
+    }
+
+    if (!evicted.empty())
+        Save();
+    Unlock(lock);
+    return evicted;
+}
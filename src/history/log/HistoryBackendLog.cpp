@@ -0,0 +1,1225 @@
+#include "history/log/HistoryBackendLog.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <ctime>
+#include <limits>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "config.hpp"
+#include "util.hpp"
+
+constexpr char     LOG_MAGIC[8]  = { 'C', 'L', 'P', 'Y', 'H', 'I', 'S', 'T' };
+constexpr uint32_t LOG_VERSION   = 1;
+constexpr size_t   CHECKSUM_SKIP = sizeof(CHistoryBackendLog::RecordHeader::checksum);
+
+// appends are fsynced in groups: right away when the last fsync is old enough, else after this many records
+// or by the next Sync(), which the listener calls every SYNC_INTERVAL
+constexpr auto   SYNC_INTERVAL = std::chrono::seconds(1);
+constexpr size_t SYNC_RECORDS  = 64;
+
+constexpr char     INDEX_MAGIC[8] = { 'C', 'L', 'P', 'Y', 'L', 'I', 'D', 'X' };
+constexpr uint32_t INDEX_VERSION  = 2;  // 1 had a struct per entry instead of the columns
+
+// Ranges of the header locked by writers: appending moves next_id and end, compacting replaces the whole log,
+// so both can happen at the same time until the compacted log gets renamed over, which needs both.
+constexpr off_t APPEND_LOCK_START  = offsetof(CHistoryBackendLog::FileHeader, next_id);
+constexpr off_t APPEND_LOCK_LEN    = sizeof(CHistoryBackendLog::FileHeader) - APPEND_LOCK_START;
+constexpr off_t COMPACT_LOCK_START = 0;
+constexpr off_t COMPACT_LOCK_LEN   = APPEND_LOCK_START;
+
+// times Compact() starts over when other instances appended while it was copying the log
+constexpr int COMPACT_ATTEMPTS = 3;
+
+// smaller contents barely shrink even with a dictionary, it's not worth decompressing them
+constexpr size_t COMPRESS_MIN_SIZE = 32;
+
+// the dictionary is trained on up to DICT_SAMPLE_BYTES of the newest entries, each cut to DICT_SAMPLE_MAX,
+// and only once there are DICT_MIN_SAMPLES of them, with fewer zstd can't make a useful one
+constexpr size_t DICT_CAPACITY     = 32 * 1024;
+constexpr size_t DICT_MIN_SAMPLES  = 128;
+constexpr size_t DICT_SAMPLE_MAX   = 16 * 1024;
+constexpr size_t DICT_SAMPLE_BYTES = 4 * 1024 * 1024;
+
+// a new dictionary gets trained once the entries copied since the last one are this fraction of the history,
+// and every DICT_HOLDOUT_EVERY-th sample is kept out of training, to check it does better than the old one
+constexpr size_t DICT_RETRAIN_FRACTION = 4;
+constexpr size_t DICT_HOLDOUT_EVERY    = 8;
+
+static uint64_t new_generation()
+{
+    std::random_device random;
+    return (static_cast<uint64_t>(random()) << 32) | random();
+}
+
+static uint32_t record_checksum(const CHistoryBackendLog::RecordHeader& rec, const std::string_view payload)
+{
+    const uint32_t crc = crc32_checksum(reinterpret_cast<const char*>(&rec) + CHECKSUM_SKIP, sizeof(rec) - CHECKSUM_SKIP);
+    return crc32_checksum(payload.data(), payload.size(), crc);
+}
+
+/*
+ * Write a record at offset of fd.
+ * @return The record size, or 0 if it failed
+ */
+static size_t write_record(const int fd, const uint64_t offset, const CHistoryBackendLog::RecordType type,
+                           const uint32_t id, const int64_t time, const std::string_view payload,
+                           const uint8_t flags = 0)
+{
+    CHistoryBackendLog::RecordHeader rec{};
+    rec.type     = type;
+    rec.flags    = flags;
+    rec.id       = id;
+    rec.size     = payload.size();
+    rec.time     = time;
+    rec.checksum = record_checksum(rec, payload);
+
+    struct iovec iov[2] = { { &rec, sizeof(rec) }, { const_cast<char*>(payload.data()), payload.size() } };
+    const size_t total  = sizeof(rec) + payload.size();
+    return pwritev(fd, iov, 2, offset) == static_cast<ssize_t>(total) ? total : 0;
+}
+
+bool CHistoryBackendLog::IsLogFile(const std::string& path)
+{
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    char       magic[sizeof(LOG_MAGIC)];
+    const bool ret = read(fd, magic, sizeof(magic)) == sizeof(magic) && memcmp(magic, LOG_MAGIC, sizeof(magic)) == 0;
+    close(fd);
+    return ret;
+}
+
+std::string CHistoryBackendLog::GetIndexPath(const std::string& path)
+{
+    return path + ".idx";
+}
+
+CHistoryBackendLog::CHistoryBackendLog(const std::string& path) : m_Path(path)
+{
+    Open();
+}
+
+CHistoryBackendLog::~CHistoryBackendLog()
+{
+    Flush();
+
+    if (m_Index)
+        munmap(const_cast<IndexHeader*>(m_Index), m_IndexSize);
+    if (m_Fd >= 0)
+        close(m_Fd);
+}
+
+void CHistoryBackendLog::Open()
+{
+    m_Fd = open(m_Path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (m_Fd < 0)
+        die("Failed to open clipboard history at '{}': {}", m_Path, strerror(errno));
+
+    struct stat st;
+    if (fstat(m_Fd, &st) != 0)
+        die("Failed to stat clipboard history at '{}': {}", m_Path, strerror(errno));
+
+    // another instance may be creating it too, only one of us writes the header
+    if (st.st_size == 0)
+    {
+        if (!lock_file_range(m_Fd, APPEND_LOCK_START, APPEND_LOCK_LEN))
+            die("Failed to lock clipboard history at '{}': {}", m_Path, strerror(errno));
+
+        if (fstat(m_Fd, &st) == 0 && st.st_size == 0)
+        {
+            FileHeader header{};
+            memcpy(header.magic, LOG_MAGIC, sizeof(LOG_MAGIC));
+            header.version    = LOG_VERSION;
+            header.end        = sizeof(FileHeader);
+            header.generation = new_generation();
+            WriteHeader(header);
+        }
+        unlock_file_range(m_Fd, APPEND_LOCK_START, APPEND_LOCK_LEN);
+    }
+
+    const FileHeader& header = ReadHeader();
+    if (memcmp(header.magic, LOG_MAGIC, sizeof(LOG_MAGIC)) != 0)
+        die("Clipboard history at '{}' is not a clippyman history", m_Path);
+    if (header.version != LOG_VERSION)
+        die("Clipboard history at '{}' has an unsupported version ({})", m_Path, header.version);
+}
+
+void CHistoryBackendLog::Reopen()
+{
+    debug("clipboard history at '{}' got compacted by another clippyman instance, opening it again", m_Path);
+
+    // what we appended to the old one was copied into the new one before it got renamed
+    Sync();
+    close(m_Fd);
+    m_AppendLocked = false;
+    Open();
+
+    m_Loaded         = false;
+    m_ReplayedOffset = sizeof(FileHeader);
+    m_LiveBytes      = 0;
+    m_DeadBytes      = 0;
+    m_IndexEnd       = 0;
+    m_DictId         = 0;
+    m_DictTime       = 0;
+    m_DictLoaded     = false;
+    m_Records.clear();
+    m_Hashes.clear();
+    if (m_Index)
+    {
+        munmap(const_cast<IndexHeader*>(m_Index), m_IndexSize);
+        m_Index = nullptr;
+    }
+}
+
+void CHistoryBackendLog::LockAppend()
+{
+    while (true)
+    {
+        if (!lock_file_range(m_Fd, APPEND_LOCK_START, APPEND_LOCK_LEN))
+            die("Failed to lock clipboard history at '{}': {}", m_Path, strerror(errno));
+
+        // we may have waited on the lock of a log that has been compacted meanwhile
+        if (!file_was_replaced(m_Fd, m_Path))
+            break;
+        Reopen();
+    }
+    m_AppendLocked = true;
+}
+
+void CHistoryBackendLog::UnlockAppend()
+{
+    unlock_file_range(m_Fd, APPEND_LOCK_START, APPEND_LOCK_LEN);
+    m_AppendLocked = false;
+}
+
+CHistoryBackendLog::FileHeader CHistoryBackendLog::ReadHeader() const
+{
+    FileHeader header;
+    if (pread(m_Fd, &header, sizeof(header), 0) != sizeof(header))
+        die("Failed to read the header of clipboard history at '{}'", m_Path);
+
+    return header;
+}
+
+void CHistoryBackendLog::WriteHeader(const FileHeader& header)
+{
+    if (pwrite(m_Fd, &header, sizeof(header), 0) != sizeof(header))
+        die("Failed to write the header of clipboard history at '{}': {}", m_Path, strerror(errno));
+}
+
+void CHistoryBackendLog::AppendRecord(FileHeader& header, const RecordType type, const uint32_t id,
+                                      const std::string_view payload, const uint8_t flags)
+{
+    // Write past the last complete record, then move the end in the header.
+    // If we crash in between, the half written record is just overwritten by the next one.
+    // If the header reaches the disk before the record, Replay() drops the torn record.
+    const size_t total = write_record(m_Fd, header.end, type, id, std::time(nullptr), payload, flags);
+    if (total == 0)
+        die("Failed to write into clipboard history at '{}': {}", m_Path, strerror(errno));
+
+    header.end += total;
+    WriteHeader(header);
+
+    if (++m_Unsynced >= SYNC_RECORDS || std::chrono::steady_clock::now() - m_LastSync >= SYNC_INTERVAL)
+        Sync();
+}
+
+void CHistoryBackendLog::Sync()
+{
+    if (m_Unsynced == 0)
+        return;
+
+    if (fdatasync(m_Fd) != 0)
+        warn("Failed to sync clipboard history at '{}': {}", m_Path, strerror(errno));
+    m_Unsynced = 0;
+    m_LastSync = std::chrono::steady_clock::now();
+}
+
+bool CHistoryBackendLog::MapIndex()
+{
+    if (m_Index)
+        return true;
+
+    const int fd = open(GetIndexPath(m_Path).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    void*       map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(IndexHeader))
+        map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    // it's only a cache, anything wrong with it just means replaying the whole log
+    const IndexHeader* index  = static_cast<const IndexHeader*>(map);
+    const FileHeader&  header = ReadHeader();
+    if (memcmp(index->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 || index->version != INDEX_VERSION ||
+        index->generation != header.generation || index->end > header.end ||
+        index->count > static_cast<size_t>(st.st_size) || IndexFileSize(index->count) != static_cast<size_t>(st.st_size))
+    {
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    const size_t count = index->count;
+    const char*  data  = reinterpret_cast<const char*>(index + 1);
+    m_IndexColumns.ids     = reinterpret_cast<const uint32_t*>(data);
+    m_IndexColumns.sizes   = m_IndexColumns.ids + count;
+    m_IndexColumns.offsets = reinterpret_cast<const uint64_t*>(m_IndexColumns.sizes + count);
+    m_IndexColumns.hashes  = m_IndexColumns.offsets + count;
+    m_IndexColumns.records = m_IndexColumns.hashes + count;
+    m_IndexColumns.times   = reinterpret_cast<const int64_t*>(m_IndexColumns.records + count);
+    m_IndexColumns.flags   = reinterpret_cast<const uint8_t*>(m_IndexColumns.times + count);
+
+    m_Index     = index;
+    m_IndexSize = st.st_size;
+    m_IndexEnd  = index->end;
+    return true;
+}
+
+size_t CHistoryBackendLog::IndexFileSize(const uint64_t count)
+{
+    return sizeof(IndexHeader) +
+           count * (2 * sizeof(uint32_t) + 3 * sizeof(uint64_t) + sizeof(int64_t) + sizeof(uint8_t));
+}
+
+bool CHistoryBackendLog::IndexIsCurrent()
+{
+    if (!MapIndex())
+        return false;
+
+    const FileHeader& header = ReadHeader();
+    return m_Index->generation == header.generation && m_Index->end == header.end;
+}
+
+bool CHistoryBackendLog::FindInIndex(const uint32_t id, size_t& pos) const
+{
+    // only the id column gets touched
+    const uint32_t* begin = m_IndexColumns.ids;
+    const uint32_t* end   = begin + m_Index->count;
+    const uint32_t* it    = std::lower_bound(begin, end, id);
+
+    pos = it - begin;
+    return it != end && *it == id;
+}
+
+void CHistoryBackendLog::SaveIndex()
+{
+    // other instances may be saving theirs at the same time
+    const std::string& path    = GetIndexPath(m_Path);
+    const std::string& tmpPath = path + fmt::format(".{}.tmp", getpid());
+    const int          fd      = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        debug("Failed to create '{}': {}", tmpPath, strerror(errno));
+        return;
+    }
+
+    IndexHeader index{};
+    memcpy(index.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    index.version    = INDEX_VERSION;
+    index.generation = ReadHeader().generation;
+    index.end        = m_ReplayedOffset;
+    index.live_bytes = m_LiveBytes;
+    index.dead_bytes = m_DeadBytes;
+    index.count      = m_Records.size();
+
+    // laid out like IndexColumns
+    const size_t          count = m_Records.size();
+    std::vector<uint32_t> ids, sizes;
+    std::vector<uint64_t> offsets, hashes, records;
+    std::vector<int64_t>  times;
+    std::vector<uint8_t>  flags;
+    ids.reserve(count);
+    sizes.reserve(count);
+    offsets.reserve(count);
+    hashes.reserve(count);
+    records.reserve(count);
+    times.reserve(count);
+    flags.reserve(count);
+    for (const auto& [id, record] : m_Records)
+    {
+        ids.push_back(id);
+        sizes.push_back(record.size);
+        offsets.push_back(record.offset);
+        hashes.push_back(record.hash);
+        records.push_back(record.record);
+        times.push_back(record.time);
+        flags.push_back((record.pinned ? RECORD_FLAG_PINNED : 0) | (record.compressed ? RECORD_FLAG_COMPRESSED : 0));
+    }
+
+    struct iovec iov[8] = { { &index, sizeof(index) },
+                            { ids.data(), count * sizeof(uint32_t) },
+                            { sizes.data(), count * sizeof(uint32_t) },
+                            { offsets.data(), count * sizeof(uint64_t) },
+                            { hashes.data(), count * sizeof(uint64_t) },
+                            { records.data(), count * sizeof(uint64_t) },
+                            { times.data(), count * sizeof(int64_t) },
+                            { flags.data(), count * sizeof(uint8_t) } };
+    if (writev(fd, iov, 8) != static_cast<ssize_t>(IndexFileSize(count)) || fsync(fd) != 0 ||
+        rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        debug("Failed to write '{}': {}", path, strerror(errno));
+        close(fd);
+        unlink(tmpPath.c_str());
+        return;
+    }
+    close(fd);
+
+    // the old one is for an older state of the log
+    if (m_Index)
+    {
+        munmap(const_cast<IndexHeader*>(m_Index), m_IndexSize);
+        m_Index = nullptr;
+    }
+    m_IndexEnd = m_ReplayedOffset;
+}
+
+void CHistoryBackendLog::Flush()
+{
+    Sync();
+    if (m_Loaded && m_ReplayedOffset != m_IndexEnd)
+        SaveIndex();
+}
+
+void CHistoryBackendLog::ReadContent(const uint64_t offset, const uint32_t size, const bool compressed,
+                                     std::string& content)
+{
+    std::string  frame;
+    std::string& buf = compressed ? frame : content;
+    buf.resize(size);
+    if (pread(m_Fd, buf.data(), size, offset) != static_cast<ssize_t>(size))
+        die("Failed to read clipboard history at '{}': {}", m_Path, strerror(errno));
+
+    if (compressed)
+        DecompressContent(frame, content);
+}
+
+CZstd* CHistoryBackendLog::GetZstd()
+{
+    if (!m_Zstd && CZstd::IsAvailable())
+        m_Zstd = std::make_unique<CZstd>();
+    return m_Zstd.get();
+}
+
+bool CHistoryBackendLog::ReadDictionary(std::string& dict, int64_t& time) const
+{
+    RecordHeader      rec;
+    const FileHeader& header = ReadHeader();
+    if (header.end < sizeof(FileHeader) + sizeof(rec) ||
+        pread(m_Fd, &rec, sizeof(rec), sizeof(FileHeader)) != sizeof(rec) || rec.type != RECORD_DICT ||
+        sizeof(FileHeader) + sizeof(rec) + rec.size > header.end)
+        return false;
+
+    time = rec.time;
+    dict.resize(rec.size);
+    return pread(m_Fd, dict.data(), rec.size, sizeof(FileHeader) + sizeof(rec)) == static_cast<ssize_t>(rec.size) &&
+           record_checksum(rec, dict) == rec.checksum;
+}
+
+void CHistoryBackendLog::LoadDictionary()
+{
+    if (m_DictLoaded || !GetZstd())
+        return;
+
+    m_DictLoaded = true;
+    std::string dict;
+    if (ReadDictionary(dict, m_DictTime))
+        m_DictId = m_Zstd->AddDictionary(dict);
+}
+
+bool CHistoryBackendLog::ShouldTrainDictionary() const
+{
+    // the newest entries are the last ones
+    size_t fresh = 0;
+    for (auto it = m_Records.rbegin(); it != m_Records.rend() && (m_DictId == 0 || it->second.time >= m_DictTime); ++it)
+        ++fresh;
+
+    return fresh >= std::max(DICT_MIN_SAMPLES, m_DictId == 0 ? 0 : m_Records.size() / DICT_RETRAIN_FRACTION);
+}
+
+bool CHistoryBackendLog::CompressContent(const std::string_view content, const uint64_t hash, const uint32_t dictId,
+                                         std::string& payload)
+{
+    std::string frame;
+    if (!config.compress || content.size() < COMPRESS_MIN_SIZE || !GetZstd() ||
+        !m_Zstd->Compress(content, dictId, frame) || frame.size() + sizeof(hash) >= content.size())
+        return false;
+
+    payload.assign(reinterpret_cast<const char*>(&hash), sizeof(hash));
+    payload += frame;
+    return true;
+}
+
+void CHistoryBackendLog::DecompressContent(const std::string_view frame, std::string& content, const size_t max)
+{
+    // compression may have been turned off since, the entries stay compressed until the next compaction
+    if (!GetZstd())
+        die("Clipboard history at '{}' is compressed, but libzstd.so.1 is not installed", m_Path);
+
+    const uint32_t dictId = CZstd::GetFrameDictionary(frame);
+    if (dictId != 0 && !m_Zstd->HasDictionary(dictId))
+        LoadDictionary();
+
+    if (!m_Zstd->Decompress(frame, content, max))
+        die("Failed to decompress an entry of clipboard history at '{}'", m_Path);
+}
+
+std::string CHistoryBackendLog::TrainDictionary()
+{
+    if (m_Records.size() < DICT_MIN_SAMPLES)
+        return {};
+
+    // the newest entries are the most like the ones to come, and links would only repeat a sample
+    std::vector<std::string> samples, holdout;
+    size_t                   bytes = 0;
+    std::string              content;
+    for (auto it = m_Records.rbegin(); it != m_Records.rend() && bytes < DICT_SAMPLE_BYTES; ++it)
+    {
+        const Record& record = it->second;
+        if (!OwnsContent(record))
+            continue;
+
+        ReadContent(record.offset, record.size, record.compressed, content);
+        if (content.size() > DICT_SAMPLE_MAX)
+            content.resize(DICT_SAMPLE_MAX);
+        bytes += content.size();
+        ((samples.size() + holdout.size() + 1) % DICT_HOLDOUT_EVERY == 0 ? holdout : samples).push_back(std::move(content));
+    }
+
+    if (samples.size() < DICT_MIN_SAMPLES)
+        return {};
+
+    std::string dict = CZstd::TrainDictionary({ samples.begin(), samples.end() }, DICT_CAPACITY);
+    if (dict.empty() || m_DictId == 0)
+        return dict;
+
+    const uint32_t dictId = m_Zstd->AddDictionary(dict);
+    if (dictId == 0 || dictId == m_DictId)
+        return {};
+
+    // what the entries kept out of training would take with each of them
+    size_t      oldSize = 0, newSize = 0;
+    std::string frame;
+    for (const std::string& sample : holdout)
+    {
+        oldSize += m_Zstd->Compress(sample, m_DictId, frame) ? frame.size() : sample.size();
+        newSize += m_Zstd->Compress(sample, dictId, frame) ? frame.size() : sample.size();
+    }
+
+    if (newSize >= oldSize)
+    {
+        debug("new compression dictionary for clipboard history doesn't do better ({} >= {} bytes), keeping the old one",
+              newSize, oldSize);
+        return {};
+    }
+    return dict;
+}
+
+void CHistoryBackendLog::Replay()
+{
+    // nobody can rename a compacted log over ours while we hold the append lock
+    if (!m_AppendLocked && file_was_replaced(m_Fd, m_Path))
+        Reopen();
+
+    if (!m_Loaded)
+    {
+        m_Loaded = true;
+        if (MapIndex())
+        {
+            const IndexColumns& columns = m_IndexColumns;
+            for (size_t i = 0; i < m_Index->count; ++i)
+            {
+                m_Records.emplace_hint(m_Records.end(), columns.ids[i],
+                                       Record{ columns.offsets[i], columns.sizes[i], columns.hashes[i],
+                                               columns.records[i], columns.times[i],
+                                               (columns.flags[i] & RECORD_FLAG_PINNED) != 0,
+                                               (columns.flags[i] & RECORD_FLAG_COMPRESSED) != 0 });
+                m_Hashes.emplace(columns.hashes[i], columns.ids[i]);
+            }
+            m_LiveBytes      = m_Index->live_bytes;
+            m_DeadBytes      = m_Index->dead_bytes;
+            m_ReplayedOffset = m_Index->end;
+
+            // from now on it's all in m_Records
+            munmap(const_cast<IndexHeader*>(m_Index), m_IndexSize);
+            m_Index = nullptr;
+        }
+    }
+
+    FileHeader  header = ReadHeader();
+    std::string payload, content;
+
+    while (m_ReplayedOffset + sizeof(RecordHeader) <= header.end)
+    {
+        RecordHeader   rec;
+        const uint64_t payload_offset = m_ReplayedOffset + sizeof(rec);
+
+        // Records are complete once the header counts them, so a bad one means we crashed before it reached the disk.
+        // Nothing after it can be trusted, so cut the log there instead of refusing to open it.
+        bool complete = pread(m_Fd, &rec, sizeof(rec), m_ReplayedOffset) == sizeof(rec) &&
+                        payload_offset + rec.size <= header.end;
+        if (complete)
+        {
+            payload.resize(rec.size);
+            complete = pread(m_Fd, payload.data(), rec.size, payload_offset) == static_cast<ssize_t>(rec.size) &&
+                       record_checksum(rec, payload) == rec.checksum;
+        }
+        if (!complete)
+        {
+            // another instance may have cut it already and appended over it, so look again holding the lock
+            const bool locked = m_AppendLocked;
+            if (!locked && !lock_file_range(m_Fd, APPEND_LOCK_START, APPEND_LOCK_LEN))
+                die("Failed to lock clipboard history at '{}': {}", m_Path, strerror(errno));
+
+            const FileHeader current = ReadHeader();
+            if (current.end != header.end)
+            {
+                if (!locked)
+                    unlock_file_range(m_Fd, APPEND_LOCK_START, APPEND_LOCK_LEN);
+                header = current;
+                continue;
+            }
+
+            warn("Clipboard history at '{}' is corrupted at offset {}, dropping the last {} bytes", m_Path,
+                 m_ReplayedOffset, header.end - m_ReplayedOffset);
+            header.end = m_ReplayedOffset;
+            WriteHeader(header);
+            fdatasync(m_Fd);
+            if (!locked)
+                unlock_file_range(m_Fd, APPEND_LOCK_START, APPEND_LOCK_LEN);
+            break;
+        }
+
+        switch (rec.type)
+        {
+            case RECORD_ADD:
+            {
+                // The hash is of the content, to find it again whether it gets stored compressed or not.
+                // Compressed ones have it before their frame, only the ones written before that get decompressed
+                const bool compressed = (rec.flags & RECORD_FLAG_COMPRESSED) != 0;
+                const bool hashed     = compressed && (rec.flags & RECORD_FLAG_HASHED) != 0;
+                uint64_t   hash       = 0;
+                size_t     skip       = 0;
+                if (hashed)
+                {
+                    if (rec.size < sizeof(hash))
+                    {
+                        warn("Dropping entry {} in clipboard history, its record is too short", rec.id);
+                        m_DeadBytes += sizeof(rec) + rec.size;
+                        break;
+                    }
+                    memcpy(&hash, payload.data(), sizeof(hash));
+                    skip = sizeof(hash);
+                }
+                else if (compressed)
+                {
+                    DecompressContent(payload, content);
+                    hash = xxh64_hash(content.data(), content.size());
+                }
+                else
+                {
+                    hash = xxh64_hash(payload.data(), payload.size());
+                }
+
+                m_Records[rec.id] = { payload_offset + skip,
+                                      static_cast<uint32_t>(rec.size - skip),
+                                      hash,
+                                        m_ReplayedOffset,
+                                        rec.time,
+                                        (rec.flags & RECORD_FLAG_PINNED) != 0,
+                                        compressed };
+                m_Hashes.emplace(hash, rec.id);
+                m_LiveBytes += sizeof(rec) + rec.size;
+                break;
+            }
+
+            case RECORD_LINK:
+            {
+                uint32_t source = 0;
+                if (rec.size == sizeof(source))
+                    memcpy(&source, payload.data(), sizeof(source));
+
+                // the entry having the content can't be deleted before the link gets written, unless another
+                // clippyman instance did it in between
+                const auto& it = m_Records.find(source);
+                if (rec.size != sizeof(source) || it == m_Records.end())
+                {
+                    warn("Dropping entry {} in clipboard history, it links to missing entry {}", rec.id, source);
+                    m_DeadBytes += sizeof(rec) + rec.size;
+                    break;
+                }
+
+                m_Records[rec.id] = { it->second.offset, it->second.size,
+                                      it->second.hash,   m_ReplayedOffset,
+                                      rec.time,          (rec.flags & RECORD_FLAG_PINNED) != 0,
+                                      it->second.compressed };
+                m_Hashes.emplace(it->second.hash, rec.id);
+                m_LiveBytes += sizeof(rec) + rec.size;
+                break;
+            }
+
+            case RECORD_DELETE:
+            {
+                m_DeadBytes += sizeof(rec);
+                const auto& it = m_Records.find(rec.id);
+                if (it != m_Records.end())
+                {
+                    const Record& record = it->second;
+                    m_LiveBytes -= RecordBytes(record);
+                    m_DeadBytes += RecordBytes(record);
+
+                    auto [begin, end] = m_Hashes.equal_range(record.hash);
+                    for (; begin != end; ++begin)
+                    {
+                        if (begin->second == rec.id)
+                        {
+                            m_Hashes.erase(begin);
+                            break;
+                        }
+                    }
+                    m_Records.erase(it);
+                }
+                break;
+            }
+
+            case RECORD_PIN:
+            {
+                // only needed until the next compaction, which moves it into the flags
+                m_DeadBytes += sizeof(rec) + rec.size;
+                const auto& it = m_Records.find(rec.id);
+                if (it != m_Records.end() && rec.size == 1)
+                    it->second.pinned = payload[0] != 0;
+                break;
+            }
+
+            case RECORD_DICT:
+                // LoadDictionary() reads it when it's needed
+                m_LiveBytes += sizeof(rec) + rec.size;
+                break;
+
+            default: warn("Unknown record type {} in clipboard history at offset {}", rec.type, m_ReplayedOffset);
+        }
+
+        m_ReplayedOffset = payload_offset + rec.size;
+    }
+}
+
+uint64_t CHistoryBackendLog::RecordBytes(const Record& record)
+{
+    // a link only takes its own record, the content stays with the entry having it
+    return OwnsContent(record) ? record.offset - record.record + record.size : sizeof(RecordHeader) + sizeof(uint32_t);
+}
+
+bool CHistoryBackendLog::OwnsContent(const Record& record)
+{
+    // the content is right after the record header, or after the hash of a compressed one
+    const uint64_t start = record.record + sizeof(RecordHeader);
+    return record.offset == start || record.offset == start + sizeof(uint64_t);
+}
+
+bool CHistoryBackendLog::FindContent(const std::string_view content, const uint64_t hash, uint32_t& id)
+{
+    std::string existing;
+    auto [begin, end] = m_Hashes.equal_range(hash);
+    for (; begin != end; ++begin)
+    {
+        const Record& record = m_Records.at(begin->second);
+        if (!record.compressed && record.size != content.size())
+            continue;
+
+        // the hash only tells they're most likely the same
+        ReadContent(record.offset, record.size, record.compressed, existing);
+
+        if (existing == content)
+        {
+            id = begin->second;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint32_t CHistoryBackendLog::AddEntry(const std::string_view content)
+{
+    // replay with the lock held, so the entry we link to can't get deleted by another instance in between
+    LockAppend();
+    Replay();
+    FileHeader     header = ReadHeader();
+    const uint32_t id     = header.next_id++;
+
+    uint32_t       source = 0;
+    std::string    payload;
+    const uint64_t hash = xxh64_hash(content.data(), content.size());
+    if (FindContent(content, hash, source))
+    {
+        AppendRecord(header, RECORD_LINK, id, { reinterpret_cast<const char*>(&source), sizeof(source) });
+    }
+    else
+    {
+        LoadDictionary();
+        if (CompressContent(content, hash, m_DictId, payload))
+            AppendRecord(header, RECORD_ADD, id, payload, RECORD_FLAG_COMPRESSED | RECORD_FLAG_HASHED);
+        else
+            AppendRecord(header, RECORD_ADD, id, content);
+    }
+    UnlockAppend();
+    return id;
+}
+
+bool CHistoryBackendLog::GetEntry(const uint32_t id, std::string& content)
+{
+    if (!m_Loaded && IndexIsCurrent())
+    {
+        size_t pos;
+        if (!FindInIndex(id, pos))
+            return false;
+
+        ReadContent(m_IndexColumns.offsets[pos], m_IndexColumns.sizes[pos],
+                    (m_IndexColumns.flags[pos] & RECORD_FLAG_COMPRESSED) != 0, content);
+        return true;
+    }
+
+    Replay();
+    const auto& it = m_Records.find(id);
+    if (it == m_Records.end())
+        return false;
+
+    ReadContent(it->second.offset, it->second.size, it->second.compressed, content);
+    return true;
+}
+
+void CHistoryBackendLog::GetEntries(const std::vector<uint32_t>& ids,
+                                    const std::function<void(uint32_t, std::string_view)>& func)
+{
+    if (m_Loaded || !IndexIsCurrent())
+    {
+        CHistoryBackend::GetEntries(ids, func);
+        return;
+    }
+
+    std::vector<uint32_t> sorted(ids);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    std::string content;
+    for (const uint32_t id : sorted)
+    {
+        size_t pos;
+        if (FindInIndex(id, pos))
+        {
+            ReadContent(m_IndexColumns.offsets[pos], m_IndexColumns.sizes[pos],
+                        (m_IndexColumns.flags[pos] & RECORD_FLAG_COMPRESSED) != 0, content);
+            func(id, content);
+        }
+    }
+}
+
+std::vector<uint32_t> CHistoryBackendLog::DeleteEntries(const std::vector<uint32_t>& ids)
+{
+    // Checked with the lock held: waiting on it may mean the log got compacted and reopened,
+    // or that someone appended more, so the index isn't current anymore
+    LockAppend();
+    if (m_Loaded || !IndexIsCurrent())
+    {
+        UnlockAppend();
+        return CHistoryBackend::DeleteEntries(ids);
+    }
+
+    std::vector<uint32_t> deleted(ids);
+    std::sort(deleted.begin(), deleted.end());
+    deleted.erase(std::unique(deleted.begin(), deleted.end()), deleted.end());
+    size_t pos;
+    deleted.erase(std::remove_if(deleted.begin(), deleted.end(), [&](const uint32_t id) { return !FindInIndex(id, pos); }),
+                  deleted.end());
+
+    // the next one replaying the log picks up the tombstones
+    FileHeader header = ReadHeader();
+    for (const uint32_t id : deleted)
+        AppendRecord(header, RECORD_DELETE, id, {});
+    UnlockAppend();
+    return deleted;
+}
+
+bool CHistoryBackendLog::DeleteEntry(const uint32_t id)
+{
+    LockAppend();
+    Replay();
+    if (m_Records.find(id) == m_Records.end())
+    {
+        UnlockAppend();
+        return false;
+    }
+
+    // Replay() will pick up the tombstone and do the bookkeeping
+    FileHeader header = ReadHeader();
+    AppendRecord(header, RECORD_DELETE, id, {});
+    Replay();
+    UnlockAppend();
+    return true;
+}
+
+void CHistoryBackendLog::ForEachEntry(const std::function<void(uint32_t, std::string_view)>& func)
+{
+    Replay();
+    std::string content;
+    for (const auto& [id, record] : m_Records)
+    {
+        ReadContent(record.offset, record.size, record.compressed, content);
+        func(id, content);
+    }
+}
+
+void CHistoryBackendLog::GetEntryTable(EntryTable& table)
+{ FillTable(table, SIZE_MAX); }
+
+void CHistoryBackendLog::GetPreviewTable(EntryTable& table, const size_t maxSize)
+{ FillTable(table, maxSize); }
+
+void CHistoryBackendLog::FillTable(EntryTable& table, const size_t maxSize)
+{
+    // an unchanged log doesn't need to be replayed, the columns have it all
+    const bool fromIndex = !m_Loaded && IndexIsCurrent();
+    if (!fromIndex)
+        Replay();
+
+    // the contents are never rewritten in place, so they can be read straight from the page cache
+    const size_t mapSize = fromIndex ? m_Index->end : m_ReplayedOffset;
+    void*        map     = mmap(nullptr, mapSize, PROT_READ, MAP_SHARED, m_Fd, 0);
+    if (map == MAP_FAILED)
+    {
+        CHistoryBackend::GetEntryTable(table);
+        for (std::string_view& value : table.values)
+            value = value.substr(0, utf8_prefix_size(value, maxSize));
+        return;
+    }
+
+    table.ids.clear();
+    table.values.clear();
+    table.storage.clear();
+    table.mapping.reset(map, [mapSize](const void* p) { munmap(const_cast<void*>(p), mapSize); });
+
+    // Compressed contents are decompressed into storage, once for all the entries linking to them,
+    // and only up to maxSize. It may move while it grows, so their views are only taken once it's full.
+    // content offset -> (offset, size) in storage
+    std::unordered_map<uint64_t, std::pair<size_t, size_t>> decompressed;
+    std::vector<std::pair<size_t, uint64_t>>                pending;  // value index, content offset
+    std::string                                             content;
+    const char*                                             base = static_cast<const char*>(map);
+    auto add = [&](const uint64_t offset, const uint32_t size, const bool compressed) {
+        if (compressed)
+        {
+            if (decompressed.find(offset) == decompressed.end())
+            {
+                // one more byte, to tell if the last character got cut
+                DecompressContent({ base + offset, size }, content, maxSize == SIZE_MAX ? maxSize : maxSize + 1);
+                decompressed.emplace(offset, std::make_pair(table.storage.size(), utf8_prefix_size(content, maxSize)));
+                table.storage += content;
+            }
+            pending.emplace_back(table.values.size(), offset);
+        }
+
+        const std::string_view value(base + offset, size);
+        table.values.push_back(value.substr(0, utf8_prefix_size(value, maxSize)));
+    };
+
+    if (fromIndex)
+    {
+        const size_t count = m_Index->count;
+        table.ids.assign(m_IndexColumns.ids, m_IndexColumns.ids + count);
+        table.values.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+            add(m_IndexColumns.offsets[i], m_IndexColumns.sizes[i],
+                (m_IndexColumns.flags[i] & RECORD_FLAG_COMPRESSED) != 0);
+    }
+    else
+    {
+        table.ids.reserve(m_Records.size());
+        table.values.reserve(m_Records.size());
+        for (const auto& [id, record] : m_Records)
+        {
+            table.ids.push_back(id);
+            add(record.offset, record.size, record.compressed);
+        }
+    }
+
+    for (const auto& [i, offset] : pending)
+    {
+        const auto& [start, size] = decompressed.at(offset);
+        table.values[i]           = { table.storage.data() + start, size };
+    }
+}
+
+std::vector<uint32_t> CHistoryBackendLog::GetAllIds()
+{
+    if (!m_Loaded && IndexIsCurrent())
+        return std::vector<uint32_t>(m_IndexColumns.ids, m_IndexColumns.ids + m_Index->count);
+
+    Replay();
+    std::vector<uint32_t> ids;
+    ids.reserve(m_Records.size());
+    for (const auto& [id, record] : m_Records)
+        ids.push_back(id);
+
+    return ids;
+}
+
+bool CHistoryBackendLog::SetPinned(const uint32_t id, const bool pinned)
+{
+    LockAppend();
+    Replay();
+    const auto& it = m_Records.find(id);
+    if (it == m_Records.end() || it->second.pinned == pinned)
+    {
+        UnlockAppend();
+        return it != m_Records.end();
+    }
+
+    const char payload = pinned;
+    FileHeader header  = ReadHeader();
+    AppendRecord(header, RECORD_PIN, id, { &payload, 1 });
+    Replay();
+    UnlockAppend();
+    return true;
+}
+
+std::vector<uint32_t> CHistoryBackendLog::EnforceRetention()
+{
+    // two instances evicting at the same time would both delete the oldest entries
+    LockAppend();
+    Replay();
+
+    const int64_t oldest = config.max_age > 0 ? std::time(nullptr) - config.max_age : std::numeric_limits<int64_t>::min();
+    uint64_t      entries = m_Records.size();
+    uint64_t      bytes   = m_LiveBytes;
+
+    // ids only grow, so the oldest entries are the first ones
+    std::vector<uint32_t> evicted;
+    for (const auto& [id, record] : m_Records)
+    {
+        if ((config.max_entries == 0 || entries <= config.max_entries) &&
+            (config.max_history_size == 0 || bytes <= config.max_history_size) && record.time >= oldest)
+            break;
+
+        if (record.pinned)
+            continue;
+
+        evicted.push_back(id);
+        --entries;
+        bytes -= RecordBytes(record);
+    }
+
+    if (evicted.empty())
+    {
+        UnlockAppend();
+        return evicted;
+    }
+
+    FileHeader header = ReadHeader();
+    for (const uint32_t id : evicted)
+        AppendRecord(header, RECORD_DELETE, id, {});
+    Replay();
+    UnlockAppend();
+
+    debug("deleted {} entries past the retention limits", evicted.size());
+    return evicted;
+}
+
+void CHistoryBackendLog::Compact()
+{
+    Replay();
+    const bool worth = m_DeadBytes != 0 && m_DeadBytes >= m_LiveBytes;
+
+    // a compressed log without a dictionary yet, or with one trained on too few of its entries,
+    // is also worth rewriting, to compress it all with a new one
+    LoadDictionary();
+    const bool train = config.compress && GetZstd() && ShouldTrainDictionary();
+    if (!worth && (!train || m_DictTrainingFailed))
+        return;
+
+    // another instance is already on it, we'll switch to its log on the next replay
+    if (!lock_file_range(m_Fd, COMPACT_LOCK_START, COMPACT_LOCK_LEN, false))
+        return;
+
+    // or it just finished, and ours isn't the log anymore
+    if (file_was_replaced(m_Fd, m_Path))
+    {
+        unlock_file_range(m_Fd, COMPACT_LOCK_START, COMPACT_LOCK_LEN);
+        return;
+    }
+
+    // the new log gets a new dictionary if it does better, else it keeps the one of the old log,
+    // with compression off, everything gets decompressed and it has none
+    std::string dict;
+    int64_t     dictTime = std::time(nullptr);
+    m_DictTrainingFailed = false;
+    if (train)
+    {
+        dict                 = TrainDictionary();
+        m_DictTrainingFailed = dict.empty();
+        if (dict.empty() && !worth)
+        {
+            debug("no new compression dictionary for clipboard history, not compacting it");
+            unlock_file_range(m_Fd, COMPACT_LOCK_START, COMPACT_LOCK_LEN);
+            return;
+        }
+    }
+    if (dict.empty() && config.compress && GetZstd())
+        ReadDictionary(dict, dictTime);
+
+    const uint32_t dictId = dict.empty() ? 0 : m_Zstd->AddDictionary(dict);
+    if (dictId == 0)
+        dict.clear();
+
+    const std::string& tmpPath = m_Path + ".tmp";
+    for (int attempt = 1; attempt <= COMPACT_ATTEMPTS; ++attempt)
+    {
+        const int fd = open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+            warn("Failed to compact clipboard history, couldn't create '{}': {}", tmpPath, strerror(errno));
+            break;
+        }
+
+        // other instances keep appending while we copy, without the append lock
+        const uint64_t copied = m_ReplayedOffset;
+        FileHeader     header = ReadHeader();
+        header.end            = sizeof(FileHeader);
+        header.generation     = new_generation();
+
+        // the first entry still using a content gets it, the other ones link to that one
+        // old content offset -> (new content offset, id of the entry having it)
+        std::unordered_map<uint64_t, std::pair<uint64_t, uint32_t>> contents;
+        std::map<uint32_t, Record>                                  records;
+        std::string                                                 buf, frame;
+        bool                                                        failed = false;
+
+        // first, so LoadDictionary() finds it without replaying
+        if (!dict.empty())
+        {
+            const size_t size = write_record(fd, header.end, RECORD_DICT, dictId, dictTime, dict);
+            failed            = size == 0;
+            header.end += size;
+        }
+
+        for (const auto& [id, record] : m_Records)
+        {
+            if (failed)
+                break;
+
+            uint8_t flags = record.pinned ? RECORD_FLAG_PINNED : 0;
+            size_t  size;
+            const auto& it = contents.find(record.offset);
+            if (it == contents.end())
+            {
+                // compressed again with the new dictionary, or decompressed if compression is off now
+                ReadContent(record.offset, record.size, record.compressed, buf);
+                const bool compressed = CompressContent(buf, record.hash, dictId, frame);
+                if (compressed)
+                    flags |= RECORD_FLAG_COMPRESSED | RECORD_FLAG_HASHED;
+
+                const std::string_view payload = compressed ? frame : buf;
+                const size_t           skip    = compressed ? sizeof(record.hash) : 0;
+                size = write_record(fd, header.end, RECORD_ADD, id, record.time, payload, flags);
+                contents.emplace(record.offset, std::make_pair(header.end + sizeof(RecordHeader) + skip, id));
+                records[id] = { header.end + sizeof(RecordHeader) + skip,
+                                static_cast<uint32_t>(payload.size() - skip),
+                                record.hash,
+                                header.end,
+                                record.time,
+                                record.pinned,
+                                compressed };
+            }
+            else
+            {
+                const uint32_t source = it->second.second;
+                size = write_record(fd, header.end, RECORD_LINK, id, record.time,
+                                    { reinterpret_cast<const char*>(&source), sizeof(source) }, flags);
+                const Record& owner = records.at(source);
+                records[id] = { it->second.first, owner.size,   record.hash,      header.end,
+                                record.time,      record.pinned, owner.compressed };
+            }
+
+            if (size == 0)
+            {
+                failed = true;
+                break;
+            }
+            header.end += size;
+        }
+
+        if (failed)
+        {
+            warn("Failed to compact clipboard history: {}", strerror(errno));
+            close(fd);
+            unlink(tmpPath.c_str());
+            break;
+        }
+
+        // nobody can append while we check the copy is still the whole log, then rename it over
+        if (!lock_file_range(m_Fd, APPEND_LOCK_START, APPEND_LOCK_LEN))
+            die("Failed to lock clipboard history at '{}': {}", m_Path, strerror(errno));
+        m_AppendLocked = true;
+
+        Replay();
+        if (m_ReplayedOffset != copied)
+        {
+            UnlockAppend();
+            close(fd);
+            unlink(tmpPath.c_str());
+            debug("clipboard history got appended while compacting it, trying again ({}/{})", attempt, COMPACT_ATTEMPTS);
+            continue;
+        }
+
+        if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header) || fsync(fd) != 0 ||
+            rename(tmpPath.c_str(), m_Path.c_str()) != 0)
+        {
+            warn("Failed to compact clipboard history: {}", strerror(errno));
+            UnlockAppend();
+            close(fd);
+            unlink(tmpPath.c_str());
+            break;
+        }
+        if (!sync_parent_dir(m_Path))
+            warn("Failed to sync the directory of clipboard history at '{}': {}", m_Path, strerror(errno));
+
+        debug("compacted clipboard history from {} to {} bytes", m_LiveBytes + m_DeadBytes + sizeof(FileHeader),
+              header.end);
+
+        // this drops our locks, the instances waiting on them will see the log got replaced
+        close(m_Fd);
+        m_Fd             = fd;
+        m_AppendLocked   = false;
+        m_Unsynced       = 0;
+        m_Records        = std::move(records);
+        m_ReplayedOffset = header.end;
+        m_LiveBytes      = header.end - sizeof(FileHeader);
+        m_DeadBytes      = 0;
+        m_DictId         = dictId;
+        m_DictTime       = dictTime;
+        m_DictLoaded     = true;
+
+        // the side index is for the old log now, Flush() writes a new one
+        m_IndexEnd = 0;
+        return;
+    }
+
+    unlock_file_range(m_Fd, COMPACT_LOCK_START, COMPACT_LOCK_LEN);
+}
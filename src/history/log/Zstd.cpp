@@ -0,0 +1,234 @@
+#include "history/log/Zstd.hpp"
+
+#include <dlfcn.h>
+
+#include <algorithm>
+
+#include "util.hpp"
+
+// only what we use of zstd.h and zdict.h, so they're not needed for building
+struct ZSTD_inBuffer
+{
+    const void* src;
+    size_t      size;
+    size_t      pos;
+};
+
+struct ZSTD_outBuffer
+{
+    void*  dst;
+    size_t size;
+    size_t pos;
+};
+
+using ZSTD_CCtx  = ZSTD_CCtx_s;
+using ZSTD_DCtx  = ZSTD_DCtx_s;
+using ZSTD_CDict = ZSTD_CDict_s;
+using ZSTD_DDict = ZSTD_DDict_s;
+
+constexpr int                ZSTD_reset_session_only  = 1;
+constexpr unsigned long long ZSTD_CONTENTSIZE_UNKNOWN = -1ULL;
+constexpr unsigned long long ZSTD_CONTENTSIZE_ERROR   = -2ULL;
+
+// clipboard entries are small, a higher level barely helps and makes every copy slower
+constexpr int COMPRESSION_LEVEL = 3;
+
+LIB_SYMBOL(size_t, ZSTD_compressBound, size_t srcSize);
+LIB_SYMBOL(unsigned, ZSTD_isError, size_t code);
+LIB_SYMBOL(ZSTD_CCtx*, ZSTD_createCCtx, void);
+LIB_SYMBOL(size_t, ZSTD_freeCCtx, ZSTD_CCtx* cctx);
+LIB_SYMBOL(ZSTD_DCtx*, ZSTD_createDCtx, void);
+LIB_SYMBOL(size_t, ZSTD_freeDCtx, ZSTD_DCtx* dctx);
+LIB_SYMBOL(size_t, ZSTD_compressCCtx, ZSTD_CCtx* cctx, void* dst, size_t dstCapacity, const void* src,
+           size_t srcSize, int compressionLevel);
+LIB_SYMBOL(ZSTD_CDict*, ZSTD_createCDict, const void* dictBuffer, size_t dictSize, int compressionLevel);
+LIB_SYMBOL(size_t, ZSTD_freeCDict, ZSTD_CDict* cdict);
+LIB_SYMBOL(size_t, ZSTD_compress_usingCDict, ZSTD_CCtx* cctx, void* dst, size_t dstCapacity, const void* src,
+           size_t srcSize, const ZSTD_CDict* cdict);
+LIB_SYMBOL(ZSTD_DDict*, ZSTD_createDDict, const void* dictBuffer, size_t dictSize);
+LIB_SYMBOL(size_t, ZSTD_freeDDict, ZSTD_DDict* ddict);
+LIB_SYMBOL(unsigned, ZSTD_getDictID_fromDict, const void* dict, size_t dictSize);
+LIB_SYMBOL(unsigned, ZSTD_getDictID_fromFrame, const void* src, size_t srcSize);
+LIB_SYMBOL(unsigned long long, ZSTD_getFrameContentSize, const void* src, size_t srcSize);
+LIB_SYMBOL(size_t, ZSTD_DCtx_reset, ZSTD_DCtx* dctx, int reset);
+LIB_SYMBOL(size_t, ZSTD_DCtx_refDDict, ZSTD_DCtx* dctx, const ZSTD_DDict* ddict);
+LIB_SYMBOL(size_t, ZSTD_decompressStream, ZSTD_DCtx* dctx, ZSTD_outBuffer* output, ZSTD_inBuffer* input);
+LIB_SYMBOL(size_t, ZDICT_trainFromBuffer, void* dictBuffer, size_t dictBufferCapacity, const void* samplesBuffer,
+           const size_t* samplesSizes, unsigned nbSamples);
+LIB_SYMBOL(unsigned, ZDICT_isError, size_t errorCode);
+
+// get a symbol into cf_<name>, or fail the whole library
+#define LOAD_ZSTD_SYMBOL(handle, name)                                          \
+    cf_##name = reinterpret_cast<decltype(cf_##name)>(dlsym(handle, #name));    \
+    if (!cf_##name)                                                             \
+        return false;
+
+static bool load_zstd()
+{
+    void* handle = LOAD_LIBRARY("libzstd.so.1");
+    if (!handle)
+        return false;
+
+    LOAD_ZSTD_SYMBOL(handle, ZSTD_compressBound);
+    LOAD_ZSTD_SYMBOL(handle, ZSTD_isError);
+    LOAD_ZSTD_SYMBOL(handle, ZSTD_createCCtx);
+    LOAD_ZSTD_SYMBOL(handle, ZSTD_freeCCtx);
+    LOAD_ZSTD_SYMBOL(handle, ZSTD_createDCtx);
+    LOAD_ZSTD_SYMBOL(handle, ZSTD_freeDCtx);
+    LOAD_ZSTD_SYMBOL(handle, ZSTD_compressCCtx);
+    LOAD_ZSTD_SYMBOL(handle, ZSTD_createCDict);
+    LOAD_ZSTD_SYMBOL(handle, ZSTD_freeCDict);
+    LOAD_ZSTD_SYMBOL(handle, ZSTD_compress_usingCDict);
+    LOAD_ZSTD_SYMBOL(handle, ZSTD_createDDict);
+    LOAD_ZSTD_SYMBOL(handle, ZSTD_freeDDict);
+    LOAD_ZSTD_SYMBOL(handle, ZSTD_getDictID_fromDict);
+    LOAD_ZSTD_SYMBOL(handle, ZSTD_getDictID_fromFrame);
+    LOAD_ZSTD_SYMBOL(handle, ZSTD_getFrameContentSize);
+    LOAD_ZSTD_SYMBOL(handle, ZSTD_DCtx_reset);
+    LOAD_ZSTD_SYMBOL(handle, ZSTD_DCtx_refDDict);
+    LOAD_ZSTD_SYMBOL(handle, ZSTD_decompressStream);
+    LOAD_ZSTD_SYMBOL(handle, ZDICT_trainFromBuffer);
+    LOAD_ZSTD_SYMBOL(handle, ZDICT_isError);
+    return true;
+}
+
+bool CZstd::IsAvailable()
+{
+    static const bool available = [] {
+        const bool loaded = load_zstd();
+        if (!loaded)
+            debug("libzstd.so.1 not found, the history won't be compressed");
+        return loaded;
+    }();
+    return available;
+}
+
+CZstd::CZstd()
+{
+    m_CCtx = cf_ZSTD_createCCtx();
+    m_DCtx = cf_ZSTD_createDCtx();
+    if (!m_CCtx || !m_DCtx)
+        die("Failed to create zstd contexts");
+}
+
+CZstd::~CZstd()
+{
+    for (const auto& it : m_Dicts)
+    {
+        cf_ZSTD_freeCDict(it.second.cdict);
+        cf_ZSTD_freeDDict(it.second.ddict);
+    }
+    cf_ZSTD_freeCCtx(m_CCtx);
+    cf_ZSTD_freeDCtx(m_DCtx);
+}
+
+uint32_t CZstd::AddDictionary(const std::string_view dict)
+{
+    const uint32_t id = cf_ZSTD_getDictID_fromDict(dict.data(), dict.size());
+    if (id == 0 || HasDictionary(id))
+        return id;
+
+    // both copy the dictionary, so it doesn't have to outlive them
+    Dictionary dictionary{ cf_ZSTD_createCDict(dict.data(), dict.size(), COMPRESSION_LEVEL),
+                           cf_ZSTD_createDDict(dict.data(), dict.size()) };
+    if (!dictionary.cdict || !dictionary.ddict)
+    {
+        cf_ZSTD_freeCDict(dictionary.cdict);
+        cf_ZSTD_freeDDict(dictionary.ddict);
+        return 0;
+    }
+
+    m_Dicts.emplace(id, dictionary);
+    return id;
+}
+
+bool CZstd::Compress(const std::string_view src, const uint32_t dictId, std::string& dst)
+{
+    const auto& it = m_Dicts.find(dictId);
+    if (dictId != 0 && it == m_Dicts.end())
+        return false;
+
+    dst.resize(cf_ZSTD_compressBound(src.size()));
+    const size_t size = dictId != 0 ? cf_ZSTD_compress_usingCDict(m_CCtx, dst.data(), dst.size(), src.data(),
+                                                                  src.size(), it->second.cdict)
+                                    : cf_ZSTD_compressCCtx(m_CCtx, dst.data(), dst.size(), src.data(), src.size(),
+                                                           COMPRESSION_LEVEL);
+    if (cf_ZSTD_isError(size))
+        return false;
+
+    dst.resize(size);
+    return true;
+}
+
+bool CZstd::Decompress(const std::string_view src, std::string& dst, const size_t max)
+{
+    const unsigned long long contentSize = cf_ZSTD_getFrameContentSize(src.data(), src.size());
+    if (contentSize == ZSTD_CONTENTSIZE_ERROR)
+        return false;
+
+    const uint32_t dictId = GetFrameDictionary(src);
+    const auto&    it     = m_Dicts.find(dictId);
+    if (dictId != 0 && it == m_Dicts.end())
+        return false;
+
+    cf_ZSTD_DCtx_reset(m_DCtx, ZSTD_reset_session_only);
+    cf_ZSTD_DCtx_refDDict(m_DCtx, dictId != 0 ? it->second.ddict : nullptr);
+
+    // the content size is always written by Compress(), so the output is sized once
+    const size_t size = contentSize == ZSTD_CONTENTSIZE_UNKNOWN ? max : std::min<unsigned long long>(contentSize, max);
+    dst.resize(size == SIZE_MAX ? src.size() * 4 : size);
+
+    // streaming, so it can stop once it has max bytes
+    ZSTD_inBuffer  in{ src.data(), src.size(), 0 };
+    ZSTD_outBuffer out{ dst.data(), dst.size(), 0 };
+    while (out.pos < max)
+    {
+        const size_t ret = cf_ZSTD_decompressStream(m_DCtx, &out, &in);
+        if (cf_ZSTD_isError(ret))
+            return false;
+        if (ret == 0)
+            break;
+
+        if (out.pos == out.size)
+        {
+            if (out.size >= max)
+                break;
+            dst.resize(std::min(std::max<size_t>(dst.size() * 2, 4096), max));
+            out.dst  = dst.data();
+            out.size = dst.size();
+        }
+        else if (in.pos == in.size)
+        {
+            // truncated frame
+            return false;
+        }
+    }
+
+    dst.resize(out.pos);
+    return true;
+}
+
+uint32_t CZstd::GetFrameDictionary(const std::string_view src)
+{
+    return cf_ZSTD_getDictID_fromFrame(src.data(), src.size());
+}
+
+std::string CZstd::TrainDictionary(const std::vector<std::string_view>& samples, const size_t capacity)
+{
+    std::string         buffer;
+    std::vector<size_t> sizes;
+    sizes.reserve(samples.size());
+    for (const std::string_view sample : samples)
+    {
+        buffer += sample;
+        sizes.push_back(sample.size());
+    }
+
+    std::string  dict(capacity, '\0');
+    const size_t size = cf_ZDICT_trainFromBuffer(dict.data(), dict.size(), buffer.data(), sizes.data(), sizes.size());
+    if (cf_ZDICT_isError(size))
+        return {};
+
+    dict.resize(size);
+    return dict;
+}
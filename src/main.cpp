@@ -6,6 +6,8 @@
 #include <memory>
 #include <algorithm>
 #include <cerrno>
+#include <charconv>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
@@ -13,22 +15,22 @@
 #include <filesystem>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 #include <vector>
-#include <chrono>
-#include <thread>
 
 #include "EventData.hpp"
+#include "EventLoop.hpp"
+#include "Search.hpp"
 #include "clipboard/ClipboardListener.hpp"
 #include "clipboard/unix/ClipboardListenerUnix.hpp"
 #include "config.hpp"
 #include "fmt/base.h"
 #include "fmt/format.h"
 #include "fmt/os.h"
-#include "rapidjson/document.h"
-#include "rapidjson/error/en.h"
-#include "rapidjson/filereadstream.h"
-#include "rapidjson/filewritestream.h"
-#include "rapidjson/prettywriter.h"
+#include "history/HistoryBackend.hpp"
+#include "history/daemon/HistoryClient.hpp"
+#include "history/daemon/HistoryServer.hpp"
+#include "history/index/TrigramIndex.hpp"
 #include "util.hpp"
 
 #if __linux__
@@ -48,10 +50,11 @@
 
 // include/config.hpp
 Config config;
+// include/history/HistoryBackend.hpp
+static std::unique_ptr<CHistoryBackend> history;
 // src/box.cpp
-void draw_search_box(const std::string& query, const std::vector<std::string>& results,
-                     const std::vector<std::string>& results_id, const size_t selected, size_t& scroll_offset,
-                     const size_t cursor_x, const bool is_search_tab);
+void draw_search_box(const std::string& query, const std::vector<uint32_t>& entries_id, const CSearch& search,
+                     const size_t selected, size_t& scroll_offset, const size_t cursor_x, const bool is_search_tab);
 void delete_draw_confirm(const int seloption);
 
 static void version()
@@ -71,7 +74,13 @@ R"(Usage: clippyman [OPTIONS]...
     -S, --silent                Silence some extra info text, useful for pipes or other operations
     -e, --get-entry [<id>]      Get an entry string by given ID (0, 24, ...) Not providing an ID will print all the existent entries with their ID
     -D, --delete-entry [<id>]   DELETE an entry string by given ID (0, 24, ...) Not providing an ID will DELETE all the existent entries
+    --pin <id>                  Pin an entry by given ID, pinned entries are never deleted by the retention limits in the config
+    --unpin <id>                Unpin an entry by given ID
+    --stats                     Print how many entries the running daemon has, and how many copies it queued or dropped
     --wl-seat <name>            The seat for using in wayland (just leave it empty if you don't know what's this)
+    --export <format>           Print the whole clipboard history in the given format (only "json" for now)
+    --import <format>           Append the entries of a clipboard history from stdin in the given format (only "json" for now)
+    -q, --query <text>          Print every entry containing text (case sensitive), along with their ID
     -s, --search                Delete/Search clipboard history.
                                 Press TAB to switch beetwen search bar and clipboard history.
                                 In clipboard history: press 'd' for delete, press enter for output selected text
@@ -94,66 +103,28 @@ void CopyCallback(const CopyEvent& event)
 
 void CopyEntry(const CopyEvent& event)
 {
-    FILE* file = fopen(config.path.c_str(), "r+");
-    if (!file)
-        die("Failed to open clipboard history at '{}': {}", config.path, strerror(errno));
-
-    rapidjson::Document       doc;
-    char                      buf[UINT16_MAX] = { 0 };
-    rapidjson::FileReadStream stream(file, buf, sizeof(buf));
-
-    if (doc.ParseStream(stream).HasParseError())
+    if (event.content.size() > config.max_copy_size)
     {
-        fclose(file);
-        die("Failed to parse {}: {} at offset {}", config.path, rapidjson::GetParseError_En(doc.GetParseError()),
-            doc.GetErrorOffset());
+        warn("Not saving a copy of {} bytes in the clipboard history, max-copy-size is {} MiB", event.content.size(),
+             config.max_copy_size >> 20);
+        return;
     }
 
-    rapidjson::Document::AllocatorType& allocator = doc.GetAllocator();
-
-    // add the new entry into entries, and set the id from the previous
-    // incremented id
-    unsigned int id = 0;
-    if (!doc["entries"].ObjectEmpty())
+    // the daemon saves it from its writer thread, so we can go back listening right away
+    if (CHistoryServer* server = dynamic_cast<CHistoryServer*>(history.get()))
     {
-        const auto& lastId = (doc["entries"].MemberEnd() - 1)->name;
-        id                 = std::stoi(lastId.GetString()) + 1;
+        server->QueueEntry(event.content);
+        return;
     }
-    rapidjson::GenericStringRef<char> id_ref(fmt::to_string(id).c_str());
-    rapidjson::Value                  value_content(event.content.c_str(), event.content.size(), allocator);
-    doc["entries"].AddMember(id_ref, value_content, allocator);
-
-    // seek back to the beginning to overwrite
-    fseek(file, 0, SEEK_SET);
-
-    char                                                writeBuffer[UINT16_MAX] = { 0 };
-    rapidjson::FileWriteStream                          writeStream(file, writeBuffer, sizeof(writeBuffer));
-    rapidjson::PrettyWriter<rapidjson::FileWriteStream> fileWriter(writeStream);
-    fileWriter.SetFormatOptions(rapidjson::kFormatSingleLineArray);  // Disable newlines between array elements
-    doc.Accept(fileWriter);
-
-    ftruncate(fileno(file), ftell(file));
-    fflush(file);
-    fclose(file);
+
+    history->AddEntry(event.content);
+    history->EnforceRetention();
 }
 
-void CreateInitialCache(const std::string& path)
+static bool str_to_id(const std::string_view str, uint32_t& id)
 {
-    if (access(path.data(), F_OK) == 0)
-        return;
-
-    constexpr std::string_view json =
-R"({
-    "entries": {}
-})";
-
-    const size_t pos = path.rfind('/');
-    if (pos != path.npos)
-        std::filesystem::create_directories(path.substr(0, pos));
-
-    auto f = fmt::output_file(path, fmt::file::CREATE | fmt::file::RDWR | fmt::file::TRUNC);
-    f.print("{}", json);
-    f.close();
+    const auto& [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), id);
+    return ec == std::errc() && ptr == str.data() + str.size();
 }
 
 /*static bool binarySearchJsonArray(const rapidjson::Value& arr, const long int target)
@@ -175,57 +146,63 @@ R"({
     return false;
 }*/
 
-static void removeEntries(std::vector<std::string>& results_value, std::vector<std::string>& results_id,
-                          const std::string& query)
+// let the daemon own the clipboard if it's running, so we don't have to stay around for serving it
+static void copy_to_clipboard(CClipboardListener& clipboardListener, const std::string& content)
 {
-    auto it_id = results_id.begin();
-
-    auto new_end = std::remove_if(results_value.begin(), results_value.end(), [&](const std::string& s) {
-        bool remove = !hasStart(s, query);
-        if (remove)
-            it_id = results_id.erase(it_id);
-        else
-            ++it_id;
-        return remove;
-    });
+    CHistoryClient* client = dynamic_cast<CHistoryClient*>(history.get());
+    if (client && client->CopyToClipboard(content))
+    {
+        if (!config.silent)
+            info("Copied to clipboard!");
+        return;
+    }
 
-    results_value.erase(new_end, results_value.end());
+    clipboardListener.CopyToClipboard(content);
 }
 
 #define SEARCH_TITLE_LEN (2 + 8)  // 2 for box border, 8 for "Search: "
-int search_algo(const CClipboardListener& clipboardListener, const Config& config)
+
+// how much of each entry gets loaded for listing them, more than fits in the few lines they get
+constexpr size_t TUI_PREVIEW_SIZE = 512;
+
+int search_algo(CClipboardListener& clipboardListener, const Config& config)
 {
     initscr();
     noecho();
     cbreak();              // Enable immediate character input
     keypad(stdscr, TRUE);  // Enable arrow keys
+    idlok(stdscr, TRUE);   // Let scrolling the results use the terminal scroll regions
 
-restart:
-    FILE* file = fopen(config.path.c_str(), "r+");
-    if (!file)
-        die("Failed to open clipboard history at '{}': {}", config.path, strerror(errno));
-
-    rapidjson::Document       doc;
-    char                      buf[UINT16_MAX] = { 0 };
-    rapidjson::FileReadStream stream(file, buf, sizeof(buf));
+    CTrigramIndex index(CTrigramIndex::GetIndexPath(config.path));
+    bool          index_synced = false;
 
-    if (doc.ParseStream(stream).HasParseError())
+restart:
+    // the entries are views into the history where possible, so they're not copied once more in here.
+    // Only their start at first, so big ones don't slow down showing the list,
+    // the whole of the cut ones gets loaded by the search once it needs them
+    EntryTable table;
+    history->GetPreviewTable(table, TUI_PREVIEW_SIZE);
+    const std::vector<uint32_t>&         entries_id    = table.ids;
+    const std::vector<std::string_view>& entries_value = table.values;
+    if (entries_id.empty() || entries_value.empty())
     {
-        fclose(file);
         endwin();
-        die("Failed to parse {}: {} at offset {}", config.path, rapidjson::GetParseError_En(doc.GetParseError()),
-            doc.GetErrorOffset());
+        die("Clipboard history at '{}' is empty", config.path);
     }
 
-    std::vector<std::string> entries_id, entries_value;
-    for (auto it = doc["entries"].MemberBegin(); it != doc["entries"].MemberEnd(); ++it)
-    {
-        entries_id.push_back(it->name.GetString());
-        entries_value.push_back(it->value.GetString());
-    }
-    std::vector<std::string> results(entries_value), results_id(entries_id);
-    if (entries_id.empty() || entries_value.empty())
-        die("Failed to parse clipboard history at '{}'", config.path);
+    const CSearch::BodyLoader load_bodies = [](const auto& ids, const auto& func) { history->GetEntries(ids, func); };
+
+    CSearch search(entries_value, entries_id, index, config.fuzzy_search, TUI_PREVIEW_SIZE, load_bodies);
+
+    // only exact queries of a trigram or more use the index, so it's read (and caught up) once the first one is typed
+    const auto set_query = [&](const std::string& query) {
+        if (!index_synced && !config.fuzzy_search && query.size() >= 3)
+        {
+            index.Sync(*history);
+            index_synced = true;
+        }
+        search.SetQuery(query);
+    };
 
     std::string query;
     int         ch            = 0;
@@ -235,17 +212,36 @@ restart:
     bool        is_search_tab = true;
 
     const int max_visible = ((getmaxy(stdscr) - 3) / 2) * 0.80f;
-    draw_search_box(query, entries_value, entries_id, selected, scroll_offset, cursor_x, is_search_tab);
+    draw_search_box(query, entries_id, search, selected, scroll_offset, cursor_x, is_search_tab);
     move(1, cursor_x);
 
     bool del          = false;
     bool del_selected = false;
-    while ((ch = getch()) != ERR)
+    while (true)
     {
-        if (!del && ch == 27)  // ESC
-            break;
+        // while searching in the background, wake up now and then to show the results
+        timeout(search.IsSearching() ? 10 : -1);
+        ch = getch();
 
-        if (ch == '\t')
+        if (ch == ERR)
+        {
+            if (!search.IsSearching())
+                break;
+            if (!search.Poll())
+                continue;
+
+            // the results changed under the selection
+            const size_t size = search.GetResults().size();
+            if (selected >= size)
+                selected = size > 0 ? size - 1 : 0;
+            if (scroll_offset > selected)
+                scroll_offset = selected;
+        }
+        else if (!del && ch == 27)  // ESC
+        {
+            break;
+        }
+        else if (ch == '\t')
         {
             is_search_tab = !is_search_tab;
         }
@@ -261,10 +257,8 @@ restart:
                     if (cursor_x > SEARCH_TITLE_LEN)
                         query.erase(--cursor_x - SEARCH_TITLE_LEN, 1);
 
-                    erased     = true;
-                    results    = entries_value;
-                    results_id = entries_id;
-                    removeEntries(results, results_id, query);
+                    erased = true;
+                    set_query(query);
                 }
             }
             else if (ch == KEY_LEFT)
@@ -291,18 +285,20 @@ restart:
                 selected      = 0;
                 scroll_offset = 0;
 
-                removeEntries(results, results_id, query);
+                set_query(query);
             }
         }
         else
         {
+            const std::vector<size_t>& results = search.GetResults();
+
             // go up
             if (ch == KEY_DOWN || ch == KEY_RIGHT)
             {
                 if (del)
                     del_selected = false;
 
-                else if (selected < results.size() - 1)
+                else if (selected + 1 < results.size())
                 {
                     ++selected;
                     if (selected >= scroll_offset + max_visible)
@@ -337,23 +333,12 @@ restart:
             {
                 del          = false;
                 del_selected = false;
-                results.clear();
-                entries_id.clear();
-                entries_value.clear();
-
-                doc["entries"].EraseMember(results_id[selected].c_str());
-                results_id.clear();
+                if (!results.empty())
+                    history->DeleteEntry(entries_id[results[selected]]);
+                history->Flush();
 
                 selected      = 0;
                 scroll_offset = 0;
-                fseek(file, 0, SEEK_SET);
-
-                char                                                writeBuffer[UINT16_MAX] = { 0 };
-                rapidjson::FileWriteStream                          writeStream(file, writeBuffer, sizeof(writeBuffer));
-                rapidjson::PrettyWriter<rapidjson::FileWriteStream> fileWriter(writeStream);
-                doc.Accept(fileWriter);
-                ftruncate(fileno(file), ftell(file));
-                fflush(file);
                 goto restart;  // yes... let's just restart everything for now
             }
             // operation delete and pressed 'q' or "no"
@@ -365,48 +350,38 @@ restart:
             else if (ch == '\n' && !results.empty())
             {
                 endwin();
-                clipboardListener.CopyToClipboard(results[selected]);
+
+                // the table may only have the start of big entries
+                std::string content;
+                if (!history->GetEntry(entries_id[results[selected]], content))
+                    die("Entry {} got deleted meanwhile", entries_id[results[selected]]);
+                copy_to_clipboard(clipboardListener, content);
                 return 0;
             }
         }
 
+        // the selected entry is shown whole
+        if (!is_search_tab && !search.GetResults().empty())
+            search.LoadBodies({ search.GetResults()[selected] });
+
         if (del)
             delete_draw_confirm(del_selected);
         else
-            draw_search_box(query, (query.empty() ? entries_value : results), (query.empty() ? entries_id : results_id), selected,
-                            scroll_offset, cursor_x, is_search_tab);
+            draw_search_box(query, entries_id, search, selected, scroll_offset, cursor_x, is_search_tab);
 
         curs_set(is_search_tab);
     }
 
-    fclose(file);
     endwin();
     return 0;
 }
 
-static std::vector<std::string> getAllEntries(const std::string& path)
+static std::vector<std::string> getAllEntries()
 {
-    FILE* file = fopen(path.c_str(), "r+");
-    if (!file)
-        die("Failed to open clipboard history at '{}': {}", path, strerror(errno));
-
-    rapidjson::Document       doc;
-    char                      buf[UINT16_MAX] = { 0 };
-    rapidjson::FileReadStream stream(file, buf, sizeof(buf));
-
-    if (doc.ParseStream(stream).HasParseError())
-    {
-        fclose(file);
-        endwin();
-        die("Failed to parse {}: {} at offset {}", path, rapidjson::GetParseError_En(doc.GetParseError()),
-            doc.GetErrorOffset());
-    }
-
     std::vector<std::string> entries_id;
-    for (auto it = doc["entries"].MemberBegin(); it != doc["entries"].MemberEnd(); ++it)
-        entries_id.push_back(it->name.GetString());
+    for (const uint32_t id : history->GetAllIds())
+        entries_id.push_back(fmt::to_string(id));
 
-    fclose(file);
     return entries_id;
 }
 
@@ -453,7 +428,7 @@ bool parseargs(int argc, char* argv[], Config& config, const std::string& config
     int opt               = 0;
     int option_index      = 0;
     opterr                = 1;  // re-enable since before we disabled for "invalid option" error
-    const char* optstring = "-Vhiscp:C:e::D::P::S";
+    const char* optstring = "-Vhiscp:C:q:e::D::P::S";
 
     // clang-format off
     static const struct option opts[] = {
@@ -467,15 +442,19 @@ bool parseargs(int argc, char* argv[], Config& config, const std::string& config
         {"primary",     optional_argument, 0, 'P'},
         {"path",        required_argument, 0, 'p'},
         {"config",      required_argument, 0, 'C'},
+        {"query",       required_argument, 0, 'q'},
         {"get-entry",   optional_argument, 0, 'e'},
         {"delete-entry",optional_argument, 0, 'D'},
         {"wl-seat",     required_argument, 0, 6968},
         {"gen-config",  optional_argument, 0, 6969},
+        {"export",      required_argument, 0, 6970},
+        {"import",      required_argument, 0, 6971},
+        {"pin",         required_argument, 0, 6972},
+        {"unpin",       required_argument, 0, 6973},
+        {"stats",       no_argument,       0, 6974},
 
         {0,0,0,0}
     };
-    bool get_all    = false;
-    bool delete_all = false;
 
     // clang-format on
     optind = 0;
@@ -493,6 +472,7 @@ bool parseargs(int argc, char* argv[], Config& config, const std::string& config
             case 's':  config.arg_search = true; break;
             case 'i':  config.arg_terminal_input = true; break;
             case 'c':  config.arg_copy_input = true; break;
+            case 'q':  config.arg_query = optarg; break;
             case 6968: config.wl_seat = optarg;
             case 'C':  break;  // we have already did it in parse_config_path()
 
@@ -500,14 +480,14 @@ bool parseargs(int argc, char* argv[], Config& config, const std::string& config
                 if (OPTIONAL_ARGUMENT_IS_PRESENT)
                     config.arg_entries.push_back(optarg);
                 else
-                    get_all = true;
+                    config.arg_entries_all = true;
                 break;
 
             case 'D': 
                 if (OPTIONAL_ARGUMENT_IS_PRESENT)
                     config.arg_entries_delete.push_back(optarg);
                 else
-                    delete_all = true;
+                    config.arg_entries_delete_all = true;
                 break;
 
             case 'P':
@@ -531,21 +511,13 @@ bool parseargs(int argc, char* argv[], Config& config, const std::string& config
                     config.generateConfig(configFile);
                 std::exit(EXIT_SUCCESS);
 
-            default: return false;
-        }
-    }
+            case 6970: config.arg_export_format = optarg; break;
+            case 6971: config.arg_import_format = optarg; break;
+            case 6972: config.arg_entries_pin.push_back(optarg); break;
+            case 6973: config.arg_entries_unpin.push_back(optarg); break;
+            case 6974: config.arg_stats = true; break;
 
-    if (delete_all || get_all)
-    {
-        const std::vector<std::string>& entries = getAllEntries(config.path);
-        if (config.arg_entries.empty() && get_all)
-            config.arg_entries = entries;
-        if (config.arg_entries_delete.empty() && delete_all)
-        {
-            if (askUserYorN(false, "Are You Sure You Want To DELETE ALL Entries? This action cannot be undone"))
-                config.arg_entries_delete = entries;
-            else
-                die("Exiting from operation");
+            default: return false;
         }
     }
 
@@ -576,62 +548,147 @@ int main(int argc, char* argv[])
     if (!parseargs(argc, argv, config, configFile))
         return 1;
 
-    CreateInitialCache(config.path);
+    // if the listener is running, it already has the whole history in memory
+    const std::string& socketPath = GetHistorySocketPath(config.path);
+    const bool         hasDaemon  = (history = CHistoryClient::Connect(socketPath)) != nullptr;
+    if (!hasDaemon)
+        history = OpenHistoryBackend(config.path);
     setlocale(LC_ALL, "");
 
-    if ((config.arg_search && config.arg_terminal_input) ||
-        (config.arg_search && config.arg_copy_input))
-        die("Please only use either --search or --input/--copy");
+    if (config.arg_stats)
+    {
+        if (!hasDaemon)
+            die("No clippyman daemon is running for '{}'", config.path);
+
+        uint32_t entries = 0, queued = 0;
+        uint64_t dropped = 0;
+        static_cast<CHistoryClient&>(*history).GetStats(entries, queued, dropped);
+        fmt::print("entries: {}\nqueued copies: {}\ndropped copies: {}\n", entries, queued, dropped);
+        return EXIT_SUCCESS;
+    }
 
-    if (!config.arg_entries.empty() || !config.arg_entries_delete.empty())
+    if (!config.arg_export_format.empty() || !config.arg_import_format.empty())
     {
-        FILE* file = fopen(config.path.c_str(), "r+");
-        if (!file)
-            die("Failed to open clipboard history at '{}': {}", config.path, strerror(errno));
+        if (!config.arg_export_format.empty() && config.arg_export_format != "json")
+            die("Unsupported export format '{}', only \"json\" is supported", config.arg_export_format);
+        if (!config.arg_import_format.empty() && config.arg_import_format != "json")
+            die("Unsupported import format '{}', only \"json\" is supported", config.arg_import_format);
 
-        rapidjson::Document       doc;
-        char                      buf[UINT16_MAX] = { 0 };
-        rapidjson::FileReadStream stream(file, buf, sizeof(buf));
+        if (!config.arg_import_format.empty())
+        {
+            const size_t count = ImportHistoryJson(*history, stdin);
+            history->EnforceRetention();
+            if (!config.silent)
+                info("Imported {} entries into '{}'", count, config.path);
+        }
+        if (!config.arg_export_format.empty())
+            ExportHistoryJson(*history, stdout);
+        return EXIT_SUCCESS;
+    }
 
-        if (doc.ParseStream(stream).HasParseError())
+    if (config.arg_entries_delete_all || config.arg_entries_all)
+    {
+        const std::vector<std::string>& entries = getAllEntries();
+        if (config.arg_entries.empty() && config.arg_entries_all)
+            config.arg_entries = entries;
+        if (config.arg_entries_delete.empty() && config.arg_entries_delete_all)
         {
-            fclose(file);
-            die("Failed to parse {}: {} at offset {}", config.path, rapidjson::GetParseError_En(doc.GetParseError()),
-                doc.GetErrorOffset());
+            if (askUserYorN(false, "Are You Sure You Want To DELETE ALL Entries? This action cannot be undone"))
+                config.arg_entries_delete = entries;
+            else
+                die("Exiting from operation");
         }
+    }
+
+    if (!config.arg_query.empty())
+    {
+        CTrigramIndex index(CTrigramIndex::GetIndexPath(config.path));
+        index.Sync(*history);
+
+        std::vector<uint32_t> candidates;
+        if (!index.GetCandidates(config.arg_query, candidates))
+            candidates = history->GetAllIds();
+
+        history->GetEntries(candidates, [](const uint32_t id, const std::string_view content) {
+            if (content.find(config.arg_query) == content.npos)
+                return;
 
+            if (config.silent)
+                fmt::println("{}", content);
+            else
+                fmt::println("{}: {}", id, content);
+        });
+        return EXIT_SUCCESS;
+    }
+
+    if ((config.arg_search && config.arg_terminal_input) ||
+        (config.arg_search && config.arg_copy_input))
+        die("Please only use either --search or --input/--copy");
+
+    if (!config.arg_entries.empty() || !config.arg_entries_delete.empty() || !config.arg_entries_pin.empty() ||
+        !config.arg_entries_unpin.empty())
+    {
+        uint32_t              id = 0;
+        std::vector<uint32_t> ids;
+
+        // fetched all at once, so a history that has to be scanned is only scanned once
+        for (const std::string& entry : config.arg_entries)
+            if (str_to_id(entry, id))
+                ids.push_back(id);
+
+        std::unordered_map<uint32_t, std::string> contents;
+        history->GetEntries(ids, [&](const uint32_t found, const std::string_view content) { contents.emplace(found, content); });
         for (const std::string& entry : config.arg_entries)
         {
-            if (doc["entries"].HasMember(entry.c_str()))
+            const auto& it = str_to_id(entry, id) ? contents.find(id) : contents.end();
+            if (it != contents.end())
             {
                 if (config.silent)
-                    fmt::println("{}", doc["entries"][entry.c_str()].GetString());
+                    fmt::println("{}", it->second);
                 else
-                    fmt::println("{}: {}", entry, doc["entries"][entry.c_str()].GetString());
+                    fmt::println("{}: {}", entry, it->second);
             }
             else if (!config.silent)
                 warn("Entry to get '{}' doesn't exist", entry);
         }
+
+        ids.clear();
+        for (const std::string& entry : config.arg_entries_delete)
+            if (str_to_id(entry, id))
+                ids.push_back(id);
+
+        const std::vector<uint32_t>& deleted = history->DeleteEntries(ids);
         for (const std::string& entry : config.arg_entries_delete)
         {
-            if (doc["entries"].HasMember(entry.c_str()))
+            if (str_to_id(entry, id) && std::find(deleted.begin(), deleted.end(), id) != deleted.end())
             {
                 if (!config.silent)
                     info("deleting entry '{}", entry);
-                doc["entries"].EraseMember(entry.c_str());
             }
             else if (!config.silent)
                 warn("Entry to delete '{}' doesn't exist", entry);
         }
-        fseek(file, 0, SEEK_SET);
-
-        char                                                writeBuffer[UINT16_MAX] = { 0 };
-        rapidjson::FileWriteStream                          writeStream(file, writeBuffer, sizeof(writeBuffer));
-        rapidjson::PrettyWriter<rapidjson::FileWriteStream> fileWriter(writeStream);
-        doc.Accept(fileWriter);
-        ftruncate(fileno(file), ftell(file));
-        fflush(file);
-        fclose(file);
+        for (const std::string& entry : config.arg_entries_pin)
+        {
+            if (str_to_id(entry, id) && history->SetPinned(id, true))
+            {
+                if (!config.silent)
+                    info("pinned entry '{}'", entry);
+            }
+            else if (!config.silent)
+                warn("Entry to pin '{}' doesn't exist", entry);
+        }
+        for (const std::string& entry : config.arg_entries_unpin)
+        {
+            if (str_to_id(entry, id) && history->SetPinned(id, false))
+            {
+                if (!config.silent)
+                    info("unpinned entry '{}'", entry);
+            }
+            else if (!config.silent)
+                warn("Entry to unpin '{}' doesn't exist", entry);
+        }
+        history->Flush();
         return EXIT_SUCCESS;
     }
 
@@ -656,7 +713,7 @@ int main(int argc, char* argv[])
         if (config.arg_copy_input)
         {
             std::unique_ptr<CClipboardListener> clipboardListener = GetAppropriateClipboardListener();
-            clipboardListener->CopyToClipboard(clipboardListenerUnix.getLastClipboardContent());
+            copy_to_clipboard(*clipboardListener, clipboardListenerUnix.getLastClipboardContent());
         }
         return EXIT_SUCCESS;
     }
@@ -696,21 +753,46 @@ int main(int argc, char* argv[])
         if (!gotstdin)
         {
             info("Type or Paste the text to copy into the clipboard, then press enter and CTRL+D to save and exit");
-            clipboardListener->CopyToClipboard(getin());
+            copy_to_clipboard(*clipboardListener, getin());
         }
         else
         {
-            clipboardListener->CopyToClipboard(clipboardListenerUnix.getLastClipboardContent());
+            copy_to_clipboard(*clipboardListener, clipboardListenerUnix.getLastClipboardContent());
         }
         return EXIT_SUCCESS;
     }
 
-    while (true)
+    // every source we care about is an fd in here: the display, the daemon socket, timers and signals
+    CEventLoop loop;
+    loop.AddSignal(SIGINT, [&loop] { loop.Stop(); });
+    loop.AddSignal(SIGTERM, [&loop] { loop.Stop(); });
+
+    // we are the listener, so become the daemon the other instances will talk to
+    if (!hasDaemon)
     {
-        // debug("POLLING");
-        clipboardListener->PollClipboard();
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        auto server = std::make_unique<CHistoryServer>(std::move(history), socketPath, loop);
+        server->SetCopyHandler(
+            [&](std::string content) { return clipboardListener->OwnSelection(std::move(content)); });
+        history = std::move(server);
     }
 
+    const int clipboardFd = clipboardListener->GetFd();
+    if (clipboardFd >= 0)
+    {
+        loop.AddFd(clipboardFd, [&] { clipboardListener->ProcessEvents(); });
+        // there may already be something queued before we start waiting
+        clipboardListener->ProcessEvents();
+    }
+    else
+    {
+        loop.AddTimer(std::chrono::milliseconds(50), [&] { clipboardListener->PollClipboard(); });
+    }
+
+    loop.AddTimer(std::chrono::minutes(10), [] { history->Compact(); });
+
+    loop.Run();
+
+    // the server is watched by the loop, so it must go away first
+    history.reset();
     return EXIT_SUCCESS;
 }
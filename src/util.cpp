@@ -1,6 +1,12 @@
 #include "util.hpp"
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <array>
+#include <cerrno>
 #include <cstdlib>
 #include <cstring>
 #include <filesystem>
@@ -16,6 +22,179 @@ bool hasStart(const std::string_view fullString, const std::string_view start)
     return (fullString.substr(0, start.size()) == start);
 }
 
+uint32_t crc32_checksum(const void* data, const size_t len, uint32_t crc)
+{
+    static const auto table = [] {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    crc              = ~crc;
+    for (size_t i = 0; i < len; ++i)
+        crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+// https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+constexpr uint64_t XXH_PRIME64_1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t XXH_PRIME64_3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t XXH_PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t XXH_PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t xxh_rotl(const uint64_t x, const int r)
+{ return (x << r) | (x >> (64 - r)); }
+
+static inline uint64_t xxh_read64(const uint8_t* p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t xxh_read32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, const uint64_t input)
+{
+    acc += input * XXH_PRIME64_2;
+    acc = xxh_rotl(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t xxh_merge_round(uint64_t acc, const uint64_t val)
+{
+    acc ^= xxh_round(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+uint64_t xxh64_hash(const void* data, const size_t len, const uint64_t seed)
+{
+    const uint8_t*       p   = static_cast<const uint8_t*>(data);
+    const uint8_t* const end = p + len;
+    uint64_t             h;
+
+    if (len >= 32)
+    {
+        uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t v2 = seed + XXH_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME64_1;
+        for (; p + 32 <= end; p += 32)
+        {
+            v1 = xxh_round(v1, xxh_read64(p));
+            v2 = xxh_round(v2, xxh_read64(p + 8));
+            v3 = xxh_round(v3, xxh_read64(p + 16));
+            v4 = xxh_round(v4, xxh_read64(p + 24));
+        }
+
+        h = xxh_rotl(v1, 1) + xxh_rotl(v2, 7) + xxh_rotl(v3, 12) + xxh_rotl(v4, 18);
+        h = xxh_merge_round(h, v1);
+        h = xxh_merge_round(h, v2);
+        h = xxh_merge_round(h, v3);
+        h = xxh_merge_round(h, v4);
+    }
+    else
+    {
+        h = seed + XXH_PRIME64_5;
+    }
+
+    h += len;
+    for (; p + 8 <= end; p += 8)
+        h = xxh_rotl(h ^ xxh_round(0, xxh_read64(p)), 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    if (p + 4 <= end)
+    {
+        h = xxh_rotl(h ^ (xxh_read32(p) * XXH_PRIME64_1), 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+        h = xxh_rotl(h ^ (*p * XXH_PRIME64_5), 11) * XXH_PRIME64_1;
+
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+size_t utf8_prefix_size(const std::string_view text, const size_t max)
+{
+    size_t size = std::min(text.size(), max);
+    while (size > 0 && size < text.size() && (static_cast<unsigned char>(text[size]) & 0xC0) == 0x80)
+        --size;
+    return size;
+}
+
+bool sync_parent_dir(const std::string& path)
+{
+    const size_t       pos = path.rfind('/');
+    const std::string& dir = pos == path.npos ? "." : pos == 0 ? "/" : path.substr(0, pos);
+
+    const int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    const bool ret = fsync(fd) == 0;
+    close(fd);
+    return ret;
+}
+
+// open file description locks are only on linux, elsewhere fall back to the per process ones
+#ifdef F_OFD_SETLKW
+constexpr int LOCK_CMD      = F_OFD_SETLK;
+constexpr int LOCK_CMD_WAIT = F_OFD_SETLKW;
+#else
+constexpr int LOCK_CMD      = F_SETLK;
+constexpr int LOCK_CMD_WAIT = F_SETLKW;
+#endif
+
+bool lock_file_range(const int fd, const off_t start, const off_t len, const bool wait)
+{
+    struct flock lock{};
+    lock.l_type   = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    lock.l_start  = start;
+    lock.l_len    = len;
+
+    int ret;
+    while ((ret = fcntl(fd, wait ? LOCK_CMD_WAIT : LOCK_CMD, &lock)) != 0 && errno == EINTR)
+        ;
+    return ret == 0;
+}
+
+void unlock_file_range(const int fd, const off_t start, const off_t len)
+{
+    struct flock lock{};
+    lock.l_type   = F_UNLCK;
+    lock.l_whence = SEEK_SET;
+    lock.l_start  = start;
+    lock.l_len    = len;
+    fcntl(fd, LOCK_CMD, &lock);
+}
+
+bool file_was_replaced(const int fd, const std::string& path)
+{
+    struct stat opened, current;
+    if (fstat(fd, &opened) != 0 || opened.st_nlink == 0 || stat(path.c_str(), &current) != 0)
+        return true;
+
+    return opened.st_dev != current.st_dev || opened.st_ino != current.st_ino;
+}
+
 void ctrl_d_handler(const std::istream& cin)
 {
     if (cin.eof())